@@ -16,12 +16,15 @@
 #include <vpb/System>
 #include <vpb/Version>
 #include <vpb/FileUtils>
+#include <vpb/SourceManifest>
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
 #include <iostream>
 
+#include <stdlib.h>
+
 int main(int argc, char** argv)
 {
     osg::Timer_t startTick = osg::Timer::instance()->tick();
@@ -35,6 +38,7 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
     arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
     arguments.getApplicationUsage()->addCommandLineOption("--cache <filename>","Read the cache file to use a look up for locally cached files.");
+    arguments.getApplicationUsage()->addCommandLineOption("--metadata-cache <filename>","Read and update the cache of source file metadata, avoiding reopening unchanged source files.");
 
     vpb::Commandline commandline;
 
@@ -167,7 +171,26 @@ int main(int argc, char** argv)
             return 1;
         }
             
-        osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(fileName);
+        osg::ref_ptr<osg::Node> node;
+
+        // a task building a subtile only needs the sources from the manifest that overlap its subtile,
+        // --subtile is left in place for Commandline to read later.
+        int subtilePos = arguments.find("--subtile");
+        if (subtilePos>0 && subtilePos+3<arguments.argc() &&
+            arguments.isNumber(subtilePos+1) && arguments.isNumber(subtilePos+2) && arguments.isNumber(subtilePos+3) &&
+            vpb::SourceManifest::isManifestFile(fileName))
+        {
+            osg::ref_ptr<vpb::SourceManifest> manifest = new vpb::SourceManifest;
+            if (manifest->open(fileName))
+            {
+                node = manifest->createTerrainTile(atoi(arguments[subtilePos+1]), atoi(arguments[subtilePos+2]), atoi(arguments[subtilePos+3]));
+            }
+        }
+        else
+        {
+            node = osgDB::readNodeFile(fileName);
+        }
+
         if (node.valid())
         {
             osgTerrain::TerrainTile* loaded_terrain = dynamic_cast<osgTerrain::TerrainTile*>(node.get());
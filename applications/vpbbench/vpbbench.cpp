@@ -0,0 +1,1255 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This application is open source and may be redistributed and/or modified
+ * freely and without restriction, both in commericial and non commericial applications,
+ * as long as this copyright notice is maintained.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include <vpb/DataSet>
+#include <vpb/Destination>
+#include <vpb/BuildLog>
+#include <vpb/MemoryTracker>
+#include <vpb/System>
+#include <vpb/FileUtils>
+#include <vpb/Version>
+#include <vpb/BinaryStream>
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Version>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+
+#include <OpenThreads/Thread>
+
+#include <gdal_priv.h>
+#include <ogr_spatialref.h>
+#include <cpl_string.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <set>
+#include <vector>
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+/** Return the peak resident set size of the process since it started in kilobytes, 0 if it isn't available.
+  * The peak only ever grows, so measured after a stage it is the peak of that stage and all the ones before it.*/
+static double getPeakRSS()
+{
+#if defined(WIN32) && !defined(__CYGWIN__)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return double(counters.PeakWorkingSetSize)/1024.0;
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)!=0) return 0.0;
+#if defined(__APPLE__)
+    return double(usage.ru_maxrss)/1024.0;
+#else
+    return double(usage.ru_maxrss);
+#endif
+#endif
+}
+
+struct ProcessUsage
+{
+    ProcessUsage(): cpuSeconds(0.0), bytesRead(0.0), bytesWritten(0.0) {}
+
+    double  cpuSeconds;
+    double  bytesRead;
+    double  bytesWritten;
+};
+
+/** Return the CPU time and block I/O of this process, or of all the child processes waited for so far,
+  * zeros where it isn't available.*/
+static ProcessUsage getProcessUsage(bool children)
+{
+    ProcessUsage usage;
+#if !(defined(WIN32) && !defined(__CYGWIN__))
+    struct rusage ru;
+    if (getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &ru)==0)
+    {
+        usage.cpuSeconds = double(ru.ru_utime.tv_sec) + double(ru.ru_utime.tv_usec)*0.000001 +
+                           double(ru.ru_stime.tv_sec) + double(ru.ru_stime.tv_usec)*0.000001;
+
+        // block counts are in 512 byte units, reads satisfied from the page cache aren't counted.
+        usage.bytesRead = double(ru.ru_inblock)*512.0;
+        usage.bytesWritten = double(ru.ru_oublock)*512.0;
+    }
+#endif
+    return usage;
+}
+
+/** Run command through the shell like system(), also returning the peak resident set size in kilobytes of the process
+  * it ran, and of any descendants that process waited for, 0 where it isn't available.*/
+static int runCommand(const std::string& command, double& peakRSS)
+{
+    peakRSS = 0.0;
+#if defined(WIN32) && !defined(__CYGWIN__)
+    return system(command.c_str());
+#else
+    pid_t pid = fork();
+    if (pid<0) return -1;
+    if (pid==0)
+    {
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char*)0);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru)<0)
+    {
+        if (errno!=EINTR) return -1;
+    }
+
+#if defined(__APPLE__)
+    peakRSS = double(ru.ru_maxrss)/1024.0;
+#else
+    peakRSS = double(ru.ru_maxrss);
+#endif
+    return status;
+#endif
+}
+
+struct SyntheticOptions
+{
+    SyntheticOptions():
+        size(2048),
+        numBands(3),
+        projected(false),
+        useNoData(false),
+        noDataValue(0.0),
+        blockSize(256) {}
+
+    unsigned int    size;
+    unsigned int    numBands;
+    bool            projected;
+    bool            useNoData;
+    double          noDataValue;
+    unsigned int    blockSize;
+};
+
+/** Result of a stage.  peakRSS and peakTracked are the peaks of vpbbench since it started, written as processPeakRSSKB
+  * and processPeakTrackedMB, other than for the build phases run as child processes where peakRSS is that of the child,
+  * written as childPeakRSSKB.*/
+struct Result
+{
+    Result(): items(0.0), seconds(0.0), peakRSS(0.0), childPeakRSS(false), peakTracked(0.0), cpuSeconds(0.0), bytesRead(0.0), bytesWritten(0.0) {}
+
+    std::string     benchmark;
+    std::string     name;
+    std::string     unit;
+    double          items;
+    double          seconds;
+    double          peakRSS;
+    bool            childPeakRSS;
+    double          peakTracked;
+    double          cpuSeconds;
+    double          bytesRead;
+    double          bytesWritten;
+    std::string     outputHash;
+};
+typedef std::vector<Result> Results;
+
+static void addResult(Results& results, const std::string& benchmark, const std::string& name, const std::string& unit, double items, double seconds)
+{
+    Result result;
+    result.benchmark = benchmark;
+    result.name = name;
+    result.unit = unit;
+    result.items = items;
+    result.seconds = seconds;
+    result.peakRSS = getPeakRSS();
+    result.peakTracked = vpb::MemoryTracker::instance()->getPeakTotal();
+    results.push_back(result);
+
+    vpb::log(osg::NOTICE,"%s %s: %.0f %ss in %.3fs, %.1f ns/%s",benchmark.c_str(),name.c_str(),items,unit.c_str(),seconds,
+             items>0.0 ? seconds*1.0e9/items : 0.0, unit.c_str());
+}
+
+/** Create a synthetic raster in memory with the MEM driver and copy it to a GeoTIFF, imagery is a
+  * byte pattern in each band and height fields a single float band of rolling hills, with a hole of
+  * no data values in the middle when enabled.*/
+static bool createSyntheticRaster(const std::string& filename, const SyntheticOptions& options, bool heightField)
+{
+    GDALDriver* memDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+    GDALDriver* tiffDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!memDriver || !tiffDriver)
+    {
+        vpb::log(osg::WARN,"Error: GDAL MEM and GTiff drivers are required to generate synthetic data.");
+        return false;
+    }
+
+    unsigned int size = options.size;
+    unsigned int numBands = heightField ? 1 : options.numBands;
+    GDALDataset* dataset = memDriver->Create("", size, size, numBands, heightField ? GDT_Float32 : GDT_Byte, NULL);
+    if (!dataset) return false;
+
+    // geographic data covers a degree square in the mid latitudes, projected data a 100km square in UTM zone 32
+    // that overlaps its south west corner.
+    OGRSpatialReference srs;
+    srs.SetWellKnownGeogCS("WGS84");
+    double geoTransform[6];
+    if (options.projected)
+    {
+        srs.SetUTM(32, TRUE);
+        double resolution = 100000.0/double(size);
+        geoTransform[0] = 450000.0; geoTransform[1] = resolution; geoTransform[2] = 0.0;
+        geoTransform[3] = 5050000.0; geoTransform[4] = 0.0; geoTransform[5] = -resolution;
+    }
+    else
+    {
+        double resolution = 1.0/double(size);
+        geoTransform[0] = 9.0; geoTransform[1] = resolution; geoTransform[2] = 0.0;
+        geoTransform[3] = 46.0; geoTransform[4] = 0.0; geoTransform[5] = -resolution;
+    }
+
+    char* wkt = 0;
+    srs.exportToWkt(&wkt);
+    dataset->SetProjection(wkt);
+    CPLFree(wkt);
+    dataset->SetGeoTransform(geoTransform);
+
+    double holeRadius2 = double(size)*double(size)/64.0;
+    double centre = double(size)*0.5;
+
+    std::vector<float> heights(size);
+    std::vector<unsigned char> pixels(size);
+    for(unsigned int b=0; b<numBands; ++b)
+    {
+        GDALRasterBand* band = dataset->GetRasterBand(b+1);
+        if (options.useNoData) band->SetNoDataValue(options.noDataValue);
+
+        for(unsigned int y=0; y<size; ++y)
+        {
+            for(unsigned int x=0; x<size; ++x)
+            {
+                double dx = double(x)-centre;
+                double dy = double(y)-centre;
+                bool hole = options.useNoData && (dx*dx+dy*dy)<holeRadius2;
+
+                if (heightField)
+                {
+                    double h = 500.0 + 300.0*sin(double(x)*0.02)*cos(double(y)*0.015) + 50.0*sin(double(x+y)*0.11);
+                    heights[x] = hole ? float(options.noDataValue) : float(h);
+                }
+                else
+                {
+                    unsigned char value = (unsigned char)((x*3 + y*5 + b*85 + ((x^y)&31)) & 255);
+                    if (options.useNoData && value==(unsigned char)options.noDataValue) value += 1;
+                    pixels[x] = hole ? (unsigned char)options.noDataValue : value;
+                }
+            }
+
+            if (heightField) band->RasterIO(GF_Write, 0, y, size, 1, &heights.front(), size, 1, GDT_Float32, 0, 0);
+            else band->RasterIO(GF_Write, 0, y, size, 1, &pixels.front(), size, 1, GDT_Byte, 0, 0);
+        }
+    }
+
+    char** createOptions = NULL;
+    if (options.blockSize>0)
+    {
+        std::ostringstream blockSize;
+        blockSize<<options.blockSize;
+        createOptions = CSLSetNameValue(createOptions, "TILED", "YES");
+        createOptions = CSLSetNameValue(createOptions, "BLOCKXSIZE", blockSize.str().c_str());
+        createOptions = CSLSetNameValue(createOptions, "BLOCKYSIZE", blockSize.str().c_str());
+    }
+
+    GDALDataset* copy = tiffDriver->CreateCopy(filename.c_str(), dataset, FALSE, createOptions, NULL, NULL);
+    CSLDestroy(createOptions);
+    GDALClose(dataset);
+
+    if (!copy)
+    {
+        vpb::log(osg::WARN,"Error: unable to write synthetic data to %s.",filename.c_str());
+        return false;
+    }
+
+    GDALClose(copy);
+    return true;
+}
+
+class CollectTilesVisitor : public vpb::DestinationVisitor
+{
+    public:
+
+        virtual void apply(vpb::DestinationTile& tile) { _tiles.push_back(&tile); }
+
+        std::vector<vpb::DestinationTile*> _tiles;
+};
+
+/** Run a build over the synthetic sources one stage at a time across all the tiles, timing each stage.*/
+static bool runPipelineBenchmark(Results& results, const std::string& name, const SyntheticOptions& options, const std::string& directory,
+                                 unsigned int numLevels, unsigned int imageSize, unsigned int terrainSize)
+{
+    std::string imageFileName = directory + "/" + name + "_image.tif";
+    std::string demFileName = directory + "/" + name + "_dem.tif";
+
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+    if (!createSyntheticRaster(imageFileName, options, false) ||
+        !createSyntheticRaster(demFileName, options, true)) return false;
+    addResult(results, name, "generate", "pixel", 2.0*double(options.size)*double(options.size), osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+    dataset->setDirectory(directory + "/" + name + "_tiles/");
+    dataset->setMaximumNumOfLevels(numLevels);
+    dataset->setMaximumTileImageSize(imageSize);
+    dataset->setMaximumTileTerrainSize(terrainSize);
+    dataset->setTextureType(vpb::BuildOptions::RGB_24);
+    dataset->setMipMappingMode(vpb::BuildOptions::NO_MIP_MAPPING);
+    dataset->setGeometryType(vpb::BuildOptions::POLYGONAL);
+
+    dataset->addSource(new vpb::Source(vpb::Source::IMAGE, imageFileName), 0);
+    dataset->addSource(new vpb::Source(vpb::Source::HEIGHT_FIELD, demFileName), 0);
+
+    vpb::mkpath(dataset->getDirectory().c_str(), 0755);
+
+    startTick = osg::Timer::instance()->tick();
+    dataset->loadSources();
+    dataset->createDestination(numLevels);
+    if (!dataset->getDestinationGraph())
+    {
+        vpb::log(osg::WARN,"Error: no destination graph built for %s.",name.c_str());
+        return false;
+    }
+
+    CollectTilesVisitor collectTiles;
+    collectTiles.traverse(*dataset->getDestinationGraph());
+    std::vector<vpb::DestinationTile*>& tiles = collectTiles._tiles;
+    addResult(results, name, "createDestination", "tile", double(tiles.size()), osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    // read each source into each tile, attributing the time to the image or height field reader.
+    double readImageTime = 0.0, readHeightFieldTime = 0.0, optimizeTime = 0.0;
+    double numImagePixels = 0.0, numHeightSamples = 0.0;
+    for(std::vector<vpb::DestinationTile*>::iterator titr = tiles.begin(); titr != tiles.end(); ++titr)
+    {
+        vpb::DestinationTile* tile = *titr;
+        tile->allocate();
+
+        for(unsigned int layerNum=0; layerNum<tile->getNumLayers(); ++layerNum)
+        {
+            vpb::DestinationTile::ImageSet& imageSet = tile->getImageSet(layerNum);
+            for(vpb::DestinationTile::ImageSet::LayerSetImageDataMap::iterator itr = imageSet._layerSetImageDataMap.begin();
+                itr != imageSet._layerSetImageDataMap.end();
+                ++itr)
+            {
+                vpb::DestinationData* data = itr->second._imageDestination.get();
+                if (data && data->_image.valid()) numImagePixels += double(data->_image->s())*double(data->_image->t());
+            }
+        }
+        if (tile->_terrain.valid() && tile->_terrain->_heightField.valid())
+        {
+            numHeightSamples += double(tile->_terrain->_heightField->getNumColumns())*double(tile->_terrain->_heightField->getNumRows());
+        }
+
+        for(vpb::CompositeSource::source_iterator sitr(dataset->getSourceGraph()); sitr.valid(); ++sitr)
+        {
+            vpb::Source* source = sitr->get();
+            osg::Timer_t tick = osg::Timer::instance()->tick();
+            tile->readFrom(source);
+            double duration = osg::Timer::instance()->delta_s(tick, osg::Timer::instance()->tick());
+            if (source->getType()==vpb::Source::HEIGHT_FIELD) readHeightFieldTime += duration;
+            else readImageTime += duration;
+        }
+
+        osg::Timer_t tick = osg::Timer::instance()->tick();
+        tile->optimizeResolution();
+        optimizeTime += osg::Timer::instance()->delta_s(tick, osg::Timer::instance()->tick());
+    }
+    addResult(results, name, "readImage", "pixel", numImagePixels, readImageTime);
+    addResult(results, name, "readHeightField", "sample", numHeightSamples, readHeightFieldTime);
+    addResult(results, name, "optimizeResolution", "tile", double(tiles.size()), optimizeTime);
+
+    startTick = osg::Timer::instance()->tick();
+    for(std::vector<vpb::DestinationTile*>::iterator titr = tiles.begin(); titr != tiles.end(); ++titr)
+    {
+        (*titr)->equalizeBoundaries();
+        (*titr)->setTileComplete(true);
+    }
+    addResult(results, name, "equalize", "tile", double(tiles.size()), osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    // the height fields are optimized by now, so count the samples the scene creation actually sees.
+    numHeightSamples = 0.0;
+    for(std::vector<vpb::DestinationTile*>::iterator titr = tiles.begin(); titr != tiles.end(); ++titr)
+    {
+        vpb::DestinationTile* tile = *titr;
+        if (tile->_terrain.valid() && tile->_terrain->_heightField.valid())
+        {
+            numHeightSamples += double(tile->_terrain->_heightField->getNumColumns())*double(tile->_terrain->_heightField->getNumRows());
+        }
+    }
+
+    startTick = osg::Timer::instance()->tick();
+    for(std::vector<vpb::DestinationTile*>::iterator titr = tiles.begin(); titr != tiles.end(); ++titr)
+    {
+        osg::ref_ptr<osg::Node> node = (*titr)->createTerrainTile();
+    }
+    addResult(results, name, "createTerrainTile", "sample", numHeightSamples, osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    std::vector< osg::ref_ptr<osg::Node> > nodes;
+    nodes.reserve(tiles.size());
+    startTick = osg::Timer::instance()->tick();
+    for(std::vector<vpb::DestinationTile*>::iterator titr = tiles.begin(); titr != tiles.end(); ++titr)
+    {
+        nodes.push_back((*titr)->createPolygonal());
+    }
+    addResult(results, name, "createPolygonal", "sample", numHeightSamples, osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    unsigned int numWritten = 0;
+    startTick = osg::Timer::instance()->tick();
+    for(unsigned int i=0; i<tiles.size(); ++i)
+    {
+        if (!nodes[i].valid()) continue;
+
+        vpb::DestinationTile* tile = tiles[i];
+        std::ostringstream filename;
+        filename<<dataset->getDirectory()<<"tile_L"<<tile->_level<<"_X"<<tile->_tileX<<"_Y"<<tile->_tileY<<dataset->getDestinationTileExtension();
+
+        dataset->_writeNodeFile(*nodes[i], filename.str());
+        ++numWritten;
+    }
+    addResult(results, name, "write", "tile", double(numWritten), osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    return true;
+}
+
+/** Build a level of quadMapSize x quadMapSize tiles into the quad map then look up the neighbours of every tile.*/
+static void runQuadTreeBenchmark(Results& results, unsigned int quadMapSize)
+{
+    osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+
+    std::vector< osg::ref_ptr<vpb::CompositeDestination> > composites;
+    composites.reserve(quadMapSize*quadMapSize);
+
+    unsigned int level = 10;
+
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+    for(unsigned int y=0; y<quadMapSize; ++y)
+    {
+        for(unsigned int x=0; x<quadMapSize; ++x)
+        {
+            vpb::CompositeDestination* cd = new vpb::CompositeDestination;
+            cd->_dataSet = dataset.get();
+            cd->_level = level;
+            cd->_tileX = x;
+            cd->_tileY = y;
+            composites.push_back(cd);
+            dataset->insertTileToQuadMap(cd);
+        }
+    }
+    double numTiles = double(quadMapSize)*double(quadMapSize);
+    addResult(results, "quadtree", "create", "tile", numTiles, osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    unsigned int numFound = 0;
+    startTick = osg::Timer::instance()->tick();
+    for(unsigned int y=0; y<quadMapSize; ++y)
+    {
+        for(unsigned int x=0; x<quadMapSize; ++x)
+        {
+            for(int dy=-1; dy<=1; ++dy)
+            {
+                for(int dx=-1; dx<=1; ++dx)
+                {
+                    if (dx==0 && dy==0) continue;
+                    if (dataset->getComposite(level, x+dx, y+dy)) ++numFound;
+                }
+            }
+        }
+    }
+    addResult(results, "quadtree", "neighbours", "lookup", numTiles*8.0, osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick()));
+
+    vpb::log(osg::INFO,"quadtree found %u neighbours",numFound);
+}
+
+class LoggingThread : public OpenThreads::Thread
+{
+    public:
+
+        LoggingThread(osg::NotifySeverity level, unsigned int index, unsigned int numMessages):
+            _level(level),
+            _index(index),
+            _numMessages(numMessages) {}
+
+        virtual void run()
+        {
+            for(unsigned int i=0; i<_numMessages; ++i)
+            {
+                vpb::log(_level, "vpbbench message %u from thread %u",i,_index);
+            }
+        }
+
+    protected:
+
+        osg::NotifySeverity     _level;
+        unsigned int            _index;
+        unsigned int            _numMessages;
+};
+
+/** Log from numThreads threads at once into a build log with a log file, at NOTICE, which is recorded,
+  * and at INFO, which the default notify level filters out.*/
+static void runLoggingBenchmark(Results& results, const std::string& directory, unsigned int numThreads, unsigned int numMessages)
+{
+    osg::NotifySeverity notifyLevel = osg::getNotifyLevel();
+    osg::setNotifyLevel(osg::NOTICE);
+
+    const char* names[] = { "notice", "infoFiltered" };
+    osg::NotifySeverity levels[] = { osg::NOTICE, osg::INFO };
+
+    for(unsigned int l=0; l<2; ++l)
+    {
+        osg::ref_ptr<vpb::BuildLog> buildLog = new vpb::BuildLog;
+        buildLog->openLogFile(directory + "/vpbbench_" + names[l] + ".log");
+        vpb::pushOperationLog(buildLog.get());
+
+        std::vector<LoggingThread*> threads;
+        for(unsigned int i=0; i<numThreads; ++i) threads.push_back(new LoggingThread(levels[l], i, numMessages));
+
+        osg::Timer_t startTick = osg::Timer::instance()->tick();
+        for(unsigned int i=0; i<numThreads; ++i) threads[i]->startThread();
+        for(unsigned int i=0; i<numThreads; ++i) threads[i]->join();
+        buildLog->getLogFile()->flush();
+        double duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+        vpb::popOperationLog();
+
+        for(unsigned int i=0; i<numThreads; ++i) delete threads[i];
+
+        addResult(results, "logging", names[l], "message", double(numThreads)*double(numMessages), duration);
+    }
+
+    osg::setNotifyLevel(notifyLevel);
+}
+
+struct BuildBenchmarkOptions
+{
+    BuildBenchmarkOptions():
+        numLevels(4),
+        primarySplitLevel(1),
+        secondarySplitLevel(2),
+        numProcesses(2),
+        threshold(10.0),
+        historyWindow(5),
+        updateGolden(false) {}
+
+    unsigned int    numLevels;
+    unsigned int    primarySplitLevel;
+    unsigned int    secondarySplitLevel;
+    unsigned int    numProcesses;
+    std::string     binDirectory;
+    std::string     historyFileName;
+    std::string     goldenDirectory;
+    double          threshold;
+    unsigned int    historyWindow;
+    bool            updateGolden;
+};
+
+typedef std::map<std::string, std::string> FileHashes;
+
+/** Regressions smaller than this are treated as timing noise whatever the threshold.*/
+static const double s_minimumRegressionSeconds = 0.1;
+
+/** Exit code when the output of the build benchmark can't be checked, as the SKIP_RETURN_CODE of its test.*/
+static const int s_skipReturnCode = 77;
+
+static std::string getAbsolutePath(const std::string& path)
+{
+    if (!path.empty() && (path[0]=='/' || path[0]=='\\' || (path.size()>1 && path[1]==':'))) return path;
+
+    char cwd[4096];
+    if (!vpb::getCurrentWorkingDirectory(cwd, sizeof(cwd))) return path;
+    return std::string(cwd) + "/" + path;
+}
+
+/** Prepend directory to the PATH of this process so that it and the child processes it starts, such as
+  * the osgdem tasks run by vpbmaster, pick up the applications in directory.*/
+static void prependToPath(const std::string& directory)
+{
+    const char* path = getenv("PATH");
+#if defined(WIN32) && !defined(__CYGWIN__)
+    std::string value = std::string("PATH=") + directory + (path ? std::string(";") + path : std::string());
+    _putenv(value.c_str());
+#else
+    std::string value = directory + (path ? std::string(":") + path : std::string());
+    setenv("PATH", value.c_str(), 1);
+#endif
+}
+
+/** Add the files under directory to files, as paths relative to directory, in sorted order.*/
+static void listFiles(const std::string& directory, const std::string& relativePath, std::vector<std::string>& files)
+{
+    std::string path = relativePath.empty() ? directory : directory + "/" + relativePath;
+    osgDB::DirectoryContents contents = osgDB::getDirectoryContents(path);
+    std::sort(contents.begin(), contents.end());
+
+    for(osgDB::DirectoryContents::iterator itr = contents.begin(); itr != contents.end(); ++itr)
+    {
+        if (*itr=="." || *itr=="..") continue;
+
+        std::string relativeFileName = relativePath.empty() ? *itr : relativePath + "/" + *itr;
+        if (osgDB::fileType(directory + "/" + relativeFileName)==osgDB::DIRECTORY) listFiles(directory, relativeFileName, files);
+        else files.push_back(relativeFileName);
+    }
+}
+
+/** Return true if ext is that of a tile of the database, a model, an image or an archive holding them.*/
+static bool isTileExtension(const std::string& ext)
+{
+    static const char* s_tileExtensions[] = { "ive", "osgb", "osgt", "osgx", "osg", "osga", "vpbc",
+                                              "dds", "png", "jpg", "jpeg", "tif", "tiff", "rgb", "rgba" };
+    for(unsigned int i=0; i<sizeof(s_tileExtensions)/sizeof(const char*); ++i)
+    {
+        if (ext==s_tileExtensions[i]) return true;
+    }
+    return false;
+}
+
+/** Hash the contents of every tile of the build output under directory, returning the total size of the tiles.
+  * The logs, task, source, trace and revision files record paths, hosts and times so are left out.*/
+static double hashOutput(const std::string& directory, FileHashes& hashes, std::string& combinedHash)
+{
+    std::vector<std::string> files;
+    listFiles(directory, "", files);
+
+    double totalSize = 0.0;
+    std::string hashList;
+    for(std::vector<std::string>::iterator itr = files.begin(); itr != files.end(); ++itr)
+    {
+        if (!isTileExtension(osgDB::getLowerCaseFileExtension(*itr))) continue;
+
+        osgDB::ifstream fin((directory + "/" + *itr).c_str(), std::ios::in | std::ios::binary);
+        if (!fin) continue;
+
+        std::ostringstream contents;
+        contents<<fin.rdbuf();
+        std::string data = contents.str();
+        totalSize += double(data.size());
+
+        std::ostringstream hash;
+        hash<<std::hex<<std::setw(16)<<std::setfill('0')<<vpb::hashBytes(data);
+        hashes[*itr] = hash.str();
+        hashList += *itr + " " + hash.str() + "\n";
+    }
+
+    std::ostringstream hash;
+    hash<<std::hex<<std::setw(16)<<std::setfill('0')<<vpb::hashBytes(hashList);
+    combinedHash = hash.str();
+
+    return totalSize;
+}
+
+/** Run command in directory, as a phase of the build benchmark, recording its wall time, the CPU time, block I/O and
+  * peak resident set size of it and its children, and the size and hash of the output it left in directory.*/
+static bool runPhase(Results& results, const std::string& name, const std::string& command, const std::string& directory, FileHashes& hashes)
+{
+    // remove the output of previous runs so it can't be mistaken for the output of this one.
+    std::vector<std::string> previousFiles;
+    listFiles(directory, "", previousFiles);
+    for(std::vector<std::string>::iterator itr = previousFiles.begin(); itr != previousFiles.end(); ++itr)
+    {
+        remove((directory + "/" + *itr).c_str());
+    }
+
+    char cwd[4096];
+    bool restoreDirectory = vpb::getCurrentWorkingDirectory(cwd, sizeof(cwd))!=0;
+
+    vpb::log(osg::NOTICE,"build %s: running %s",name.c_str(),command.c_str());
+
+    ProcessUsage startUsage = getProcessUsage(true);
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    double peakRSS = 0.0;
+    vpb::chdir(directory.c_str());
+    int status = runCommand(command, peakRSS);
+    if (restoreDirectory) vpb::chdir(cwd);
+
+    double duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+    ProcessUsage endUsage = getProcessUsage(true);
+
+    Result result;
+    result.benchmark = "build";
+    result.name = name;
+    result.unit = "byte";
+    result.items = hashOutput(directory, hashes, result.outputHash);
+    result.seconds = duration;
+    result.peakRSS = peakRSS;
+    result.childPeakRSS = true;
+    result.cpuSeconds = endUsage.cpuSeconds - startUsage.cpuSeconds;
+    result.bytesRead = endUsage.bytesRead - startUsage.bytesRead;
+    result.bytesWritten = endUsage.bytesWritten - startUsage.bytesWritten;
+    results.push_back(result);
+
+    vpb::log(osg::NOTICE,"build %s: %.3fs wall, %.3fs CPU, %.0f bytes read, %.0f bytes written, %.0f bytes of output, hash %s",
+             name.c_str(), result.seconds, result.cpuSeconds, result.bytesRead, result.bytesWritten, result.items, result.outputHash.c_str());
+
+    if (status!=0)
+    {
+        vpb::log(osg::WARN,"Error: build %s failed, %s returned %d.",name.c_str(),command.c_str(),status);
+        return false;
+    }
+
+    return true;
+}
+
+static std::string getJSONString(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\":\"";
+    std::string::size_type start = line.find(pattern);
+    if (start==std::string::npos) return std::string();
+    start += pattern.size();
+    std::string::size_type end = line.find('"', start);
+    return line.substr(start, end==std::string::npos ? std::string::npos : end-start);
+}
+
+static double getJSONNumber(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\":";
+    std::string::size_type start = line.find(pattern);
+    if (start==std::string::npos) return 0.0;
+    return atof(line.c_str() + start + pattern.size());
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    unsigned int n = values.size();
+    return (n%2) ? values[n/2] : (values[n/2-1] + values[n/2])*0.5;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The build history is a JSON file with one record per line, so that it can be appended to
+// and read back without a JSON parser:
+//
+//   {"time":<seconds since epoch>,"configuration":"<options>","phase":"<phase>","wallSeconds":<s>,
+//    "cpuSeconds":<s>,"bytesRead":<n>,"bytesWritten":<n>,"outputBytes":<n>,"outputHash":"<hash>"}
+//
+// Each phase is compared against the median of the last historyWindow runs of the same phase and
+// configuration, and is a regression when its wall or CPU time exceeds that by more than threshold percent.
+//
+static bool checkHistory(const Results& results, const std::string& configuration, const BuildBenchmarkOptions& buildOptions)
+{
+    typedef std::map<std::string, std::vector<double> > PhaseTimes;
+    PhaseTimes wallTimes, cpuTimes;
+
+    {
+        osgDB::ifstream fin(buildOptions.historyFileName.c_str());
+        std::string line;
+        while(fin && std::getline(fin, line))
+        {
+            if (getJSONString(line, "configuration")!=configuration) continue;
+
+            std::string phase = getJSONString(line, "phase");
+            wallTimes[phase].push_back(getJSONNumber(line, "wallSeconds"));
+            cpuTimes[phase].push_back(getJSONNumber(line, "cpuSeconds"));
+        }
+    }
+
+    bool withinBudget = true;
+    double limit = 1.0 + buildOptions.threshold*0.01;
+    for(Results::const_iterator itr = results.begin(); itr != results.end(); ++itr)
+    {
+        if (itr->benchmark!="build") continue;
+
+        std::vector<double>& wall = wallTimes[itr->name];
+        std::vector<double>& cpu = cpuTimes[itr->name];
+        if (wall.empty()) continue;
+
+        unsigned int window = osg::minimum(static_cast<unsigned int>(wall.size()), buildOptions.historyWindow);
+        double wallBaseline = median(std::vector<double>(wall.end()-window, wall.end()));
+        double cpuBaseline = median(std::vector<double>(cpu.end()-window, cpu.end()));
+
+        if (itr->seconds>wallBaseline*limit && itr->seconds-wallBaseline>s_minimumRegressionSeconds)
+        {
+            vpb::log(osg::WARN,"Regression: build %s took %.3fs wall time against a baseline of %.3fs.",itr->name.c_str(),itr->seconds,wallBaseline);
+            withinBudget = false;
+        }
+
+        if (itr->cpuSeconds>cpuBaseline*limit && itr->cpuSeconds-cpuBaseline>s_minimumRegressionSeconds)
+        {
+            vpb::log(osg::WARN,"Regression: build %s took %.3fs CPU time against a baseline of %.3fs.",itr->name.c_str(),itr->cpuSeconds,cpuBaseline);
+            withinBudget = false;
+        }
+    }
+
+    return withinBudget;
+}
+
+static bool appendHistory(const Results& results, const std::string& configuration, const std::string& historyFileName)
+{
+    osgDB::ofstream fout(historyFileName.c_str(), std::ios::out | std::ios::app);
+    if (!fout)
+    {
+        vpb::log(osg::WARN,"Error: unable to open build history %s for writing.",historyFileName.c_str());
+        return false;
+    }
+
+    fout.setf(std::ios::fixed, std::ios::floatfield);
+    fout.precision(6);
+
+    double now = double(time(0));
+    for(Results::const_iterator itr = results.begin(); itr != results.end(); ++itr)
+    {
+        if (itr->benchmark!="build") continue;
+
+        fout<<"{\"time\":"<<std::setprecision(0)<<now<<std::setprecision(6)<<",\"configuration\":\""<<configuration<<"\""
+            <<",\"phase\":\""<<itr->name<<"\",\"wallSeconds\":"<<itr->seconds<<",\"cpuSeconds\":"<<itr->cpuSeconds
+            <<",\"bytesRead\":"<<itr->bytesRead<<",\"bytesWritten\":"<<itr->bytesWritten
+            <<",\"outputBytes\":"<<itr->items<<",\"outputHash\":\""<<itr->outputHash<<"\"}"<<std::endl;
+    }
+
+    return !fout.fail();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// The exact bytes of the tiles depend on the OSG and GDAL versions and on the platform, so the golden
+// directory holds one file of hashes for each environment they have been recorded in, named
+// build_<environment>.txt, each listing the hash of every tile of each phase one per line, lines
+// starting with # are comments:
+//
+//   <phase> <hash> <relative path>
+//
+// A golden file is only written when --update-golden is given.  When there is none for this environment
+// the check is skipped rather than failed.
+//
+enum GoldenStatus
+{
+    GOLDEN_MATCHED,
+    GOLDEN_DIFFERS,
+    GOLDEN_UNAVAILABLE
+};
+
+/** Return the name of the OSG and GDAL versions and the platform the golden hashes of this build are kept under.*/
+static std::string getGoldenEnvironment()
+{
+#if defined(WIN32) && !defined(__CYGWIN__)
+    const char* platform = "windows";
+#elif defined(__APPLE__)
+    const char* platform = "macos";
+#elif defined(__linux__)
+    const char* platform = "linux";
+#elif defined(__FreeBSD__)
+    const char* platform = "freebsd";
+#else
+    const char* platform = "unix";
+#endif
+
+    std::ostringstream environment;
+    environment<<"osg"<<osgGetVersion()<<"_gdal"<<GDALVersionInfo("RELEASE_NAME")<<"_"<<platform<<"-"<<sizeof(void*)*8;
+    return environment.str();
+}
+
+static GoldenStatus checkGolden(const std::map<std::string, FileHashes>& phaseHashes, const BuildBenchmarkOptions& buildOptions)
+{
+    std::string goldenFileName = buildOptions.goldenDirectory + "/build_" + getGoldenEnvironment() + ".txt";
+
+    if (buildOptions.updateGolden)
+    {
+        vpb::mkpath(buildOptions.goldenDirectory.c_str(), 0755);
+
+        osgDB::ofstream fout(goldenFileName.c_str());
+        if (!fout)
+        {
+            vpb::log(osg::WARN,"Error: unable to open golden hashes %s for writing.",goldenFileName.c_str());
+            return GOLDEN_DIFFERS;
+        }
+
+        fout<<"# <phase> <hash> <relative path> of the vpbbench build output, regenerate with --update-golden"<<std::endl;
+        for(std::map<std::string, FileHashes>::const_iterator pitr = phaseHashes.begin(); pitr != phaseHashes.end(); ++pitr)
+        {
+            for(FileHashes::const_iterator itr = pitr->second.begin(); itr != pitr->second.end(); ++itr)
+            {
+                fout<<pitr->first<<" "<<itr->second<<" "<<itr->first<<std::endl;
+            }
+        }
+
+        vpb::log(osg::NOTICE,"Wrote golden hashes to %s.",goldenFileName.c_str());
+        return GOLDEN_MATCHED;
+    }
+
+    std::map<std::string, FileHashes> goldenHashes;
+    {
+        osgDB::ifstream fin(goldenFileName.c_str());
+        std::string line;
+        while(fin && std::getline(fin, line))
+        {
+            if (line.empty() || line[0]=='#') continue;
+
+            std::istringstream sin(line);
+            std::string phase, hash, filename;
+            if (!(sin>>phase>>hash) || !std::getline(sin, filename)) continue;
+
+            if (!filename.empty() && filename[0]==' ') filename.erase(0, 1);
+            goldenHashes[phase][filename] = hash;
+        }
+    }
+
+    if (goldenHashes.empty())
+    {
+        vpb::log(osg::NOTICE,"No golden hashes in %s for this environment, skipping the output check, run with --update-golden to record them.",goldenFileName.c_str());
+        return GOLDEN_UNAVAILABLE;
+    }
+
+    unsigned int numDifferences = 0;
+    for(std::map<std::string, FileHashes>::const_iterator pitr = phaseHashes.begin(); pitr != phaseHashes.end(); ++pitr)
+    {
+        const FileHashes& golden = goldenHashes[pitr->first];
+        const FileHashes& output = pitr->second;
+
+        for(FileHashes::const_iterator itr = output.begin(); itr != output.end(); ++itr)
+        {
+            FileHashes::const_iterator gitr = golden.find(itr->first);
+            if (gitr==golden.end())
+            {
+                vpb::log(osg::WARN,"Golden mismatch: build %s wrote %s which isn't in the golden output.",pitr->first.c_str(),itr->first.c_str());
+                ++numDifferences;
+            }
+            else if (gitr->second!=itr->second)
+            {
+                vpb::log(osg::WARN,"Golden mismatch: build %s wrote %s with hash %s, expected %s.",pitr->first.c_str(),itr->first.c_str(),itr->second.c_str(),gitr->second.c_str());
+                ++numDifferences;
+            }
+        }
+
+        for(FileHashes::const_iterator gitr = golden.begin(); gitr != golden.end(); ++gitr)
+        {
+            if (output.count(gitr->first)==0)
+            {
+                vpb::log(osg::WARN,"Golden mismatch: build %s didn't write %s.",pitr->first.c_str(),gitr->first.c_str());
+                ++numDifferences;
+            }
+        }
+    }
+
+    if (numDifferences>0)
+    {
+        vpb::log(osg::WARN,"Output differs from the golden hashes in %s in %u files, rerun with --update-golden if the change is intended.",goldenFileName.c_str(),numDifferences);
+        return GOLDEN_DIFFERS;
+    }
+
+    return GOLDEN_MATCHED;
+}
+
+/** Build a database from a synthetic dataset of a DEM and two imagery layers, one of them in UTM so it has to be
+  * reprojected, once with osgdem and once with vpbmaster on localhost with primary and secondary splits.
+  * Returns false if either build fails, regresses against the history or doesn't match the golden hashes, and sets
+  * goldenUnavailable if there are no golden hashes for this environment to check against.*/
+static bool runBuildBenchmark(Results& results, const SyntheticOptions& options, const std::string& directory, const BuildBenchmarkOptions& buildOptions,
+                              bool& goldenUnavailable)
+{
+    std::string imageFileName = directory + "/build_image.tif";
+    std::string projectedImageFileName = directory + "/build_image_utm.tif";
+    std::string demFileName = directory + "/build_dem.tif";
+
+    SyntheticOptions geographicOptions = options;
+    geographicOptions.projected = false;
+    SyntheticOptions projectedOptions = options;
+    projectedOptions.projected = true;
+
+    ProcessUsage startUsage = getProcessUsage(false);
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+    if (!createSyntheticRaster(imageFileName, geographicOptions, false) ||
+        !createSyntheticRaster(projectedImageFileName, projectedOptions, false) ||
+        !createSyntheticRaster(demFileName, geographicOptions, true)) return false;
+    ProcessUsage endUsage = getProcessUsage(false);
+
+    Result generate;
+    generate.benchmark = "build";
+    generate.name = "generate";
+    generate.unit = "pixel";
+    generate.items = 3.0*double(options.size)*double(options.size);
+    generate.seconds = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+    generate.peakRSS = getPeakRSS();
+    generate.cpuSeconds = endUsage.cpuSeconds - startUsage.cpuSeconds;
+    generate.bytesRead = endUsage.bytesRead - startUsage.bytesRead;
+    generate.bytesWritten = endUsage.bytesWritten - startUsage.bytesWritten;
+    results.push_back(generate);
+
+    std::string osgdemDirectory = directory + "/osgdem";
+    std::string vpbmasterDirectory = directory + "/vpbmaster";
+    vpb::mkpath((osgdemDirectory + "/tiles").c_str(), 0755);
+    vpb::mkpath((vpbmasterDirectory + "/tiles").c_str(), 0755);
+
+    std::string machinesFileName = directory + "/build_machines";
+    {
+        osgDB::ofstream fout(machinesFileName.c_str());
+        fout<<"Machine {"<<std::endl;
+        fout<<"    hostname localhost"<<std::endl;
+        fout<<"    processes "<<buildOptions.numProcesses<<std::endl;
+        fout<<"}"<<std::endl;
+    }
+
+    std::ostringstream sources;
+    sources<<"-d \""<<demFileName<<"\" -t \""<<imageFileName<<"\" --layer 1 -t \""<<projectedImageFileName<<"\" -l "<<buildOptions.numLevels;
+
+    if (!buildOptions.binDirectory.empty()) prependToPath(getAbsolutePath(buildOptions.binDirectory));
+
+    std::map<std::string, FileHashes> phaseHashes;
+
+    std::ostringstream osgdemCommand;
+    osgdemCommand<<"osgdem "<<sources.str()<<" -o \""<<osgdemDirectory<<"/tiles/build.ive\"";
+    bool success = runPhase(results, "osgdem", osgdemCommand.str(), osgdemDirectory, phaseHashes["osgdem"]);
+
+    std::ostringstream vpbmasterCommand;
+    vpbmasterCommand<<"vpbmaster --machines \""<<machinesFileName<<"\" "<<sources.str()
+                    <<" --splits "<<buildOptions.primarySplitLevel<<" "<<buildOptions.secondarySplitLevel
+                    <<" -o \""<<vpbmasterDirectory<<"/tiles/build.ive\"";
+    success = runPhase(results, "vpbmaster", vpbmasterCommand.str(), vpbmasterDirectory, phaseHashes["vpbmaster"]) && success;
+
+    if (!success) return false;
+
+    std::ostringstream configuration;
+    configuration<<"size="<<options.size<<" bands="<<options.numBands<<" nodata="<<(options.useNoData ? 1 : 0)
+                 <<" blockSize="<<options.blockSize<<" levels="<<buildOptions.numLevels
+                 <<" splits="<<buildOptions.primarySplitLevel<<","<<buildOptions.secondarySplitLevel
+                 <<" processes="<<buildOptions.numProcesses;
+
+    if (!buildOptions.historyFileName.empty())
+    {
+        success = checkHistory(results, configuration.str(), buildOptions);
+        appendHistory(results, configuration.str(), buildOptions.historyFileName);
+    }
+
+    if (!buildOptions.goldenDirectory.empty())
+    {
+        GoldenStatus status = checkGolden(phaseHashes, buildOptions);
+        if (status==GOLDEN_DIFFERS) success = false;
+        else if (status==GOLDEN_UNAVAILABLE) goldenUnavailable = true;
+    }
+
+    return success;
+}
+
+static std::string escapeJSON(const std::string& str)
+{
+    std::string result;
+    for(std::string::const_iterator itr = str.begin(); itr != str.end(); ++itr)
+    {
+        if (*itr=='"' || *itr=='\\') result.push_back('\\');
+        result.push_back(*itr);
+    }
+    return result;
+}
+
+static void writeJSON(std::ostream& out, const SyntheticOptions& options, const Results& results)
+{
+    out.setf(std::ios::fixed, std::ios::floatfield);
+    out.precision(6);
+
+    out<<"{"<<std::endl;
+    out<<"  \"version\": \""<<vpbGetVersion()<<"\","<<std::endl;
+    out<<"  \"numProcessors\": "<<OpenThreads::GetNumberOfProcessors()<<","<<std::endl;
+    out<<"  \"configuration\": { \"size\": "<<options.size<<", \"bands\": "<<options.numBands
+       <<", \"cs\": \""<<(options.projected ? "projected" : "geographic")<<"\""
+       <<", \"nodata\": "<<(options.useNoData ? "true" : "false")
+       <<", \"blockSize\": "<<options.blockSize<<" },"<<std::endl;
+    out<<"  \"results\": ["<<std::endl;
+    for(unsigned int i=0; i<results.size(); ++i)
+    {
+        const Result& result = results[i];
+        out<<"    { \"benchmark\": \""<<escapeJSON(result.benchmark)<<"\", \"name\": \""<<escapeJSON(result.name)<<"\""
+           <<", \"unit\": \""<<result.unit<<"\", \"items\": "<<result.items<<", \"seconds\": "<<result.seconds
+           <<", \"throughput\": "<<(result.seconds>0.0 ? result.items/result.seconds : 0.0)
+           <<", \"nsPerItem\": "<<(result.items>0.0 ? result.seconds*1.0e9/result.items : 0.0)
+           <<(result.childPeakRSS ? ", \"childPeakRSSKB\": " : ", \"processPeakRSSKB\": ")<<result.peakRSS
+           <<", \"processPeakTrackedMB\": "<<result.peakTracked/(1024.0*1024.0)
+           <<", \"cpuSeconds\": "<<result.cpuSeconds<<", \"bytesRead\": "<<result.bytesRead<<", \"bytesWritten\": "<<result.bytesWritten;
+        if (!result.outputHash.empty()) out<<", \"outputHash\": \""<<result.outputHash<<"\"";
+        out<<" }"
+           <<(i+1<results.size() ? "," : "")<<std::endl;
+    }
+    out<<"  ]"<<std::endl;
+    out<<"}"<<std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    // set up the usage document, in case we need to print out how to use this program.
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" application benchmarks the stages of a build on synthetic imagery and DEMs, writing the results as JSON.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options]");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
+    arguments.getApplicationUsage()->addCommandLineOption("--benchmark <name>","Run the pipeline, quadtree, logging or build benchmark, may be repeated, defaults to all but build.");
+    arguments.getApplicationUsage()->addCommandLineOption("-o <filename>","Write the JSON results to <filename> rather than stdout.");
+    arguments.getApplicationUsage()->addCommandLineOption("--directory <dir>","Directory to write the synthetic data and output to, defaults to vpbbench_data.");
+    arguments.getApplicationUsage()->addCommandLineOption("--size <pixels>","Width and height of the synthetic imagery and DEM, defaults to 2048.");
+    arguments.getApplicationUsage()->addCommandLineOption("--bands <num>","Number of bands of the synthetic imagery, defaults to 3.");
+    arguments.getApplicationUsage()->addCommandLineOption("--cs <geographic|projected>","Coordinate system of the synthetic data, WGS84 or UTM zone 32, defaults to geographic.");
+    arguments.getApplicationUsage()->addCommandLineOption("--nodata <value>","Set the no data value and leave a hole of no data values in the middle of the synthetic data.");
+    arguments.getApplicationUsage()->addCommandLineOption("--block-size <pixels>","GeoTIFF tile size of the synthetic data, 0 writes strips, defaults to 256.");
+    arguments.getApplicationUsage()->addCommandLineOption("--levels <num>","Number of levels to build, defaults to 3.");
+    arguments.getApplicationUsage()->addCommandLineOption("--image-size <pixels>","Maximum tile image size, defaults to 256.");
+    arguments.getApplicationUsage()->addCommandLineOption("--terrain-size <samples>","Maximum tile terrain size, defaults to 64.");
+    arguments.getApplicationUsage()->addCommandLineOption("--quadtree-size <tiles>","Width and height in tiles of the quadtree benchmark level, defaults to 1000.");
+    arguments.getApplicationUsage()->addCommandLineOption("--log-threads <num>","Number of threads logging at once, defaults to 32.");
+    arguments.getApplicationUsage()->addCommandLineOption("--log-messages <num>","Number of messages logged by each thread, defaults to 10000.");
+    arguments.getApplicationUsage()->addCommandLineOption("--bin-dir <dir>","Directory containing the osgdem and vpbmaster applications run by the build benchmark, defaults to those on the PATH.");
+    arguments.getApplicationUsage()->addCommandLineOption("--build-levels <num>","Number of levels built by the build benchmark, defaults to 4.");
+    arguments.getApplicationUsage()->addCommandLineOption("--build-splits <primary> <secondary>","Distributed build split levels of the vpbmaster build, defaults to 1 2.");
+    arguments.getApplicationUsage()->addCommandLineOption("--build-processes <num>","Number of osgdem processes vpbmaster runs on localhost, defaults to 2.");
+    arguments.getApplicationUsage()->addCommandLineOption("--history <filename>","Check the build timings against and append them to the build history <filename>.");
+    arguments.getApplicationUsage()->addCommandLineOption("--threshold <percent>","Fail when a build phase's wall or CPU time exceeds the median of the history by more than <percent>, defaults to 10.");
+    arguments.getApplicationUsage()->addCommandLineOption("--history-window <num>","Number of previous runs the history median is taken over, defaults to 5.");
+    arguments.getApplicationUsage()->addCommandLineOption("--golden <dir>","Check the hashes of the tiles built against those recorded in <dir> for this OSG and GDAL version and platform, exiting with 77 if there are none.");
+    arguments.getApplicationUsage()->addCommandLineOption("--update-golden","Record the hashes of the tiles of this build in the --golden directory for this OSG and GDAL version and platform.");
+
+    // if user requests help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--version"))
+    {
+        std::cout<<"VirtualPlanetBuilder/vpbbench version "<<vpbGetVersion()<<std::endl;
+        return 0;
+    }
+
+    std::set<std::string> benchmarks;
+    std::string benchmark;
+    while (arguments.read("--benchmark",benchmark)) { benchmarks.insert(benchmark); }
+    if (benchmarks.empty())
+    {
+        benchmarks.insert("pipeline");
+        benchmarks.insert("quadtree");
+        benchmarks.insert("logging");
+    }
+
+    std::string outputFileName;
+    while (arguments.read("-o",outputFileName)) {}
+
+    std::string directory("vpbbench_data");
+    while (arguments.read("--directory",directory)) {}
+
+    SyntheticOptions options;
+    while (arguments.read("--size",options.size)) {}
+    while (arguments.read("--bands",options.numBands)) {}
+    while (arguments.read("--block-size",options.blockSize)) {}
+    while (arguments.read("--nodata",options.noDataValue)) { options.useNoData = true; }
+
+    std::string cs;
+    while (arguments.read("--cs",cs)) { options.projected = (cs=="projected"); }
+
+    unsigned int numLevels = 3;
+    while (arguments.read("--levels",numLevels)) {}
+
+    unsigned int imageSize = 256;
+    while (arguments.read("--image-size",imageSize)) {}
+
+    unsigned int terrainSize = 64;
+    while (arguments.read("--terrain-size",terrainSize)) {}
+
+    unsigned int quadMapSize = 1000;
+    while (arguments.read("--quadtree-size",quadMapSize)) {}
+
+    unsigned int numLogThreads = 32;
+    while (arguments.read("--log-threads",numLogThreads)) {}
+
+    unsigned int numLogMessages = 10000;
+    while (arguments.read("--log-messages",numLogMessages)) {}
+
+    BuildBenchmarkOptions buildOptions;
+    while (arguments.read("--bin-dir",buildOptions.binDirectory)) {}
+    while (arguments.read("--build-levels",buildOptions.numLevels)) {}
+    while (arguments.read("--build-splits",buildOptions.primarySplitLevel,buildOptions.secondarySplitLevel)) {}
+    while (arguments.read("--build-processes",buildOptions.numProcesses)) {}
+    while (arguments.read("--history",buildOptions.historyFileName)) {}
+    while (arguments.read("--threshold",buildOptions.threshold)) {}
+    while (arguments.read("--history-window",buildOptions.historyWindow)) {}
+    while (arguments.read("--golden",buildOptions.goldenDirectory)) {}
+    while (arguments.read("--update-golden")) { buildOptions.updateGolden = true; }
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    if (options.numBands<1 || options.numBands>4 || options.size<2)
+    {
+        vpb::log(osg::WARN,"Error: synthetic imagery needs 1 to 4 bands and a size of at least 2.");
+        return 1;
+    }
+
+    // registers the GDAL drivers.
+    vpb::System::instance();
+
+    vpb::mkpath(directory.c_str(), 0755);
+    directory = getAbsolutePath(directory);
+
+    Results results;
+    bool success = true;
+    bool goldenUnavailable = false;
+
+    if (benchmarks.count("pipeline"))
+    {
+        success = runPipelineBenchmark(results, "pipeline", options, directory, numLevels, imageSize, terrainSize) && success;
+    }
+
+    if (benchmarks.count("quadtree"))
+    {
+        runQuadTreeBenchmark(results, quadMapSize);
+    }
+
+    if (benchmarks.count("logging"))
+    {
+        runLoggingBenchmark(results, directory, numLogThreads, numLogMessages);
+    }
+
+    if (benchmarks.count("build"))
+    {
+        success = runBuildBenchmark(results, options, directory, buildOptions, goldenUnavailable) && success;
+    }
+
+    if (outputFileName.empty())
+    {
+        writeJSON(std::cout, options, results);
+    }
+    else
+    {
+        osgDB::ofstream fout(outputFileName.c_str());
+        if (!fout)
+        {
+            vpb::log(osg::WARN,"Error: unable to open %s for writing.",outputFileName.c_str());
+            return 1;
+        }
+        writeJSON(fout, options, results);
+    }
+
+    if (!success) return 1;
+
+    // tell ctest the build benchmark couldn't be checked, rather than that it passed or failed.
+    return goldenUnavailable ? s_skipReturnCode : 0;
+}
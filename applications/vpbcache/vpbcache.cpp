@@ -39,6 +39,10 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->addCommandLineOption("--add","Add files from specified build sources to file cache.");
     arguments.getApplicationUsage()->addCommandLineOption("--overviews","Build overviews for the source data.");
     arguments.getApplicationUsage()->addCommandLineOption("--report","Report the contents of the file cache");
+    arguments.getApplicationUsage()->addCommandLineOption("--binary","Write the file cache in the indexed binary format.");
+    arguments.getApplicationUsage()->addCommandLineOption("--text","Write the file cache in the text format.");
+    arguments.getApplicationUsage()->addCommandLineOption("--compact","Merge the appended segments of a binary file cache into one.");
+    arguments.getApplicationUsage()->addCommandLineOption("--output <filename>","Write the file cache out to the specified file, use with --binary/--text to convert between formats.");
 
     vpb::Commandline commandline;
 
@@ -142,7 +146,30 @@ int main(int argc, char** argv)
         }
     }
 
-    fileCache->sync();
+    if (arguments.read("--binary"))
+    {
+        fileCache->setFormat(vpb::FileCache::BINARY_FORMAT);
+    }
+
+    if (arguments.read("--text"))
+    {
+        fileCache->setFormat(vpb::FileCache::TEXT_FORMAT);
+    }
+
+    std::string outputFileName;
+    if (arguments.read("--output", outputFileName))
+    {
+        fileCache->write(outputFileName);
+    }
+    else
+    {
+        fileCache->sync();
+    }
+
+    if (arguments.read("--compact"))
+    {
+        fileCache->compact();
+    }
 
     if (arguments.read("--report"))
     {
@@ -50,6 +50,7 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] filename ...");
     arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
     arguments.getApplicationUsage()->addCommandLineOption("--cache <filename>","Read the cache file to use a look up for locally cached files.");
+    arguments.getApplicationUsage()->addCommandLineOption("--metadata-cache <filename>","Read and update the cache of source file metadata, avoiding reopening unchanged source files.");
     arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
 
     if (arguments.read("--version"))
@@ -0,0 +1,132 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This application is open source and may be redistributed and/or modified
+ * freely and without restriction, both in commericial and non commericial applications,
+ * as long as this copyright notice is maintained.
+ *
+ * This application is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include <vpb/TileContainer>
+#include <vpb/BuildLog>
+#include <vpb/Version>
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osgDB/FileUtils>
+
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    // set up the usage document, in case we need to print out how to use this program.
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" application merges the .vpbc tile containers written by the tasks of a distributed build into one.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] -o output.vpbc container.vpbc ...");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information");
+    arguments.getApplicationUsage()->addCommandLineOption("--version","Display version information");
+    arguments.getApplicationUsage()->addCommandLineOption("-o <filename>","Specify the container to write.");
+    arguments.getApplicationUsage()->addCommandLineOption("--append","Add to the output container rather than replacing it.");
+    arguments.getApplicationUsage()->addCommandLineOption("--master <filename>","Set the master file of the output container, defaults to that of the first container which has one.");
+    arguments.getApplicationUsage()->addCommandLineOption("--report","Report the files in the output container.");
+
+    // if user requests help write it out to cout.
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout,osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    if (arguments.read("--version"))
+    {
+        std::cout<<"VirtualPlanetBuilder/vpbmerge version "<<vpbGetVersion()<<std::endl;
+        return 0;
+    }
+
+    std::string outputFileName;
+    while (arguments.read("-o",outputFileName)) {}
+
+    bool append = false;
+    while (arguments.read("--append")) { append = true; }
+
+    std::string masterFileName;
+    while (arguments.read("--master",masterFileName)) {}
+
+    bool report = false;
+    while (arguments.read("--report")) { report = true; }
+
+    // any options left unread are converted into errors to write out later.
+    arguments.reportRemainingOptionsAsUnrecognized();
+
+    // report any errors if they have occured when parsing the program aguments.
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    if (outputFileName.empty())
+    {
+        vpb::log(osg::WARN,"Error: no output container specified, please set one using -o <filename> on command line.");
+        return 1;
+    }
+
+    osg::ref_ptr<vpb::TileContainer> output = new vpb::TileContainer;
+    if (!output->open(outputFileName, append ? osgDB::Archive::WRITE : osgDB::Archive::CREATE))
+    {
+        vpb::log(osg::WARN,"Error: unable to open output container \"%s\".",outputFileName.c_str());
+        return 1;
+    }
+
+    for(int pos=1;pos<arguments.argc();++pos)
+    {
+        std::string filename = arguments[pos];
+        if (!vpb::TileContainer::isContainerFileName(filename))
+        {
+            vpb::log(osg::WARN,"Warning: \"%s\" is not a tile container, ignoring it.",filename.c_str());
+            continue;
+        }
+
+        osg::ref_ptr<vpb::TileContainer> input = new vpb::TileContainer;
+        if (!input->open(filename, osgDB::Archive::READ))
+        {
+            vpb::log(osg::WARN,"Error: unable to open container \"%s\".",filename.c_str());
+            return 1;
+        }
+
+        vpb::log(osg::NOTICE,"Merging %d files from %s",input->getNumFiles(),filename.c_str());
+
+        if (!output->merge(*input))
+        {
+            vpb::log(osg::WARN,"Error: unable to merge container \"%s\".",filename.c_str());
+            return 1;
+        }
+    }
+
+    if (!masterFileName.empty()) output->setMasterFileName(masterFileName);
+
+    if (report)
+    {
+        osgDB::Archive::FileNameList fileNames;
+        output->getFileNames(fileNames);
+
+        std::cout<<"Master file : "<<output->getMasterFileName()<<std::endl;
+        for(osgDB::Archive::FileNameList::const_iterator itr = fileNames.begin();
+            itr != fileNames.end();
+            ++itr)
+        {
+            std::cout<<"    "<<*itr<<std::endl;
+        }
+    }
+
+    vpb::log(osg::NOTICE,"Wrote %d files to %s",output->getNumFiles(),outputFileName.c_str());
+
+    output->close();
+
+    return 0;
+}
@@ -10,12 +10,23 @@
 */
 
 #include <vpb/BuildOperation>
+#include <vpb/Commandline>
+#include <vpb/DataSet>
+#include <vpb/MachinePool>
+#include <vpb/SourceManifest>
+#include <vpb/Task>
+
 #include <osg/CoordinateSystemNode>
 
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
 #include <osgDB/ReadFile>
 #include <osgTerrain/Terrain>
 
+#include <OpenThreads/Thread>
+
 #include <iostream>
+#include <sstream>
 
 
 unsigned int computeNumTiles(unsigned int numTilesLevel1, int level)
@@ -64,11 +75,479 @@ double computeEfficiency(unsigned int numXTilesLevel1, unsigned int numYTilesLev
     return efficiency;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Build planner, predicts the cost of a build from its sources and build options, calibrated
+// from the task files of earlier distributed builds.
+//
+
+/** Stages timed by MemoryTracker and recorded in the task files as "time stage <name>", the times are inclusive,
+  * createScene includes compress and mipmap and writeSubTile includes createScene.*/
+static const char* s_stageNames[] = { "readFrom", "equalize", "createScene", "compress", "mipmap", "writeSubTile" };
+static const unsigned int s_numStages = sizeof(s_stageNames)/sizeof(const char*);
+
+static const double s_megabyte = 1024.0*1024.0;
+
+struct Calibration
+{
+    Calibration(): numTiles(0.0), totalTime(0.0) {}
+
+    bool valid() const { return numTiles>0.0 && totalTime>0.0; }
+
+    double secondsPerTile() const { return valid() ? totalTime/numTiles : 1.0; }
+
+    vpb::TaskStatsMap               taskStatsMap;
+    std::map<std::string, double>   maxMemory;
+    std::map<std::string, double>   stageTimes;
+    double                          numTiles;
+    double                          totalTime;
+};
+
+static void readCalibrationTask(const std::string& filename, Calibration& calibration)
+{
+    osg::ref_ptr<vpb::Task> task = new vpb::Task(filename);
+    if (!task->read() || task->getStatus()!=vpb::Task::COMPLETED) return;
+
+    std::string type("unknown");
+    task->getProperty("type",type);
+
+    double duration = 0.0;
+    if (!task->getProperty("duration",duration)) return;
+
+    calibration.taskStatsMap[type].logTime(duration);
+
+    double memory = 0.0;
+    if (task->getProperty("memory peak MB",memory) && memory>calibration.maxMemory[type]) calibration.maxMemory[type] = memory;
+
+    // only tasks that recorded their tiles can give the cost per tile.
+    unsigned int numTiles = 0;
+    if (!task->getProperty("tiles",numTiles) || numTiles==0) return;
+
+    calibration.numTiles += double(numTiles);
+    calibration.totalTime += duration;
+
+    for(unsigned int i=0; i<s_numStages; ++i)
+    {
+        double stageTime = 0.0;
+        if (task->getProperty(std::string("time stage ")+s_stageNames[i],stageTime)) calibration.stageTimes[s_stageNames[i]] += stageTime;
+    }
+}
+
+/** Read the completed task files of an earlier build, either a single .task file or all those under a task directory.*/
+static void readCalibration(const std::string& path, Calibration& calibration)
+{
+    if (osgDB::fileType(path)==osgDB::DIRECTORY)
+    {
+        osgDB::DirectoryContents contents = osgDB::getDirectoryContents(path);
+        for(osgDB::DirectoryContents::iterator itr = contents.begin(); itr != contents.end(); ++itr)
+        {
+            if (*itr=="." || *itr=="..") continue;
+            readCalibration(path + "/" + *itr, calibration);
+        }
+    }
+    else if (osgDB::getLowerCaseFileExtension(path)=="task")
+    {
+        readCalibrationTask(path, calibration);
+    }
+}
+
+/** Bytes per pixel of imagery of textureType as written out, or while held in memory before compression.*/
+static double computeBytesPerPixel(vpb::ImageOptions::TextureType textureType, bool inMemory)
+{
+    switch(textureType)
+    {
+        case(vpb::ImageOptions::RGB_24): return 3.0;
+        case(vpb::ImageOptions::RGBA): return 4.0;
+        case(vpb::ImageOptions::RGB_16): return 2.0;
+        case(vpb::ImageOptions::RGBA_16): return 2.0;
+        case(vpb::ImageOptions::RGB_S3TC_DXT1): return inMemory ? 3.0 : 0.5;
+        case(vpb::ImageOptions::RGBA_S3TC_DXT1): return inMemory ? 4.0 : 0.5;
+        case(vpb::ImageOptions::RGBA_S3TC_DXT3): return inMemory ? 4.0 : 1.0;
+        case(vpb::ImageOptions::RGBA_S3TC_DXT5): return inMemory ? 4.0 : 1.0;
+        case(vpb::ImageOptions::ARB_COMPRESSED): return inMemory ? 3.0 : 0.5;
+        case(vpb::ImageOptions::COMPRESSED_TEXTURE): return inMemory ? 3.0 : 0.5;
+        case(vpb::ImageOptions::COMPRESSED_RGBA_TEXTURE): return inMemory ? 4.0 : 1.0;
+        case(vpb::ImageOptions::RGB32F): return 12.0;
+        case(vpb::ImageOptions::RGBA32F): return 16.0;
+        default: return 4.0;
+    }
+}
+
+static const char* getTextureTypeName(vpb::ImageOptions::TextureType textureType)
+{
+    switch(textureType)
+    {
+        case(vpb::ImageOptions::RGB_24): return "RGB_24";
+        case(vpb::ImageOptions::RGBA): return "RGBA";
+        case(vpb::ImageOptions::RGB_16): return "RGB_16";
+        case(vpb::ImageOptions::RGBA_16): return "RGBA_16";
+        case(vpb::ImageOptions::RGB_S3TC_DXT1): return "RGB_S3TC_DXT1";
+        case(vpb::ImageOptions::RGBA_S3TC_DXT1): return "RGBA_S3TC_DXT1";
+        case(vpb::ImageOptions::RGBA_S3TC_DXT3): return "RGBA_S3TC_DXT3";
+        case(vpb::ImageOptions::RGBA_S3TC_DXT5): return "RGBA_S3TC_DXT5";
+        case(vpb::ImageOptions::ARB_COMPRESSED): return "ARB_COMPRESSED";
+        case(vpb::ImageOptions::COMPRESSED_TEXTURE): return "COMPRESSED_TEXTURE";
+        case(vpb::ImageOptions::COMPRESSED_RGBA_TEXTURE): return "COMPRESSED_RGBA_TEXTURE";
+        case(vpb::ImageOptions::RGB32F): return "RGB32F";
+        case(vpb::ImageOptions::RGBA32F): return "RGBA32F";
+        default: return "unknown";
+    }
+}
+
+/** Sizes of a full tile of the build, the imagery of each layer and the height field, on disk and in memory.*/
+struct TileSizes
+{
+    TileSizes(): imageBytes(0.0), terrainBytes(0.0), memoryBytes(0.0) {}
+
+    double  imageBytes;
+    double  terrainBytes;
+    double  memoryBytes;
+};
+
+static TileSizes computeTileSizes(const vpb::BuildOptions& buildOptions, unsigned int numLayers, std::ostream& out)
+{
+    TileSizes sizes;
+
+    for(unsigned int layer=0; layer<numLayers; ++layer)
+    {
+        const vpb::ImageOptions* imageOptions = buildOptions.getValidLayerImageOptions(layer);
+        double numPixels = double(imageOptions->getMaximumTileImageSize())*double(imageOptions->getMaximumTileImageSize());
+
+        // a full chain of mipmaps adds a third.
+        double mipmapScale = imageOptions->getMipMappingMode()==vpb::ImageOptions::MIP_MAPPING_IMAGERY ? 4.0/3.0 : 1.0;
+
+        double imageBytes = numPixels * computeBytesPerPixel(imageOptions->getTextureType(), false) * mipmapScale;
+        sizes.imageBytes += imageBytes;
+        sizes.memoryBytes += numPixels * computeBytesPerPixel(imageOptions->getTextureType(), true) * mipmapScale;
+
+        out<<"  layer "<<layer<<" "<<imageOptions->getMaximumTileImageSize()<<"x"<<imageOptions->getMaximumTileImageSize()
+           <<" "<<getTextureTypeName(imageOptions->getTextureType())
+           <<(mipmapScale>1.0 ? " with mipmaps" : "")
+           <<" "<<imageBytes/1024.0<<"KB per tile"<<std::endl;
+    }
+
+    // height fields are held as floats, the polygonal geometry has a vertex, normal, texture coordinate per layer and two triangles of short indices per sample.
+    double numSamples = double(buildOptions.getMaximumTileTerrainSize())*double(buildOptions.getMaximumTileTerrainSize());
+    double bytesPerSample = buildOptions.getGeometryType()==vpb::BuildOptions::POLYGONAL ? 12.0 + 12.0 + 8.0*double(osg::maximum(numLayers,1u)) + 12.0 : 4.0;
+    sizes.terrainBytes = numSamples * bytesPerSample;
+    sizes.memoryBytes += numSamples * 4.0;
+
+    out<<"  terrain "<<buildOptions.getMaximumTileTerrainSize()<<"x"<<buildOptions.getMaximumTileTerrainSize()
+       <<" "<<sizes.terrainBytes/1024.0<<"KB per tile"<<std::endl;
+
+    return sizes;
+}
+
+/** Predicted cost of the tasks a distributed build split at primary and secondary split levels would run, a primary
+  * split level of 0 being a single process osgdem build.*/
+struct TaskPlan
+{
+    TaskPlan(): primarySplitLevel(0), secondarySplitLevel(0), numTasks(0), maxTaskTiles(0.0), maxTaskMemory(0.0), totalTime(0.0), completionTime(0.0) {}
+
+    unsigned int    primarySplitLevel;
+    unsigned int    secondarySplitLevel;
+    unsigned int    numTasks;
+    double          maxTaskTiles;
+    double          maxTaskMemory;
+    double          totalTime;
+    double          completionTime;
+};
+
+struct PlanOptions
+{
+    PlanOptions(): numProcesses(1), processesPerMachine(1), memoryPerTask(0.0), taskOverhead(5.0) {}
+
+    unsigned int    numProcesses;
+    unsigned int    processesPerMachine;
+    double          memoryPerTask;
+    double          taskOverhead;
+};
+
+/** Estimate the peak memory of one of numTasks tasks sharing the tiles down to lastLevel, each holds around two rows
+  * of its tiles of lastLevel as one row is read while the previous is equalized and written.*/
+static double computeTaskMemory(const std::vector<unsigned int>& numTiles, unsigned int lastLevel, unsigned int numTasks,
+                                const TileSizes& tileSizes, const vpb::BuildOptions& buildOptions)
+{
+    double tilesPerTask = double(numTiles[lastLevel])/double(osg::maximum(numTasks,1u));
+    double tilesHeld = osg::minimum(tilesPerTask, 2.0*ceil(sqrt(tilesPerTask)));
+    return tilesHeld*tileSizes.memoryBytes + double(buildOptions.getWriteBehindBufferSize())*s_megabyte;
+}
+
+static double sumTiles(const std::vector<unsigned int>& numTiles, unsigned int firstLevel, unsigned int lastLevel)
+{
+    double total = 0.0;
+    for(unsigned int level=firstLevel; level<=lastLevel && level<numTiles.size(); ++level) total += double(numTiles[level]);
+    return total;
+}
+
+static TaskPlan computeTaskPlan(const std::vector<unsigned int>& numTiles, const std::vector<unsigned int>& numSubdividedTiles,
+                                unsigned int primarySplitLevel, unsigned int secondarySplitLevel,
+                                const TileSizes& tileSizes, const vpb::BuildOptions& buildOptions,
+                                const Calibration& calibration, const PlanOptions& planOptions)
+{
+    // split levels beyond the tiles of the build aren't split at.
+    unsigned int lastLevel = numTiles.size()-1;
+    if (primarySplitLevel>lastLevel) primarySplitLevel = 0;
+    if (secondarySplitLevel<=primarySplitLevel || secondarySplitLevel>lastLevel) secondarySplitLevel = 0;
+
+    TaskPlan plan;
+    plan.primarySplitLevel = primarySplitLevel;
+    plan.secondarySplitLevel = secondarySplitLevel;
+
+    double secondsPerTile = calibration.secondsPerTile();
+    double processes = double(planOptions.numProcesses);
+
+    if (primarySplitLevel==0)
+    {
+        plan.numTasks = 1;
+        plan.maxTaskTiles = sumTiles(numTiles, 0, lastLevel);
+        plan.maxTaskMemory = computeTaskMemory(numTiles, lastLevel, 1, tileSizes, buildOptions);
+        plan.totalTime = plan.maxTaskTiles*secondsPerTile + planOptions.taskOverhead;
+        plan.completionTime = plan.totalTime;
+        return plan;
+    }
+
+    // the root task builds down to the primary split level, each task of a split level then builds the tiles below one of the
+    // tiles subdivided at the level above, the stages of tasks running one after the other.
+    std::vector<unsigned int> splitLevels;
+    splitLevels.push_back(primarySplitLevel);
+    if (secondarySplitLevel!=0) splitLevels.push_back(secondarySplitLevel);
+
+    double rootTiles = sumTiles(numTiles, 0, primarySplitLevel-1);
+    plan.numTasks = 1;
+    plan.maxTaskTiles = rootTiles;
+    plan.maxTaskMemory = computeTaskMemory(numTiles, primarySplitLevel-1, 1, tileSizes, buildOptions);
+    plan.totalTime = rootTiles*secondsPerTile + planOptions.taskOverhead;
+    plan.completionTime = plan.totalTime;
+
+    for(unsigned int i=0; i<splitLevels.size(); ++i)
+    {
+        unsigned int firstLevel = splitLevels[i];
+        unsigned int endLevel = (i+1<splitLevels.size()) ? splitLevels[i+1]-1 : lastLevel;
+        unsigned int numTasks = numSubdividedTiles[firstLevel-1];
+        if (numTasks==0) continue;
+
+        double tiles = sumTiles(numTiles, firstLevel, endLevel);
+        double tilesPerTask = tiles/double(numTasks);
+        double taskTime = tilesPerTask*secondsPerTile + planOptions.taskOverhead;
+
+        plan.numTasks += numTasks;
+        plan.maxTaskTiles = osg::maximum(plan.maxTaskTiles, tilesPerTask);
+        plan.maxTaskMemory = osg::maximum(plan.maxTaskMemory, computeTaskMemory(numTiles, endLevel, numTasks, tileSizes, buildOptions));
+        plan.totalTime += taskTime*double(numTasks);
+        plan.completionTime += ceil(double(numTasks)/processes)*taskTime;
+    }
+
+    return plan;
+}
+
+static std::string formatTime(double seconds)
+{
+    std::ostringstream str;
+    str.setf(std::ios::fixed, std::ios::floatfield);
+    str.precision(1);
+    if (seconds>=24.0*3600.0) str<<seconds/(24.0*3600.0)<<" days";
+    else if (seconds>=3600.0) str<<seconds/3600.0<<" hours";
+    else if (seconds>=60.0) str<<seconds/60.0<<" minutes";
+    else str<<seconds<<" seconds";
+    return str.str();
+}
+
+static void reportTaskPlan(std::ostream& out, const TaskPlan& plan)
+{
+    if (plan.primarySplitLevel==0) out<<"  no split";
+    else if (plan.secondarySplitLevel==0) out<<"  --split "<<plan.primarySplitLevel;
+    else out<<"  --splits "<<plan.primarySplitLevel<<" "<<plan.secondarySplitLevel;
+
+    out<<" : "<<plan.numTasks<<" tasks, up to "<<plan.maxTaskTiles<<" tiles and "<<plan.maxTaskMemory/s_megabyte<<"MB per task"
+       <<", "<<formatTime(plan.totalTime)<<" of task time, completing in "<<formatTime(plan.completionTime)<<std::endl;
+}
+
+/** Predict the cost of building the terrainTile's sources with its build options, returning non zero on error.*/
+static int planBuild(osgTerrain::TerrainTile* terrainTile, const Calibration& calibration, const PlanOptions& planOptions)
+{
+    std::ostream& out = std::cout;
+    out.setf(std::ios::fixed, std::ios::floatfield);
+    out.precision(1);
+
+    osg::ref_ptr<vpb::DataSet> dataset = new vpb::DataSet;
+    dataset->addTerrain(terrainTile);
+
+    std::vector<unsigned int> numTiles, numSubdividedTiles;
+    if (!dataset->computeTileCounts(numTiles, numSubdividedTiles) || numTiles.empty())
+    {
+        dataset->log(osg::WARN,"Error: unable to compute the tiles of the build, check the sources.");
+        return 1;
+    }
+
+    unsigned int numLayers = 0;
+    for(vpb::CompositeSource::source_iterator itr(dataset->getSourceGraph()); itr.valid(); ++itr)
+    {
+        if ((*itr)->getType()==vpb::Source::IMAGE) numLayers = osg::maximum(numLayers, (*itr)->getLayer()+1);
+    }
+
+    out<<"Tile sizes"<<std::endl;
+    TileSizes tileSizes = computeTileSizes(*dataset, numLayers, out);
+
+    out<<"Tiles and output per level, full tiles before any image file compression"<<std::endl;
+    double totalTiles = 0.0, totalImageBytes = 0.0, totalTerrainBytes = 0.0;
+    for(unsigned int level=0; level<numTiles.size(); ++level)
+    {
+        double imageBytes = double(numTiles[level])*tileSizes.imageBytes;
+        double terrainBytes = double(numTiles[level])*tileSizes.terrainBytes;
+        out<<"  level "<<level<<" tiles "<<numTiles[level]<<" imagery "<<imageBytes/s_megabyte<<"MB terrain "<<terrainBytes/s_megabyte<<"MB"<<std::endl;
+
+        totalTiles += double(numTiles[level]);
+        totalImageBytes += imageBytes;
+        totalTerrainBytes += terrainBytes;
+    }
+    out<<"  total tiles "<<totalTiles<<" imagery "<<totalImageBytes/s_megabyte<<"MB terrain "<<totalTerrainBytes/s_megabyte<<"MB"<<std::endl;
+
+    if (calibration.valid())
+    {
+        out<<"Calibration from "<<calibration.numTiles<<" tiles built in "<<formatTime(calibration.totalTime)
+           <<", "<<calibration.secondsPerTile()<<" seconds per tile"<<std::endl;
+        for(vpb::TaskStatsMap::const_iterator itr = calibration.taskStatsMap.begin(); itr != calibration.taskStatsMap.end(); ++itr)
+        {
+            std::map<std::string, double>::const_iterator mitr = calibration.maxMemory.find(itr->first);
+            out<<"  task type '"<<itr->first<<"' "<<itr->second.numTasks()<<" tasks, time min "<<itr->second.minTime()
+               <<"s average "<<itr->second.averageTime()<<"s max "<<itr->second.maxTime()<<"s";
+            if (mitr != calibration.maxMemory.end()) out<<", peak memory "<<mitr->second<<"MB";
+            out<<std::endl;
+        }
+
+        out<<"Predicted time per stage, summed over threads, including the time of the stages nested within it"<<std::endl;
+        for(unsigned int i=0; i<s_numStages; ++i)
+        {
+            std::map<std::string, double>::const_iterator sitr = calibration.stageTimes.find(s_stageNames[i]);
+            if (sitr==calibration.stageTimes.end()) continue;
+            out<<"  "<<s_stageNames[i]<<" "<<formatTime(sitr->second/calibration.numTiles*totalTiles)<<std::endl;
+        }
+    }
+    else
+    {
+        out<<"No calibration, times assume 1 second per tile, pass --calibrate <task directory> of an earlier build to calibrate them."<<std::endl;
+    }
+
+    out<<"Configured build on "<<planOptions.numProcesses<<" processes"<<std::endl;
+    TaskPlan configuredPlan = computeTaskPlan(numTiles, numSubdividedTiles,
+                                              dataset->getDistributedBuildSplitLevel(), dataset->getDistributedBuildSecondarySplitLevel(),
+                                              tileSizes, *dataset, calibration, planOptions);
+    reportTaskPlan(out, configuredPlan);
+
+    // try every combination of split levels that leaves each task of the last split at least one level to build.
+    TaskPlan bestPlan = computeTaskPlan(numTiles, numSubdividedTiles, 0, 0, tileSizes, *dataset, calibration, planOptions);
+    bool bestWithinMemory = planOptions.memoryPerTask<=0.0 || bestPlan.maxTaskMemory<=planOptions.memoryPerTask*s_megabyte;
+    unsigned int lastLevel = numTiles.size()-1;
+    for(unsigned int primary=1; primary<=lastLevel; ++primary)
+    {
+        for(unsigned int secondary=0; secondary<=lastLevel; secondary = (secondary==0 ? primary+1 : secondary+1))
+        {
+            TaskPlan plan = computeTaskPlan(numTiles, numSubdividedTiles, primary, secondary, tileSizes, *dataset, calibration, planOptions);
+            bool withinMemory = planOptions.memoryPerTask<=0.0 || plan.maxTaskMemory<=planOptions.memoryPerTask*s_megabyte;
+
+            if ((withinMemory && !bestWithinMemory) ||
+                (withinMemory==bestWithinMemory && plan.completionTime<bestPlan.completionTime))
+            {
+                bestPlan = plan;
+                bestWithinMemory = withinMemory;
+            }
+        }
+    }
+
+    out<<"Recommended split levels"<<std::endl;
+    reportTaskPlan(out, bestPlan);
+    if (!bestWithinMemory)
+    {
+        out<<"  Warning: no split levels keep each task within "<<planOptions.memoryPerTask<<"MB, consider smaller tiles or --memory-budget."<<std::endl;
+    }
+
+    // share the cores of each process between the read and the write threads in proportion to the time spent reading
+    // and writing tiles, allowing twice as many threads as cores to cover waiting on I/O.  writeSubTile already
+    // includes creating the scene of the tile, so it alone covers the write threads.
+    if (calibration.valid())
+    {
+        double readTime = calibration.stageTimes.count("readFrom") ? calibration.stageTimes.find("readFrom")->second : 0.0;
+        double writeTime = calibration.stageTimes.count("writeSubTile") ? calibration.stageTimes.find("writeSubTile")->second : 0.0;
+        if (readTime+writeTime>0.0)
+        {
+            double scale = 2.0/(double(planOptions.processesPerMachine)*(readTime+writeTime));
+            double readRatio = osg::maximum(0.25, floor(readTime*scale*4.0+0.5)/4.0);
+            double writeRatio = osg::maximum(0.25, floor(writeTime*scale*4.0+0.5)/4.0);
+
+            out<<"Recommended thread ratios for "<<planOptions.processesPerMachine<<" processes per machine"<<std::endl;
+            out.precision(2);
+            out<<"  --read-threads-ratio "<<readRatio<<" --write-threads-ratio "<<writeRatio<<std::endl;
+            out.precision(1);
+        }
+    }
+
+    return 0;
+}
+
 int main( int argc, char **argv )
 {
     // use an ArgumentParser object to manage the program arguments.
     osg::ArgumentParser arguments(&argc,argv);
 
+    // with sources to build, predict the cost of building them rather than sizing a whole earth database.
+    std::string sourceName;
+    while (arguments.read("--source",sourceName)) {}
+
+    if (!sourceName.empty() || arguments.find("-d")>0 || arguments.find("-t")>0)
+    {
+        Calibration calibration;
+        std::string calibrationPath;
+        while (arguments.read("--calibrate",calibrationPath)) { readCalibration(calibrationPath, calibration); }
+
+        PlanOptions planOptions;
+        planOptions.numProcesses = OpenThreads::GetNumberOfProcessors();
+        while (arguments.read("--processes",planOptions.numProcesses)) {}
+        while (arguments.read("--processes-per-machine",planOptions.processesPerMachine)) {}
+        while (arguments.read("--memory-per-task",planOptions.memoryPerTask)) {}
+        while (arguments.read("--task-overhead",planOptions.taskOverhead)) {}
+        planOptions.numProcesses = osg::maximum(planOptions.numProcesses, 1u);
+        planOptions.processesPerMachine = osg::maximum(planOptions.processesPerMachine, 1u);
+
+        osg::ref_ptr<osgTerrain::TerrainTile> terrain;
+        if (!sourceName.empty())
+        {
+            std::string fileName = osgDB::findDataFile(sourceName);
+            osg::ref_ptr<osg::Node> node;
+            if (vpb::SourceManifest::isManifestFile(fileName))
+            {
+                osg::ref_ptr<vpb::SourceManifest> manifest = new vpb::SourceManifest;
+                if (manifest->open(fileName)) node = manifest->createTerrainTile();
+            }
+            else if (!fileName.empty())
+            {
+                node = osgDB::readNodeFile(fileName);
+            }
+
+            terrain = dynamic_cast<osgTerrain::TerrainTile*>(node.get());
+            if (!terrain)
+            {
+                std::cout<<"Error: unable to load source file \""<<sourceName<<"\""<<std::endl;
+                return 1;
+            }
+        }
+
+        if (!terrain) terrain = new osgTerrain::TerrainTile;
+
+        vpb::Commandline commandline;
+        int result = commandline.read(std::cout, arguments, terrain.get());
+        if (result) return result;
+
+        arguments.reportRemainingOptionsAsUnrecognized();
+        if (arguments.errors())
+        {
+            arguments.writeErrorMessages(std::cout);
+            return 1;
+        }
+
+        return planBuild(terrain.get(), calibration, planOptions);
+    }
+
     osg::ref_ptr<osg::EllipsoidModel> ellipsoid = new osg::EllipsoidModel;
     double circumferance = ellipsoid->getRadiusEquator() * 2.0 * osg::PI;
     
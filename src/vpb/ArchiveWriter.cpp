@@ -0,0 +1,218 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/ArchiveWriter>
+#include <vpb/TileContainer>
+#include <vpb/BuildLog>
+#include <vpb/MemoryTracker>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+
+#include <sstream>
+
+using namespace vpb;
+
+ArchiveWriter::ArchiveWriter(osgDB::Archive* archive):
+    _archive(archive),
+    _container(dynamic_cast<TileContainer*>(archive)),
+    _nextTicket(1),
+    _committing(false),
+    _maxNumPendingTickets(0)
+{
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    flush();
+}
+
+unsigned int ArchiveWriter::reserve()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    unsigned int ticket = _nextTicket++;
+    _tickets[ticket];
+
+    if (_tickets.size()>_maxNumPendingTickets) _maxNumPendingTickets = _tickets.size();
+
+    return ticket;
+}
+
+bool ArchiveWriter::writeNode(unsigned int ticket, const osg::Node& node, const std::string& filename, const osgDB::Options* options)
+{
+    return write(ticket, node, false, filename, options);
+}
+
+bool ArchiveWriter::writeImage(unsigned int ticket, const osg::Image& image, const std::string& filename, const osgDB::Options* options)
+{
+    return write(ticket, image, true, filename, options);
+}
+
+bool ArchiveWriter::write(unsigned int ticket, const osg::Object& object, bool isImage, const std::string& filename, const osgDB::Options* options)
+{
+    if (ticket==0)
+    {
+        ticket = reserve();
+        bool result = write(ticket, object, isImage, filename, options);
+        complete(ticket);
+        return result;
+    }
+
+    PendingFile file;
+    file.filename = filename;
+    file.isImage = isImage;
+    file.options = options;
+
+    bool serialized = false;
+    if (_container)
+    {
+        // serialize on the calling thread so that committing is only the append.
+        osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+        if (!rw)
+        {
+            log(osg::WARN, "Error, write support for data type not available for archive file %s",filename.c_str());
+            return false;
+        }
+
+        std::ostringstream fout(std::ios::out | std::ios::binary);
+        osgDB::ReaderWriter::WriteResult result = isImage ?
+            rw->writeImage(static_cast<const osg::Image&>(object), fout, options) :
+            rw->writeNode(static_cast<const osg::Node&>(object), fout, options);
+
+        if (!result.success())
+        {
+            log(osg::WARN, "Error, in serializing archive file %s",filename.c_str());
+            return false;
+        }
+
+        file.data = fout.str();
+        serialized = true;
+
+        // the serialized data is held until the ticket is committed, so account it to the write queue.
+        MemoryTracker::instance()->allocated(MemoryTracker::WRITE_QUEUE, double(file.data.size()));
+    }
+
+    if (!serialized) file.object = &object;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    Tickets::iterator itr = _tickets.find(ticket);
+    if (itr==_tickets.end() || itr->second.completed)
+    {
+        log(osg::WARN, "Error, archive file %s written with an invalid ticket %u",filename.c_str(),ticket);
+        MemoryTracker::instance()->released(MemoryTracker::WRITE_QUEUE, double(file.data.size()));
+        return false;
+    }
+
+    itr->second.files.push_back(PendingFile());
+    PendingFile& pending = itr->second.files.back();
+    pending.filename = file.filename;
+    pending.data.swap(file.data);
+    pending.object = file.object;
+    pending.isImage = file.isImage;
+    pending.options = file.options;
+
+    return true;
+}
+
+void ArchiveWriter::complete(unsigned int ticket)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        Tickets::iterator itr = _tickets.find(ticket);
+        if (itr==_tickets.end()) return;
+
+        itr->second.completed = true;
+    }
+
+    commit();
+}
+
+void ArchiveWriter::flush()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        for(Tickets::iterator itr = _tickets.begin();
+            itr != _tickets.end();
+            ++itr)
+        {
+            itr->second.completed = true;
+        }
+    }
+
+    commit();
+}
+
+void ArchiveWriter::commit()
+{
+    // only one thread commits at a time, a thread completing a ticket while another is committing
+    // leaves the ticket for the committing thread rather than waiting for it.
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_committing) return;
+        _committing = true;
+    }
+
+    PendingFiles files;
+    while(true)
+    {
+        files.clear();
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+            Tickets::iterator itr = _tickets.begin();
+            if (itr==_tickets.end() || !itr->second.completed)
+            {
+                _committing = false;
+                return;
+            }
+
+            files.swap(itr->second.files);
+            _tickets.erase(itr);
+        }
+
+        for(PendingFiles::iterator fitr = files.begin();
+            fitr != files.end();
+            ++fitr)
+        {
+            commitFile(*fitr);
+        }
+    }
+}
+
+bool ArchiveWriter::commitFile(PendingFile& file)
+{
+    if (!file.object.valid())
+    {
+        bool result = _container->writeFile(file.filename, file.data);
+        MemoryTracker::instance()->released(MemoryTracker::WRITE_QUEUE, double(file.data.size()));
+        if (result) return true;
+
+        log(osg::WARN, "Error, in writing archive file %s",file.filename.c_str());
+        return false;
+    }
+
+    osgDB::ReaderWriter::WriteResult result = file.isImage ?
+        _archive->writeImage(static_cast<const osg::Image&>(*file.object), file.filename, file.options.get()) :
+        _archive->writeNode(static_cast<const osg::Node&>(*file.object), file.filename, file.options.get());
+
+    if (result.success()) return true;
+
+    if (!result.message().empty()) log(osg::WARN, "%s", result.message().c_str());
+    else log(osg::WARN, "Error, in writing archive file %s",file.filename.c_str());
+    return false;
+}
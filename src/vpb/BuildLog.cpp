@@ -13,7 +13,11 @@
 
 #include <vpb/BuildLog>
 #include <vpb/BuildOperation>
+#include <vpb/MemoryTracker>
 
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 
@@ -81,15 +85,16 @@ void vpb::log(osg::NotifySeverity level, const char* format, ...)
 {
     if (level>osg::getNotifyLevel()) return;
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_opertionLogMapMutex);
-    
-    ThreadLog& tl = s_opertionLogMap;
-    
+    // format before taking the lock so threads only serialize on recording the message.
     va_list args; va_start(args, format);
     char str[1024];
     vsnprintf(str, sizeof(str), format, args);
-    tl.log(level, str);
     va_end(args);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_opertionLogMapMutex);
+    
+    ThreadLog& tl = s_opertionLogMap;
+    tl.log(level, str);
 }
 
 void vpb::pushOperationLog(OperationLog* operationLog)
@@ -111,27 +116,135 @@ void vpb::popOperationLog()
 //  LogFile
 
 
-LogFile::LogFile(const std::string& filename)
+LogFile::LogFile(const std::string& filename):
+    _flushThread(0),
+    _flushInterval(0.1),
+    _taskFileUpdateInterval(1.0),
+    _lastTaskFileUpdateTime(0.0)
 {
     _fout.open(filename.c_str());
     
     _fout.setf(std::ios::left, std::ios::adjustfield);
     _fout.setf(std::ios::fixed, std::ios::floatfield);
     _fout.precision(3);
+
+    _flushThread = new FlushThread(this);
+    _flushThread->startThread();
+}
+
+LogFile::~LogFile()
+{
+    if (_flushThread)
+    {
+        _flushThread->stop();
+        delete _flushThread;
+    }
+
+    flush();
+
+    if (_taskFile.valid() && _lastMessage.valid())
+    {
+        _taskFile->setProperty("last message time",_lastMessage->time);
+        _taskFile->setProperty("last message",_lastMessage->message);
+    }
+}
+
+/** Choose the buffer for the calling thread, the main thread isn't an OpenThreads::Thread so always gets the first.*/
+static unsigned int getBufferIndex(unsigned int numBuffers)
+{
+    size_t address = reinterpret_cast<size_t>(OpenThreads::Thread::CurrentThread());
+    return static_cast<unsigned int>((address>>4) ^ (address>>12)) % numBuffers;
 }
 
 void LogFile::write(Message* message)
+{
+    Buffer& buffer = _buffers[getBufferIndex(NUM_BUFFERS)];
+
+    bool bufferFull = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(buffer.mutex);
+        buffer.messages.push_back(message);
+        bufferFull = buffer.messages.size()>=MAXIMUM_BUFFERED_MESSAGES;
+    }
+
+    // write warnings and errors straight away so they aren't lost if the build aborts, and write out
+    // full buffers on the logging thread so they can't grow without bound if the flush thread falls behind.
+    if (bufferFull || message->level<=osg::WARN) flush();
+}
+
+struct MessageTimeLess
+{
+    bool operator() (const osg::ref_ptr<Message>& lhs, const osg::ref_ptr<Message>& rhs) const { return lhs->time < rhs->time; }
+};
+
+void LogFile::flush()
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-    _fout<<std::setw(12)<<message->time<<" : "<<message->message<<std::endl;
-    
-    if (_taskFile.valid())
+
+    Messages messages;
+    for(unsigned int i=0; i<NUM_BUFFERS; ++i)
+    {
+        Buffer& buffer = _buffers[i];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> bufferLock(buffer.mutex);
+        if (buffer.messages.empty()) continue;
+
+        if (messages.empty()) messages.swap(buffer.messages);
+        else
+        {
+            messages.insert(messages.end(), buffer.messages.begin(), buffer.messages.end());
+            buffer.messages.clear();
+        }
+    }
+
+    if (messages.empty()) return;
+
+    std::stable_sort(messages.begin(), messages.end(), MessageTimeLess());
+
+    for(Messages::iterator itr = messages.begin();
+        itr != messages.end();
+        ++itr)
+    {
+        _fout<<std::setw(12)<<(*itr)->time<<" : "<<(*itr)->message<<'\n';
+    }
+    _fout.flush();
+
+    _lastMessage = messages.back();
+
+    if (_taskFile.valid() && (_lastMessage->time - _lastTaskFileUpdateTime)>=_taskFileUpdateInterval)
     {
-        _taskFile->setProperty("last message time",message->time);
-        _taskFile->setProperty("last message",message->message);
+        _taskFile->setProperty("last message time",_lastMessage->time);
+        _taskFile->setProperty("last message",_lastMessage->message);
+        _lastTaskFileUpdateTime = _lastMessage->time;
     }
 }
 
+void LogFile::FlushThread::run()
+{
+    while(true)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if (_done) return;
+
+            _wake.wait(&_mutex, static_cast<unsigned long>(_logFile->getFlushInterval()*1000.0));
+            if (_done) return;
+        }
+
+        _logFile->flush();
+    }
+}
+
+void LogFile::FlushThread::stop()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _done = true;
+        _wake.signal();
+    }
+
+    join();
+}
+
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -350,6 +463,8 @@ void BuildLog::report(std::ostream& out)
         (*itr)->report(out);
     }
 
+    out<<std::endl;
+    MemoryTracker::instance()->report(out);
 }
 
 
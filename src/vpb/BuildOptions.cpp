@@ -114,7 +114,11 @@ BuildOptions::BuildOptions()
     _maximumVisiableDistanceOfTopLevel = 1e10;
     _radiusToMaxVisibleDistanceRatio = 7.0f;
     _simplifyTerrain = true;
+    _optimizeVertexCache = false;
+    _compactVertexFormat = false;
+    _zOrderTraversal = false;
     _skirtRatio = 0.02f;
+    _heightFieldTolerance = 0.0f;
     _tileBasename = "output";
     _tileExtension = ".osgb";
     _useLocalTileTransform = true;
@@ -131,6 +135,12 @@ BuildOptions::BuildOptions()
     
     _notifyLevel = NOTICE;
     _disableWrites = false;
+    _skipUnchangedWrites = false;
+    _writeBehindBufferSize = 0;
+    _numWriteBehindThreads = 2;
+    _syncWrites = false;
+    _traceFileName = "";
+    _memoryBudget = 0;
     
     _numReadThreadsToCoresRatio = 0.0f;
     _numWriteThreadsToCoresRatio = 0.0f;
@@ -189,6 +199,7 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _directory = rhs._directory;
     _outputTaskDirectories = rhs._outputTaskDirectories;
     _extents = rhs._extents;
+    _patchExtents = rhs._patchExtents;
     _geometryType = rhs._geometryType;
     _intermediateBuildName = rhs._intermediateBuildName;
     _logFileName = rhs._logFileName;
@@ -198,7 +209,11 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     _maximumVisiableDistanceOfTopLevel = rhs._maximumVisiableDistanceOfTopLevel;
     _radiusToMaxVisibleDistanceRatio = rhs._radiusToMaxVisibleDistanceRatio;
     _simplifyTerrain = rhs._simplifyTerrain;
+    _optimizeVertexCache = rhs._optimizeVertexCache;
+    _compactVertexFormat = rhs._compactVertexFormat;
+    _zOrderTraversal = rhs._zOrderTraversal;
     _skirtRatio = rhs._skirtRatio;
+    _heightFieldTolerance = rhs._heightFieldTolerance;
     _tileBasename = rhs._tileBasename;
     _tileExtension = rhs._tileExtension;
     _useLocalTileTransform = rhs._useLocalTileTransform;
@@ -214,6 +229,12 @@ void BuildOptions::setBuildOptions(const BuildOptions& rhs)
     
     _notifyLevel = rhs._notifyLevel;
     _disableWrites = rhs._disableWrites;
+    _skipUnchangedWrites = rhs._skipUnchangedWrites;
+    _writeBehindBufferSize = rhs._writeBehindBufferSize;
+    _numWriteBehindThreads = rhs._numWriteBehindThreads;
+    _syncWrites = rhs._syncWrites;
+    _traceFileName = rhs._traceFileName;
+    _memoryBudget = rhs._memoryBudget;
     
     _numReadThreadsToCoresRatio = rhs._numReadThreadsToCoresRatio;
     _numWriteThreadsToCoresRatio = rhs._numWriteThreadsToCoresRatio;
@@ -360,7 +381,11 @@ bool BuildOptions::compatible(BuildOptions& rhs) const
     if (_maximumVisiableDistanceOfTopLevel != rhs._maximumVisiableDistanceOfTopLevel) return false;
     if (_radiusToMaxVisibleDistanceRatio != rhs._radiusToMaxVisibleDistanceRatio) return false;
     if (_simplifyTerrain != rhs._simplifyTerrain) return false;
+    if (_optimizeVertexCache != rhs._optimizeVertexCache) return false;
+    if (_compactVertexFormat != rhs._compactVertexFormat) return false;
+    if (_zOrderTraversal != rhs._zOrderTraversal) return false;
     if (_skirtRatio != rhs._skirtRatio) return false;
+    if (_heightFieldTolerance != rhs._heightFieldTolerance) return false;
     if (_tileBasename != rhs._tileBasename) return false;
     if (_tileExtension != rhs._tileExtension) return false;
     if (_useLocalTileTransform != rhs._useLocalTileTransform) return false;
@@ -90,6 +90,85 @@ public:
 };
 
 
+template<typename C>
+class ExtentsListSerializer : public vpb::Serializer
+{
+public:
+
+     typedef BuildOptions::ExtentsList V;
+     typedef const V& P;
+     typedef P (C::*GetterFunctionType)() const;
+     typedef void (C::*SetterFunctionType)(P);
+
+     ExtentsListSerializer(const char* fieldName, P defaultValue, GetterFunctionType getter, SetterFunctionType setter):
+        _fieldName(fieldName),
+        _default(defaultValue),
+        _getter(getter),
+        _setter(setter) {}
+
+     bool write(osgDB::Output& fw, const osg::Object& obj)
+     {
+        const C& object = static_cast<const C&>(obj);
+        P value = (object.*_getter)();
+        if (!value.empty())
+        {
+            fw.indent()<<_fieldName<<" {"<<std::endl;
+            fw.moveIn();
+
+            for(V::const_iterator itr = value.begin();
+                itr != value.end();
+                ++itr)
+            {
+                fw.indent()<<itr->_min[0]<<" "<<itr->_min[1]<<" "<<itr->_max[0]<<" "<<itr->_max[1]<<" "<<itr->_isGeographic<<std::endl;
+            }
+            fw.moveOut();
+            fw.indent()<<"}"<<std::endl;
+        }
+
+        return true;
+     }
+
+    bool read(osgDB::Input& fr, osg::Object& obj, bool& itrAdvanced)
+    {
+        C& object = static_cast<C&>(obj);
+        if (fr[0].matchWord(_fieldName.c_str()) && fr[1].isOpenBracket())
+        {
+            V value;
+
+            int entry = fr[0].getNoNestedBrackets();
+
+            fr += 2;
+
+            while (!fr.eof() && fr[0].getNoNestedBrackets()>entry)
+            {
+                GeospatialExtents extents;
+                int isGeographic = 0;
+                if (fr.read(extents._min[0], extents._min[1], extents._max[0], extents._max[1], isGeographic))
+                {
+                    extents._isGeographic = isGeographic!=0;
+                    value.push_back(extents);
+                }
+                else
+                {
+                    ++fr;
+                }
+            }
+
+            ++fr;
+
+            (object.*_setter)(value);
+            itrAdvanced = true;
+        }
+
+        return true;
+     }
+
+     std::string        _fieldName;
+     V                  _default;
+     GetterFunctionType _getter;
+     SetterFunctionType _setter;
+};
+
 template<typename C, typename T, typename Itr>
 class SetSerializer : public vpb::Serializer
 {
@@ -296,6 +375,7 @@ public:
         VPB_ADD_FLOAT_PROPERTY(RadiusToMaxVisibleDistanceRatio);
         VPB_ADD_FLOAT_PROPERTY(VerticalScale);
         VPB_ADD_FLOAT_PROPERTY(SkirtRatio);
+        VPB_ADD_FLOAT_PROPERTY(HeightFieldTolerance);
         VPB_ADD_UINT_PROPERTY(ImageryQuantization);
         VPB_ADD_BOOL_PROPERTY(ImageryErrorDiffusion);
         VPB_ADD_FLOAT_PROPERTY(MaxAnisotropy);
@@ -306,6 +386,9 @@ public:
         VPB_ADD_BOOL_PROPERTY(ConvertFromGeographicToGeocentric);
         VPB_ADD_BOOL_PROPERTY(UseLocalTileTransform);
         VPB_ADD_BOOL_PROPERTY(SimplifyTerrain);
+        VPB_ADD_BOOL_PROPERTY(OptimizeVertexCache);
+        VPB_ADD_BOOL_PROPERTY(CompactVertexFormat);
+        VPB_ADD_BOOL_PROPERTY(ZOrderTraversal);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithCoordinateSystemNode);
         VPB_ADD_BOOL_PROPERTY(DecorateGeneratedSceneGraphWithMultiTextureControl);
         VPB_ADD_BOOL_PROPERTY(WriteNodeBeforeSimplification);
@@ -326,6 +409,12 @@ public:
                 &BuildOptions::getDestinationExtents,
                 &BuildOptions::setDestinationExtents));
 
+        _serializerList.push_back(new ExtentsListSerializer<BuildOptions>(
+                "PatchExtents",
+                prototype.getPatchExtents(),
+                &BuildOptions::getPatchExtents,
+                &BuildOptions::setPatchExtents));
+
         VPB_ADD_UINT_PROPERTY(MaximumNumOfLevels);
 
         VPB_ADD_UINT_PROPERTY(DistributedBuildSplitLevel);
@@ -339,6 +428,12 @@ public:
         { VPB_AEP(NotifyLevel); VPB_AEV(ALWAYS); VPB_AEV(FATAL); VPB_AEV(WARN); VPB_AEV(NOTICE); VPB_AEV(INFO); VPB_AEV(DEBUG_INFO); VPB_AEV(DEBUG_FP); }
 
         VPB_ADD_BOOL_PROPERTY(DisableWrites);
+        VPB_ADD_BOOL_PROPERTY(SkipUnchangedWrites);
+        VPB_ADD_UINT_PROPERTY(WriteBehindBufferSize);
+        VPB_ADD_UINT_PROPERTY(NumWriteBehindThreads);
+        VPB_ADD_BOOL_PROPERTY(SyncWrites);
+        VPB_ADD_STRING_PROPERTY(TraceFileName);
+        VPB_ADD_UINT_PROPERTY(MemoryBudget);
 
         VPB_ADD_FLOAT_PROPERTY(NumReadThreadsToCoresRatio);
         VPB_ADD_FLOAT_PROPERTY(NumWriteThreadsToCoresRatio);
@@ -595,6 +690,48 @@ static bool writeDestinationExtents( osgDB::OutputStream& os, const vpb::BuildOp
     return true;
 }
 
+static bool checkPatchExtents( const vpb::BuildOptions& bo )
+{ return !bo.getPatchExtents().empty(); }
+
+static bool readPatchExtents( osgDB::InputStream& is, vpb::BuildOptions& bo )
+{
+    vpb::BuildOptions::ExtentsList extentsList;
+    unsigned int size = 0; is >> size >> IS_BEGIN_BRACKET;
+    for ( unsigned int i=0; i<size; ++i )
+    {
+        double xMin, xMax, yMin, yMax;
+        bool isGeo;
+        is >> xMin;
+        is >> yMin;
+        is >> xMax;
+        is >> yMax;
+        is >> isGeo;
+        extentsList.push_back(GeospatialExtents(xMin, yMin, xMax, yMax, isGeo));
+    }
+    is >> IS_END_BRACKET;
+    bo.setPatchExtents(extentsList);
+    return true;
+}
+
+static bool writePatchExtents( osgDB::OutputStream& os, const vpb::BuildOptions& bo )
+{
+    const vpb::BuildOptions::ExtentsList& extentsList = bo.getPatchExtents();
+    os << (unsigned int)extentsList.size() << OS_BEGIN_BRACKET << std::endl;
+    for(vpb::BuildOptions::ExtentsList::const_iterator itr = extentsList.begin();
+        itr != extentsList.end();
+        ++itr)
+    {
+        os << itr->xMin();
+        os << itr->yMin();
+        os << itr->xMax();
+        os << itr->yMax();
+        os << itr->_isGeographic;
+        os << std::endl;
+    }
+    os << OS_END_BRACKET << std::endl;
+    return true;
+}
+
 
 REGISTER_OBJECT_WRAPPER( BuildOptions,
                          new vpb::BuildOptions,
@@ -731,9 +868,22 @@ REGISTER_OBJECT_WRAPPER( BuildOptions,
 
     ADD_USER_SERIALIZER( LayerImageOptions );
 
-
-
-
+    // The properties below were added after the original set.  They aren't marked with UPDATE_TO_VERSION as
+    // osgDB compares that against the OSG version a file was written with, not a version VPB controls.  Ascii and
+    // XML files match properties by name so earlier files leave them at their defaults, but the binary format is
+    // positional so .osgb BuildOptions and DatabaseBuilder files written before they were added can't be read,
+    // and have to be written out again.
+    ADD_BOOL_SERIALIZER( OptimizeVertexCache, false);
+    ADD_BOOL_SERIALIZER( CompactVertexFormat, false);
+    ADD_FLOAT_SERIALIZER( HeightFieldTolerance, 0.0f);
+    ADD_BOOL_SERIALIZER( ZOrderTraversal, false);
+    ADD_USER_SERIALIZER( PatchExtents );
+    ADD_BOOL_SERIALIZER( SkipUnchangedWrites, false);
+    ADD_UINT_SERIALIZER( WriteBehindBufferSize, 0);
+    ADD_UINT_SERIALIZER( NumWriteBehindThreads, 2);
+    ADD_BOOL_SERIALIZER( SyncWrites, false);
+    ADD_STRING_SERIALIZER( TraceFileName, "");
+    ADD_UINT_SERIALIZER( MemoryBudget, 0);
 }
 
 }
@@ -16,6 +16,7 @@
 #include <vpb/BuildOptions>
 #include <vpb/DatabaseBuilder>
 #include <vpb/System>
+#include <vpb/ThreadPool>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -81,17 +82,21 @@ void Commandline::computeGeoTransForRange(double xMin, double xMax, double yMin,
 }
 
 
-void Commandline::processFile(vpb::Source::Type type, const std::string& filename, LayerOperation layerOp)
+static void logLayerOperation(const std::string& filename, Commandline::LayerOperation layerOp)
 {
-    if (filename.empty()) return;
-
     switch(layerOp)
     {
-        case(ADD): log(osg::NOTICE,"ADD: %s",filename.c_str()); break;
-        case(REMOVE): log(osg::NOTICE,"REMOVE: %s",filename.c_str()); break;
-        case(MODIFIED): log(osg::NOTICE,"MODIFIED: %s",filename.c_str()); break;
+        case(Commandline::ADD): log(osg::NOTICE,"ADD: %s",filename.c_str()); break;
+        case(Commandline::REMOVE): log(osg::NOTICE,"REMOVE: %s",filename.c_str()); break;
+        case(Commandline::MODIFIED): log(osg::NOTICE,"MODIFIED: %s",filename.c_str()); break;
     }
+}
+
+void Commandline::processFile(vpb::Source::Type type, const std::string& filename, LayerOperation layerOp)
+{
+    if (filename.empty()) return;
 
+    logLayerOperation(filename, layerOp);
 
     if (osgDB::fileType(filename) == osgDB::REGULAR_FILE)
     {
@@ -101,13 +106,7 @@ void Commandline::processFile(vpb::Source::Type type, const std::string& filenam
             return;
         }
 
-        switch(type)
-        {
-            case(vpb::Source::IMAGE):           processImageOrHeightField(type, filename, layerOp); break;
-            case(vpb::Source::HEIGHT_FIELD):    processImageOrHeightField(type, filename, layerOp); break;
-            case(vpb::Source::MODEL):           processModel(filename, layerOp); break;
-            case(vpb::Source::SHAPEFILE):       processShapeFile(type, filename, layerOp); break;
-        }
+        processSupportedFile(type, filename, layerOp);
     }
     else
     {
@@ -115,6 +114,17 @@ void Commandline::processFile(vpb::Source::Type type, const std::string& filenam
     }
 }
 
+void Commandline::processSupportedFile(vpb::Source::Type type, const std::string& filename, LayerOperation layerOp)
+{
+    switch(type)
+    {
+        case(vpb::Source::IMAGE):           processImageOrHeightField(type, filename, layerOp); break;
+        case(vpb::Source::HEIGHT_FIELD):    processImageOrHeightField(type, filename, layerOp); break;
+        case(vpb::Source::MODEL):           processModel(filename, layerOp); break;
+        case(vpb::Source::SHAPEFILE):       processShapeFile(type, filename, layerOp); break;
+    }
+}
+
 void Commandline::processImageOrHeightField(vpb::Source::Type type, const std::string& filename, LayerOperation layerOp)
 {
     osgTerrain::Layer* existingLayer = 0;
@@ -465,20 +475,225 @@ void Commandline::processModel(const std::string& filename, LayerOperation layer
     }
 }
 
+struct DirectoryEntry
+{
+    DirectoryEntry(const std::string& in_filename=std::string(), bool in_isFile=false):
+        filename(in_filename),
+        isFile(in_isFile) {}
+
+    std::string filename;
+    bool        isFile;
+};
+typedef std::vector<DirectoryEntry> DirectoryEntries;
+typedef std::map<std::string, DirectoryEntries> DirectoryMap;
+
+static void listDirectory(const std::string& directory, DirectoryEntries& entries)
+{
+    osgDB::DirectoryContents dirContents = osgDB::getDirectoryContents(directory);
+    for(osgDB::DirectoryContents::iterator itr = dirContents.begin();
+        itr != dirContents.end();
+        ++itr)
+    {
+        if ((*itr != ".") && (*itr != ".."))
+        {
+            std::string fullfilename = directory + '/' + *itr;
+            entries.push_back(DirectoryEntry(fullfilename, osgDB::fileType(fullfilename) == osgDB::REGULAR_FILE));
+        }
+    }
+}
+
+class ListDirectoryOperation : public BuildOperation
+{
+    public:
+
+        ListDirectoryOperation(ThreadPool* threadPool, const std::string& directory, DirectoryEntries& entries):
+            BuildOperation(threadPool, 0, std::string("ListDirectoryOperation ")+directory, false),
+            _directory(directory),
+            _entries(entries) {}
+
+        virtual void build()
+        {
+            listDirectory(_directory, _entries);
+        }
+
+        std::string         _directory;
+        DirectoryEntries&   _entries;
+};
+
+static void appendFiles(const std::string& directory, DirectoryMap& directoryMap, std::vector<std::string>& files)
+{
+    DirectoryEntries& entries = directoryMap[directory];
+    for(DirectoryEntries::iterator itr = entries.begin();
+        itr != entries.end();
+        ++itr)
+    {
+        if (itr->isFile) files.push_back(itr->filename);
+        else appendFiles(itr->filename, directoryMap, files);
+    }
+}
+
+void Commandline::scanDirectory(const std::string& directory, FileNames& files)
+{
+    unsigned int numThreads = System::instance()->getNumSourceProbeThreads();
+
+    osg::ref_ptr<ThreadPool> threadPool;
+    if (numThreads>1)
+    {
+        threadPool = new ThreadPool(numThreads, false);
+        threadPool->startThreads();
+    }
+
+    // list a whole depth of the directory tree at a time, each directory into its own entry of the map.
+    DirectoryMap directoryMap;
+    FileNames directories(1, directory);
+    while(!directories.empty())
+    {
+        for(FileNames::iterator itr = directories.begin(); itr != directories.end(); ++itr)
+        {
+            directoryMap[*itr];
+        }
+
+        for(FileNames::iterator itr = directories.begin(); itr != directories.end(); ++itr)
+        {
+            if (threadPool.valid()) threadPool->run(new ListDirectoryOperation(threadPool.get(), *itr, directoryMap[*itr]));
+            else listDirectory(*itr, directoryMap[*itr]);
+        }
+
+        if (threadPool.valid()) threadPool->waitForCompletion();
+
+        FileNames subDirectories;
+        for(FileNames::iterator itr = directories.begin(); itr != directories.end(); ++itr)
+        {
+            DirectoryEntries& entries = directoryMap[*itr];
+            for(DirectoryEntries::iterator eitr = entries.begin(); eitr != entries.end(); ++eitr)
+            {
+                if (!eitr->isFile && directoryMap.count(eitr->filename)==0) subDirectories.push_back(eitr->filename);
+            }
+        }
+        directories.swap(subDirectories);
+    }
+
+    // flatten in the same order as a serial depth first traversal.
+    appendFiles(directory, directoryMap, files);
+}
+
+void Commandline::checkFileTypesSupported(vpb::Source::Type type, const FileNames& files, LayerOperation layerOp, std::vector<bool>& supported)
+{
+    System* system = System::instance().get();
+
+    supported.assign(files.size(), false);
+
+    bool probeMetadata = (type==vpb::Source::IMAGE || type==vpb::Source::HEIGHT_FIELD) && layerOp!=REMOVE;
+    if (!probeMetadata)
+    {
+        for(unsigned int i=0; i<files.size(); ++i)
+        {
+            supported[i] = system->isFileTypeSupported(files[i], type);
+        }
+        return;
+    }
+
+    // without a persistent cache use one for just this build, so loadSources can still reuse the probe results.
+    if (!system->getSourceMetadataCache()) system->setSourceMetadataCache(new SourceMetadataCache);
+    SourceMetadataCache* metadataCache = system->getSourceMetadataCache();
+
+    // sources are loaded as RASTER unless configured otherwise, so probe as RASTER to match loadSources.
+    SpatialProperties::DataType probeDataType = SpatialProperties::RASTER;
+
+    // first pass probes all files with supported extensions along with the first file of each unknown
+    // extension, which as in System::isFileTypeSupported decides whether that extension is supported.
+    SourceMetadataCache::FileNameDataTypeList filesToProbe;
+    std::map<std::string, unsigned int> unknownExtensions;
+    std::vector<unsigned int> deferred;
+    for(unsigned int i=0; i<files.size(); ++i)
+    {
+        std::string ext = osgDB::getFileExtension(files[i]);
+        bool probe = false;
+        if (system->isExtensionSupported(ext, type))
+        {
+            supported[i] = true;
+            probe = true;
+        }
+        else if (system->getUnsupportedExtensions().count(ext)==0)
+        {
+            if (unknownExtensions.count(ext)==0)
+            {
+                unknownExtensions[ext] = i;
+                probe = true;
+            }
+            else
+            {
+                deferred.push_back(i);
+            }
+        }
+
+        SourceMetadataCache::Entry entry;
+        if (probe && !metadataCache->getEntry(files[i], probeDataType, entry))
+        {
+            filesToProbe.push_back(SourceMetadataCache::FileNameDataTypePair(files[i], probeDataType));
+        }
+    }
+
+    metadataCache->probe(filesToProbe, system->getNumSourceProbeThreads());
+
+    for(std::map<std::string, unsigned int>::iterator itr = unknownExtensions.begin();
+        itr != unknownExtensions.end();
+        ++itr)
+    {
+        unsigned int i = itr->second;
+        SourceMetadataCache::Entry entry;
+        if (metadataCache->getEntry(files[i], probeDataType, entry))
+        {
+            system->addSupportedExtension(itr->first, vpb::Source::IMAGE | vpb::Source::HEIGHT_FIELD, "");
+            supported[i] = true;
+        }
+        else
+        {
+            // probing reads more than just opening the file, so let System make the final decision.
+            supported[i] = system->isFileTypeSupported(files[i], type);
+        }
+    }
+
+    // second pass probes the rest of the files with extensions the first pass found to be supported.
+    filesToProbe.clear();
+    for(std::vector<unsigned int>::iterator itr = deferred.begin(); itr != deferred.end(); ++itr)
+    {
+        unsigned int i = *itr;
+        if (!system->isExtensionSupported(osgDB::getFileExtension(files[i]), type)) continue;
+
+        supported[i] = true;
+
+        SourceMetadataCache::Entry entry;
+        if (!metadataCache->getEntry(files[i], probeDataType, entry))
+        {
+            filesToProbe.push_back(SourceMetadataCache::FileNameDataTypePair(files[i], probeDataType));
+        }
+    }
+
+    metadataCache->probe(filesToProbe, system->getNumSourceProbeThreads());
+
+    metadataCache->sync();
+}
+
 void Commandline::processDirectory(vpb::Source::Type type, const std::string& filename, LayerOperation layerOp)
 {
-    osgDB::DirectoryContents dirContents= osgDB::getDirectoryContents(filename);
+    FileNames files;
+    scanDirectory(filename, files);
 
-    // loop through directory contents and call processFile
-    std::vector<std::string>::iterator i;
-    std::string fullfilename;
-    for(i = dirContents.begin(); i != dirContents.end(); ++i)
+    std::vector<bool> supported;
+    checkFileTypesSupported(type, files, layerOp, supported);
+
+    for(unsigned int i=0; i<files.size(); ++i)
     {
-        if((*i != ".") && (*i != ".."))
+        logLayerOperation(files[i], layerOp);
+
+        if (!supported[i])
         {
-            fullfilename = filename + '/' + *i;
-            processFile(type, fullfilename, layerOp);
+            log(osg::INFO,"Ignoring %s as it's file extension is not supported", files[i].c_str());
+            continue;
         }
+
+        processSupportedFile(type, files[i], layerOp);
     }
 }
 
@@ -494,7 +709,7 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("-t <filename>","Specify the texture map input file to process.");
     usage.addCommandLineOption("--building <filename>","Specify building outlines using shapefiles.");
     usage.addCommandLineOption("--forest <filename>","Specify forest outlines using shapefiles.");
-    usage.addCommandLineOption("-a <archivename>","Specify the archive to place the generated database.");
+    usage.addCommandLineOption("-a <archivename>","Specify the archive to place the generated database, only .vpbc tile containers are currently supported.");
     usage.addCommandLineOption("--ibn <buildname>","Specify the intermediate build file name.");
     usage.addCommandLineOption("-o <outputfile>","Specify the output master file to generate.");
     usage.addCommandLineOption("-l <numOfLevels>","Specify the number of PagedLOD levels to generate.");
@@ -509,6 +724,7 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--wkt <WKT string>","Set the coordinates system of source imagery, DEM or destination database in WellKnownText form.");
     usage.addCommandLineOption("--wkt-file <WKT file>","Set the coordinates system of source imagery, DEM or destination database by as file containing WellKownText definition.");
     usage.addCommandLineOption("--skirt-ratio <float>","Set the ratio of skirt height to tile size.");
+    usage.addCommandLineOption("--heightfield-tolerance <float>","Reduce each tile's height field to the smallest 2^n+1 grid within this vertical error.");
     usage.addCommandLineOption("--HEIGHT_FIELD","Create a height field database.");
     usage.addCommandLineOption("--POLYGONAL","Create a height field database.");
     usage.addCommandLineOption("--TERRAIN","Create a osgTerrain::Terrain database.");
@@ -534,6 +750,10 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--raster","Interpret input as a raster data set (default).");
     usage.addCommandLineOption("--max-visible-distance-of-top-level","Set the maximum visible distance that the top most tile can be viewed at.");
     usage.addCommandLineOption("--no-terrain-simplification","Switch off terrain simplification.");
+    usage.addCommandLineOption("--vertex-cache-optimization","Reorder generated geometry for the vertex cache, changes the index and vertex order of the tiles written.");
+    usage.addCommandLineOption("--no-vertex-cache-optimization","Switch off reordering of generated geometry for the vertex cache (default).");
+    usage.addCommandLineOption("--compact-vertex-format","Store polygonal tiles with quantized 16 bit positions and 8 bit normals.");
+    usage.addCommandLineOption("--z-order-traversal","Build the tiles of each level in Z-order blocks rather than row by row.");
     usage.addCommandLineOption("--default-color <r,g,b,a>","Sets the default color of the terrain.");
     usage.addCommandLineOption("--radius-to-max-visible-distance-ratio","Set the maximum visible distance ratio for all tiles apart from the top most tile. The maximum visuble distance is computed from the ratio * tile radius.");
     usage.addCommandLineOption("--no-mip-mapping","Disable mip mapping of textures.");
@@ -569,6 +789,12 @@ void Commandline::getUsage(osg::ApplicationUsage& usage)
     usage.addCommandLineOption("--splits","Set the distributed build primary and secondary split levels.");
     usage.addCommandLineOption("--run-path","Set the path that the build should be run from.");
     usage.addCommandLineOption("--notify-level","Set the notify level when logging messages.");
+    usage.addCommandLineOption("--skip-unchanged-writes","Leave existing output files untouched when their contents would not change.");
+    usage.addCommandLineOption("--write-behind <MB>","Queue up to <MB> megabytes of serialized output files for writing by dedicated I/O threads.");
+    usage.addCommandLineOption("--write-behind-threads <num>","Set the number of I/O threads used for write-behind, defaults to 2.");
+    usage.addCommandLineOption("--sync-writes","Sync write-behind files to disk before renaming them into place.");
+    usage.addCommandLineOption("--trace <filename>","Write a Chrome trace JSON file of the time spent in each stage of the build, for viewing in chrome://tracing or Perfetto.");
+    usage.addCommandLineOption("--memory-budget <MB>","Hold back reading new tiles while the tile images, height fields and buffers of the build use more than <MB> megabytes.");
     usage.addCommandLineOption("--type-attribute","Set the type name which specify how the shapes should be interpreted in shapefile/dbase files.");
     usage.addCommandLineOption("--height-attribute","Set the attribute name for height attributes used in shapefile/dbase files.");
     usage.addCommandLineOption("--height","Set the height to use for asscociated shapefiles.");
@@ -839,6 +1065,40 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setDisableWrites(true);
     }
 
+    while(arguments.read("--skip-unchanged-writes"))
+    {
+        buildOptions->setSkipUnchangedWrites(true);
+    }
+
+    unsigned int writeBehindBufferSize;
+    while(arguments.read("--write-behind", writeBehindBufferSize) || arguments.read("--write_behind", writeBehindBufferSize))
+    {
+        buildOptions->setWriteBehindBufferSize(writeBehindBufferSize);
+    }
+
+    unsigned int numWriteBehindThreads;
+    while(arguments.read("--write-behind-threads", numWriteBehindThreads) || arguments.read("--write_behind_threads", numWriteBehindThreads))
+    {
+        buildOptions->setNumWriteBehindThreads(numWriteBehindThreads);
+    }
+
+    while(arguments.read("--sync-writes") || arguments.read("--sync_writes"))
+    {
+        buildOptions->setSyncWrites(true);
+    }
+
+    std::string traceFileName;
+    while(arguments.read("--trace", traceFileName))
+    {
+        buildOptions->setTraceFileName(traceFileName);
+    }
+
+    unsigned int memoryBudget;
+    while(arguments.read("--memory-budget", memoryBudget) || arguments.read("--memory_budget", memoryBudget))
+    {
+        buildOptions->setMemoryBudget(memoryBudget);
+    }
+
     while(arguments.read("--interpolate-terrain"))
     {
         buildOptions->setUseInterpolatedTerrainSampling(true);
@@ -898,9 +1158,16 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
     std::string archiveName;
     while (arguments.read("-a",archiveName))
     {
-        osg::notify(osg::NOTICE)<<"Warning: archive option -a is temporarily disabled, building with archive."<<std::endl;
-        
-        // buildOptions->setArchiveName(archiveName);
+        if (osgDB::getLowerCaseFileExtension(archiveName)=="vpbc")
+        {
+            buildOptions->setArchiveName(archiveName);
+        }
+        else
+        {
+            osg::notify(osg::NOTICE)<<"Warning: archive option -a is temporarily disabled for archives other than .vpbc tile containers, building without archive."<<std::endl;
+
+            // buildOptions->setArchiveName(archiveName);
+        }
     }
 
     unsigned int numLevels = 10;
@@ -926,6 +1193,13 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setSkirtRatio(skirtRatio);
     }
 
+    float heightFieldTolerance;
+    while (arguments.read("--heightfield_tolerance",heightFieldTolerance) ||
+           arguments.read("--heightfield-tolerance",heightFieldTolerance))
+    {
+        buildOptions->setHeightFieldTolerance(heightFieldTolerance);
+    }
+
     float maxVisibleDistanceOfTopLevel;
     while (arguments.read("--max_visible_distance_of_top_level",maxVisibleDistanceOfTopLevel) ||
           arguments.read("--max-visible-distance-of-top-level",maxVisibleDistanceOfTopLevel) )
@@ -946,6 +1220,30 @@ int Commandline::read(std::ostream& fout, osg::ArgumentParser& arguments, osgTer
         buildOptions->setSimplifyTerrain(false);
     }
 
+    while (arguments.read("--vertex_cache_optimization") ||
+           arguments.read("--vertex-cache-optimization"))
+    {
+        buildOptions->setOptimizeVertexCache(true);
+    }
+
+    while (arguments.read("--no_vertex_cache_optimization") ||
+           arguments.read("--no-vertex-cache-optimization"))
+    {
+        buildOptions->setOptimizeVertexCache(false);
+    }
+
+    while (arguments.read("--compact_vertex_format") ||
+           arguments.read("--compact-vertex-format"))
+    {
+        buildOptions->setCompactVertexFormat(true);
+    }
+
+    while (arguments.read("--z_order_traversal") ||
+           arguments.read("--z-order-traversal"))
+    {
+        buildOptions->setZOrderTraversal(true);
+    }
+
     while (arguments.read("--write_node_before_simplification") ||
            arguments.read("--write_node_before_simplification"))
     {
@@ -34,6 +34,10 @@
 #include <vpb/System>
 #include <vpb/FileUtils>
 #include <vpb/FilePathManager>
+#include <vpb/MappedFile>
+#include <vpb/TileContainer>
+#include <vpb/Trace>
+#include <vpb/MemoryTracker>
 
 #include <vpb/ShapeFilePlacer>
 
@@ -45,6 +49,7 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <string.h>
 
 
 using namespace vpb;
@@ -98,6 +103,37 @@ void DataSet::loadSources()
 
     FileCache* fileCache = System::instance()->getFileCache();
 
+    SourceMetadataCache* metadataCache = System::instance()->getSourceMetadataCache();
+    if (metadataCache)
+    {
+        // probe the sources that neither cache knows about in parallel, so the serial loop below
+        // only has to open the files that couldn't be probed.
+        SourceMetadataCache::FileNameDataTypeList filesToProbe;
+        std::set<std::string> filesAdded;
+        for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+        {
+            Source* source = itr->get();
+            if (!source || source->getSourceData() || !source->isMetadataCacheable()) continue;
+
+            if (filesAdded.count(source->getFileName())!=0) continue;
+
+            SpatialProperties sp;
+            if (fileCache && fileCache->getSpatialProperties(source->getFileName(), sp)) continue;
+
+            SourceMetadataCache::Entry entry;
+            if (metadataCache->getEntry(source->getFileName(), source->_dataType, entry)) continue;
+
+            filesToProbe.push_back(SourceMetadataCache::FileNameDataTypePair(source->getFileName(), source->_dataType));
+            filesAdded.insert(source->getFileName());
+        }
+
+        if (!filesToProbe.empty())
+        {
+            metadataCache->probe(filesToProbe, System::instance()->getNumSourceProbeThreads());
+            metadataCache->sync();
+        }
+    }
+
     for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
     {
         Source* source = itr->get();
@@ -1055,8 +1091,8 @@ bool DataSet::prepareForDestinationGraphCreation()
     log(osg::NOTICE, "local_extents = xMin() %f %f",_extents.xMin(),_extents.xMax());
     log(osg::NOTICE, "                yMin() %f %f",_extents.yMin(),_extents.yMax());
 
-    // compute the number of texture layers required.
-    unsigned int maxTextureUnit = 0;
+    // compute the number of texture layers required, at least one per color layer added.
+    unsigned int maxTextureUnit = _numTextureLevels-1;
     for(CompositeSource::source_iterator sitr(_sourceGraph.get());sitr.valid();++sitr)
     {
         Source* source = sitr->get();
@@ -1354,6 +1390,7 @@ void DataSet::populateDestinationGraphFromSources()
         // for each DestinationTile equalize the boundaries so they all fit each other without gaps.
         _destinationGraph->equalizeBoundaries();
 
+        logTerrainResolutions();
 
     }
     else
@@ -1385,19 +1422,111 @@ class ReadFromOperation : public BuildOperation
         osg::ref_ptr<CompositeSource> _sourceGraph;
 };
 
+void DataSet::computePatchExtents()
+{
+    ExtentsList patchExtents;
+
+    unsigned int numSources = 0;
+    for(CompositeSource::source_iterator itr(_sourceGraph.get());itr.valid();++itr)
+    {
+        Source* source = itr->get();
+        ++numSources;
+
+        if (source->getPatchStatus()==Source::UNCHANGED) continue;
+
+        // only patched builds assign a status, so an unassigned one means this is a full build.
+        SourceData* sd = source->getSourceData();
+        if (source->getPatchStatus()==Source::UNASSIGNED || !sd)
+        {
+            setPatchExtents(ExtentsList());
+            return;
+        }
+
+        patchExtents.push_back(sd->getExtents(_intermediateCoordinateSystem.get()));
+    }
+
+    log(osg::NOTICE,"Patch alters %d of %d sources",patchExtents.size(),numSources);
+
+    setPatchExtents(patchExtents);
+}
+
+bool DataSet::requiresRegeneration(const CompositeDestination* cd) const
+{
+    const ExtentsList& patchExtents = getPatchExtents();
+    if (patchExtents.empty()) return true;
+
+    // siblings are written to the same file so are regenerated together, each one needs the tiles around it
+    // to be equalized against so extend the parent's extents by a tile on every side.
+    const CompositeDestination* group = cd->_parent ? cd->_parent : cd;
+    double dx = cd->_extents.xMax()-cd->_extents.xMin();
+    double dy = cd->_extents.yMax()-cd->_extents.yMin();
+    GeospatialExtents extents(group->_extents.xMin()-dx, group->_extents.yMin()-dy,
+                              group->_extents.xMax()+dx, group->_extents.yMax()+dy,
+                              group->_extents._isGeographic);
+
+    for(ExtentsList::const_iterator itr = patchExtents.begin();
+        itr != patchExtents.end();
+        ++itr)
+    {
+        if (extents.intersects(*itr)) return true;
+    }
+    return false;
+}
+
+bool DataSet::requiresReading(const CompositeDestination* cd)
+{
+    if (requiresRegeneration(cd)) return true;
+
+    for(int dy=-1; dy<=1; ++dy)
+    {
+        for(int dx=-1; dx<=1; ++dx)
+        {
+            if ((dx<0 && cd->_tileX==0) || (dy<0 && cd->_tileY==0)) continue;
+
+            CompositeDestination* neighbour = getComposite(cd->_level, cd->_tileX+dx, cd->_tileY+dy);
+            if (neighbour && neighbour!=cd && requiresRegeneration(neighbour)) return true;
+        }
+    }
+    return false;
+}
+
+void DataSet::getRegeneratedCompositeDestinations(Row& row, CompositeDestinationList& tiles) const
+{
+    tiles.clear();
+    tiles.reserve(row.size());
+    for(Row::iterator citr=row.begin();
+        citr!=row.end();
+        ++citr)
+    {
+        if (requiresRegeneration(citr->second)) tiles.push_back(citr->second);
+    }
+}
+
 void DataSet::_readRow(Row& row)
 {
     log(osg::NOTICE, "_readRow %u",row.size());
 
+    CompositeDestinationList tiles;
+    for(Row::iterator citr=row.begin();
+        citr!=row.end();
+        ++citr)
+    {
+        if (requiresReading(citr->second)) tiles.push_back(citr->second);
+    }
+    _readTiles(tiles);
+}
+
+void DataSet::_readTiles(const CompositeDestinationList& tiles)
+{
     CompositeSource* sourceGraph = _newDestinationGraph ? 0 : _sourceGraph.get();
 
     if (_readThreadPool.valid())
     {
-        for(Row::iterator citr=row.begin();
-            citr!=row.end();
+        for(CompositeDestinationList::const_iterator citr=tiles.begin();
+            citr!=tiles.end();
             ++citr)
         {
-            CompositeDestination* cd = citr->second;
+            CompositeDestination* cd = *citr;
             for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
                 titr!=cd->_tiles.end();
                 ++titr)
@@ -1412,11 +1541,11 @@ void DataSet::_readRow(Row& row)
     }
     else
     {
-        for(Row::iterator citr=row.begin();
-            citr!=row.end();
+        for(CompositeDestinationList::const_iterator citr=tiles.begin();
+            citr!=tiles.end();
             ++citr)
         {
-            CompositeDestination* cd = citr->second;
+            CompositeDestination* cd = *citr;
             for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
                 titr!=cd->_tiles.end();
                 ++titr)
@@ -1432,11 +1561,19 @@ void DataSet::_readRow(Row& row)
 void DataSet::_equalizeRow(Row& row)
 {
     log(osg::NOTICE, "_equalizeRow %d",row.size());
-    for(Row::iterator citr=row.begin();
-        citr!=row.end();
+
+    CompositeDestinationList tiles;
+    getRegeneratedCompositeDestinations(row, tiles);
+    _equalizeTiles(tiles);
+}
+
+void DataSet::_equalizeTiles(const CompositeDestinationList& tiles)
+{
+    for(CompositeDestinationList::const_iterator citr=tiles.begin();
+        citr!=tiles.end();
         ++citr)
     {
-        CompositeDestination* cd = citr->second;
+        CompositeDestination* cd = *citr;
         for(CompositeDestination::TileList::iterator titr=cd->_tiles.begin();
             titr!=cd->_tiles.end();
             ++titr)
@@ -1449,17 +1586,236 @@ void DataSet::_equalizeRow(Row& row)
     }
 }
 
-void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
+void DataSet::recordTerrainResolution(unsigned int level, unsigned int numColumns, unsigned int numRows)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_terrainResolutionMutex);
+    ++(_terrainResolutions[level][Resolution(numColumns,numRows)]);
+}
+
+void DataSet::logTerrainResolutions()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_terrainResolutionMutex);
+    for(LevelResolutionCountMap::iterator litr = _terrainResolutions.begin();
+        litr != _terrainResolutions.end();
+        ++litr)
+    {
+        log(osg::NOTICE, "Height field resolutions of level %u:",litr->first);
+        for(ResolutionCountMap::iterator ritr = litr->second.begin();
+            ritr != litr->second.end();
+            ++ritr)
+        {
+            log(osg::NOTICE, "    %u x %u\t%u tiles",ritr->first.first,ritr->first.second,ritr->second);
+        }
+    }
+    _terrainResolutions.clear();
+}
+
+void DataSet::_buildLevelInZOrder(unsigned int levelNum, Level& level, bool writeToDisk)
+{
+    typedef std::pair<uint64_t, CompositeDestination*> MortonCodeTilePair;
+    typedef std::vector<MortonCodeTilePair> MortonCodeTileList;
+
+    MortonCodeTileList sortedTiles;
+    for(Level::iterator litr = level.begin();
+        litr != level.end();
+        ++litr)
+    {
+        for(Row::iterator ritr = litr->second.begin();
+            ritr != litr->second.end();
+            ++ritr)
+        {
+            CompositeDestination* cd = ritr->second;
+            if (requiresRegeneration(cd)) sortedTiles.push_back(MortonCodeTilePair(TileIndex::computeMortonCode(cd->_tileX,cd->_tileY), cd));
+        }
+    }
+    std::sort(sortedTiles.begin(), sortedTiles.end());
+
+    // blocks of 4x4 tiles are consecutive in Z-order, and give the read threads enough tiles to work on.
+    const unsigned int blockSize = 16;
+
+    log(osg::NOTICE, "_buildLevelInZOrder %u, %u tiles",levelNum,sortedTiles.size());
+
+    std::set<CompositeDestination*> readTiles;
+    CompositeDestinationList toRead;
+    CompositeDestinationList block;
+    for(unsigned int i=0; i<sortedTiles.size(); i+=blockSize)
+    {
+        block.clear();
+        toRead.clear();
+
+        for(unsigned int j=i; j<sortedTiles.size() && j<i+blockSize; ++j)
+        {
+            CompositeDestination* cd = sortedTiles[j].second;
+            block.push_back(cd);
+
+            // a tile can only be equalized once it and all of its neighbours have been read.
+            for(int dy=-1; dy<=1; ++dy)
+            {
+                for(int dx=-1; dx<=1; ++dx)
+                {
+                    if ((dx<0 && cd->_tileX==0) || (dy<0 && cd->_tileY==0)) continue;
+
+                    CompositeDestination* neighbour = getComposite(levelNum, cd->_tileX+dx, cd->_tileY+dy);
+                    if (neighbour && readTiles.insert(neighbour).second) toRead.push_back(neighbour);
+                }
+            }
+        }
+
+        _readTiles(toRead);
+
+        _equalizeTiles(block);
+        if (writeToDisk) _writeTiles(block);
+    }
+}
+
+/** Return true if the file already exists with exactly the serialized contents in buffer.*/
+static bool fileContentsMatch(const std::string& filename, const std::string& buffer)
+{
+    if (!osgDB::fileExists(filename)) return false;
+
+    osg::ref_ptr<MappedFile> file = new MappedFile;
+    if (!file->open(filename)) return false;
+    if (file->size()!=buffer.size()) return false;
+
+    return memcmp(file->data(), buffer.data(), buffer.size())==0;
+}
+
+/** Return a copy of options with the settings the plugins' filename writers add before writing to a stream, the
+  * directory of filename on the database path and for the osg2 formats the fileType, which writing straight to a
+  * stream would otherwise leave to default to binary.*/
+static osg::ref_ptr<osgDB::Options> prepareStreamWriteOptions(const std::string& filename, const osgDB::Options* options)
+{
+    osg::ref_ptr<osgDB::Options> local_opt = options ?
+        static_cast<osgDB::Options*>(options->clone(osg::CopyOp::SHALLOW_COPY)) : new osgDB::Options;
+    local_opt->getDatabasePathList().push_front(osgDB::getFilePath(filename));
+
+    std::string ext = osgDB::getLowerCaseFileExtension(filename);
+    if (ext=="osgt") local_opt->setPluginStringData("fileType", "Ascii");
+    else if (ext=="osgx") local_opt->setPluginStringData("fileType", "XML");
+    else if (ext=="osgb") local_opt->setPluginStringData("fileType", "Binary");
+
+    return local_opt;
+}
+
+/** Return true if the plugin for filename's extension uses the file name itself while writing, so that writing to a
+  * stream wouldn't produce the same file, as the .osg plugin does to place external files relative to it.*/
+static bool writerNeedsFileName(const std::string& filename)
+{
+    return osgDB::getLowerCaseFileExtension(filename)=="osg";
+}
+
+/** Serialize node to buffer with the plugin for filename's extension, returns false if the plugin can't write to a stream
+  * or needs the file name to write.*/
+static bool serializeNode(const osg::Node& node, const std::string& filename, const osgDB::Options* options, std::string& buffer)
+{
+    if (writerNeedsFileName(filename)) return false;
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+    if (!rw) return false;
+
+    osg::ref_ptr<osgDB::Options> local_opt = prepareStreamWriteOptions(filename, options);
+
+    std::ostringstream os(std::ios::out | std::ios::binary);
+    if (!rw->writeNode(node, os, local_opt.get()).success()) return false;
+
+    buffer = os.str();
+    return true;
+}
+
+/** Serialize image to buffer with the plugin for filename's extension, returns false if the plugin can't write to a stream
+  * or needs the file name to write.*/
+static bool serializeImage(const osg::Image& image, const std::string& filename, const osgDB::Options* options, std::string& buffer)
+{
+    if (writerNeedsFileName(filename)) return false;
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+    if (!rw) return false;
+
+    osg::ref_ptr<osgDB::Options> local_opt = prepareStreamWriteOptions(filename, options);
+
+    std::ostringstream os(std::ios::out | std::ios::binary);
+    if (!rw->writeImage(image, os, local_opt.get()).success()) return false;
+
+    buffer = os.str();
+    return true;
+}
+
+void DataSet::recordFileWritten(const std::string& filename, bool fileExistedBeforeWrite)
+{
+    if (!_databaseRevision.valid()) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_databaseRevisionMutex);
+    if (fileExistedBeforeWrite)
+    {
+        if (_databaseRevision->getFilesModified()) _databaseRevision->getFilesModified()->addFile(filename);
+    }
+    else
+    {
+        if (_databaseRevision->getFilesAdded()) _databaseRevision->getFilesAdded()->addFile(filename);
+    }
+}
+
+/** Records the files flushed by the write-behind queue in the DataSet's DatabaseRevision.*/
+class WriteQueueCallback : public WriteQueue::Callback
+{
+    public:
+
+        WriteQueueCallback(DataSet* dataSet):
+            _dataSet(dataSet) {}
+
+        virtual void written(const std::string& filename, bool fileExistedBeforeWrite)
+        {
+            _dataSet->recordFileWritten(filename, fileExistedBeforeWrite);
+        }
+
+        virtual void failed(const std::string& filename, const std::string& message)
+        {
+            osg::NotifySeverity notifylevel = _dataSet->getAbortTaskOnError() ? osg::FATAL : osg::WARN;
+            _dataSet->log(notifylevel, "Error, in writing file %s, %s",filename.c_str(), message.c_str());
+        }
+
+    protected:
+
+        DataSet* _dataSet;
+};
+
+void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename, unsigned int archiveTicket)
 {
     if (getDisableWrites()) return;
 
-    if (_archive.valid()) _archive->writeNode(node,filename);
+    ScopedSpan span("writeNode", filename);
+
+    if (_archiveWriter.valid()) _archiveWriter->writeNode(archiveTicket,node,filename);
+    else if (_archive.valid()) _archive->writeNode(node,filename);
     else
     {
         osg::NotifySeverity notifylevel = getAbortTaskOnError() ? osg::FATAL : osg::WARN;
 
-        if (vpb::hasWritePermission(filename))
+        if (FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(filename))
         {
+            std::string buffer;
+            if ((getSkipUnchangedWrites() || _writeQueue.valid()) &&
+                serializeNode(node, filename, osgDB::Registry::instance()->getOptions(), buffer))
+            {
+                if (getSkipUnchangedWrites() && fileContentsMatch(filename, buffer))
+                {
+                    log(osg::INFO, "Skipping write of unchanged node file %s",filename.c_str());
+                    return;
+                }
+
+                if (_writeQueue.valid())
+                {
+                    _writeQueue->write(filename, buffer);
+                    return;
+                }
+
+                // write out the contents already serialized rather than serializing the node a second time.
+                bool fileExistedBeforeWrite = osgDB::fileExists(filename);
+                if (writeFileAtomically(filename, buffer)) recordFileWritten(filename, fileExistedBeforeWrite);
+                else log(notifylevel, "Error, in writing node file %s",filename.c_str());
+                return;
+            }
+
             bool fileExistedBeforeWrite = osgDB::fileExists(filename);
 
             osgDB::ReaderWriter::WriteResult result =
@@ -1468,17 +1824,7 @@ void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
 
             if (result.success())
             {
-                if (_databaseRevision.valid())
-                {
-                    if (fileExistedBeforeWrite)
-                    {
-                        if (_databaseRevision->getFilesModified()) _databaseRevision->getFilesModified()->addFile(filename);
-                    }
-                    else
-                    {
-                        if (_databaseRevision->getFilesAdded()) _databaseRevision->getFilesAdded()->addFile(filename);
-                    }
-                }
+                recordFileWritten(filename, fileExistedBeforeWrite);
             }
             else
             {
@@ -1508,7 +1854,7 @@ void DataSet::_writeNodeFile(osg::Node& node,const std::string& filename)
     }
 }
 
-void DataSet::_writeImageFile(osg::Image& image,const std::string& filename)
+void DataSet::_writeImageFile(osg::Image& image,const std::string& filename, unsigned int archiveTicket)
 {
     if (getDisableWrites()) return;
 
@@ -1517,7 +1863,10 @@ void DataSet::_writeImageFile(osg::Image& image,const std::string& filename)
     // remove any ../ from the filename
     std::string simpliedFileName = vpb::simplifyFileName(filename);
 
-    if (_archive.valid()) _archive->writeImage(image,simpliedFileName);
+    ScopedSpan span("writeImage", simpliedFileName);
+
+    if (_archiveWriter.valid()) _archiveWriter->writeImage(archiveTicket,image,simpliedFileName);
+    else if (_archive.valid()) _archive->writeImage(image,simpliedFileName);
     else
     {
         osg::NotifySeverity notifylevel = getAbortTaskOnError() ? osg::FATAL : osg::WARN;
@@ -1538,22 +1887,34 @@ void DataSet::_writeImageFile(osg::Image& image,const std::string& filename)
                 }
             }
 
+            std::string buffer;
+            if ((getSkipUnchangedWrites() || _writeQueue.valid()) &&
+                serializeImage(image, simpliedFileName, options.get(), buffer))
+            {
+                if (getSkipUnchangedWrites() && fileContentsMatch(simpliedFileName, buffer))
+                {
+                    log(osg::INFO, "Skipping write of unchanged image file %s",simpliedFileName.c_str());
+                    return;
+                }
+
+                if (_writeQueue.valid())
+                {
+                    _writeQueue->write(simpliedFileName, buffer);
+                    return;
+                }
+
+                // write out the contents already serialized rather than serializing the image a second time.
+                if (writeFileAtomically(simpliedFileName, buffer)) recordFileWritten(filename, fileExistedBeforeWrite);
+                else log(notifylevel, "Error, in writing image file %s",filename.c_str());
+                return;
+            }
+
             osgDB::ReaderWriter::WriteResult result =
                 osgDB::Registry::instance()->writeImage(image, simpliedFileName, options.get());
 
             if (result.success())
             {
-                if (_databaseRevision.valid())
-                {
-                    if (fileExistedBeforeWrite)
-                    {
-                        if (_databaseRevision->getFilesModified()) _databaseRevision->getFilesModified()->addFile(filename);
-                    }
-                    else
-                    {
-                        if (_databaseRevision->getFilesAdded()) _databaseRevision->getFilesAdded()->addFile(filename);
-                    }
-                }
+                recordFileWritten(filename, fileExistedBeforeWrite);
             }
             else
             {
@@ -1587,9 +1948,10 @@ class WriteImageFilesVisitor : public osg::NodeVisitor
 {
 public:
 
-    WriteImageFilesVisitor(vpb::DataSet* dataSet, const std::string& directory):
+    WriteImageFilesVisitor(vpb::DataSet* dataSet, const std::string& directory, unsigned int archiveTicket=0):
         osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
         _dataSet(dataSet),
+        _archiveTicket(archiveTicket),
         _directory(directory),
         _writeHint(osg::Image::STORE_INLINE)
     {
@@ -1608,6 +1970,7 @@ public:
     }
 
     vpb::DataSet*           _dataSet;
+    unsigned int            _archiveTicket;
     std::string             _directory;
     osg::Image::WriteHint   _writeHint;
 
@@ -1651,7 +2014,7 @@ public:
             if (image)
             {
                 _dataSet->log(osg::NOTICE,"Writing out image layer %s, _directory=%s ",image->getFileName().c_str(),_directory.c_str());
-                if (needToWriteOutImage(image)) _dataSet->_writeImageFile(*image,_directory+image->getFileName());
+                if (needToWriteOutImage(image)) _dataSet->_writeImageFile(*image,_directory+image->getFileName(),_archiveTicket);
             }
             return;
         }
@@ -1716,24 +2079,24 @@ public:
 
             if (image && needToWriteOutImage(image))
             {
-                _dataSet->_writeImageFile(*image,_directory+image->getFileName());
+                _dataSet->_writeImageFile(*image,_directory+image->getFileName(),_archiveTicket);
             }
         }
     }
 };
 
-void DataSet::_writeNodeFileAndImages(osg::Node& node,const std::string& filename)
+void DataSet::_writeNodeFileAndImages(osg::Node& node,const std::string& filename, unsigned int archiveTicket)
 {
     if (getDisableWrites()) return;
 
     log(osg::NOTICE,"_writeNodeFile(%s)",filename.c_str());
 
     // write out any image data that is an external file
-    WriteImageFilesVisitor wifv(this, osgDB::getFilePath(filename));
+    WriteImageFilesVisitor wifv(this, osgDB::getFilePath(filename), archiveTicket);
     const_cast<osg::Node&>(node).accept(wifv);
 
     // write out the nodes
-    _writeNodeFile(node,filename);
+    _writeNodeFile(node,filename,archiveTicket);
 }
 
 
@@ -1742,22 +2105,26 @@ class WriteOperation : public BuildOperation
 {
     public:
 
-        WriteOperation(ThreadPool* threadPool, DataSet* dataset,CompositeDestination* cd, const std::string& filename):
+        WriteOperation(ThreadPool* threadPool, DataSet* dataset,CompositeDestination* cd, const std::string& filename, unsigned int archiveTicket):
             BuildOperation(threadPool, dataset->getBuildLog(), "WriteOperation", false),
             _dataset(dataset),
             _cd(cd),
-            _filename(filename) {}
+            _filename(filename),
+            _archiveTicket(archiveTicket) {}
 
         virtual void build()
         {
             //notify(osg::NOTICE)<<"   WriteOperation"<<std::endl;
 
+            ScopedSpan span("writeSubTile", _cd->_level, _cd->_tileX, _cd->_tileY);
+            ScopedMemoryStage stage("writeSubTile");
+
             osg::ref_ptr<osg::Node> node = _cd->createSubTileScene();
             if (node.valid())
             {
                 if (_buildLog.valid()) _buildLog->log(osg::NOTICE, "   writeSubTile filename= %s",_filename.c_str());
 
-                _dataset->_writeNodeFileAndImages(*node,_filename);
+                _dataset->_writeNodeFileAndImages(*node,_filename,_archiveTicket);
 
                 _cd->setSubTilesGenerated(true);
                 _cd->unrefSubTileData();
@@ -1766,23 +2133,76 @@ class WriteOperation : public BuildOperation
             {
                 log(osg::WARN, "   failed to writeSubTile node for tile, filename=%s",_filename.c_str());
             }
+
+            // always complete the ticket so later tiles aren't held back waiting for it
+            if (_archiveTicket) _dataset->getArchiveWriter()->complete(_archiveTicket);
         }
 
         DataSet*                            _dataset;
         osg::ref_ptr<CompositeDestination>  _cd;
         std::string                         _filename;
+        unsigned int                        _archiveTicket;
 };
 
 #define NEW_NAMING
 
+void DataSet::_prepareOutputDirectories()
+{
+    FilePathManager::PathSet directories;
+    directories.insert(getDirectory());
+    directories.insert(_taskOutputDirectory);
+
+    // tiles only differ in path by level and task, so keep one tile per path for computing the external set paths.
+    typedef std::map<std::string, CompositeDestination*> TilePathMap;
+    TilePathMap tilePaths;
+    for(QuadMap::iterator qitr = _quadMap.begin(); qitr != _quadMap.end(); ++qitr)
+    {
+        for(Level::iterator litr = qitr->second.begin(); litr != qitr->second.end(); ++litr)
+        {
+            for(Row::iterator ritr = litr->second.begin(); ritr != litr->second.end(); ++ritr)
+            {
+                CompositeDestination* cd = ritr->second;
+                std::string tilePath = cd->getTilePath();
+                if (tilePaths.count(tilePath)==0) tilePaths[tilePath] = cd;
+            }
+        }
+    }
+
+    for(TilePathMap::iterator itr = tilePaths.begin(); itr != tilePaths.end(); ++itr)
+    {
+        directories.insert(itr->first);
+
+        if (getOptionalImageLayerOutputPolicy()==EXTERNAL_SET_DIRECTORY)
+        {
+            for(OptionalLayerSet::const_iterator sitr = getOptionalLayerSet().begin();
+                sitr != getOptionalLayerSet().end();
+                ++sitr)
+            {
+                directories.insert(itr->first + itr->second->getRelativePathForExternalSet(*sitr));
+            }
+        }
+    }
+
+    unsigned int numFailed = FilePathManager::instance()->preparePaths(directories, OpenThreads::GetNumberOfProcessors());
+    if (numFailed>0) log(osg::WARN, "Warning: unable to prepare %u output directories, files in them will be checked as they are written",numFailed);
+}
+
 void DataSet::_writeRow(Row& row)
 {
     log(osg::NOTICE, "_writeRow %u",row.size());
-    for(Row::iterator citr=row.begin();
-        citr!=row.end();
+
+    CompositeDestinationList tiles;
+    getRegeneratedCompositeDestinations(row, tiles);
+    _writeTiles(tiles);
+}
+
+void DataSet::_writeTiles(const CompositeDestinationList& tiles)
+{
+    for(CompositeDestinationList::const_iterator citr=tiles.begin();
+        citr!=tiles.end();
         ++citr)
     {
-        CompositeDestination* cd = citr->second;
+        CompositeDestination* cd = *citr;
         CompositeDestination* parent = cd->_parent;
 
         if (parent)
@@ -1800,10 +2220,15 @@ void DataSet::_writeRow(Row& row)
 
                 if (_writeThreadPool.valid())
                 {
-                    _writeThreadPool->run(new WriteOperation(_writeThreadPool.get(), this, parent, filename));
+                    // reserve the archive ticket here, in the order tiles are queued, so the archive contents
+                    // don't depend on the order the write threads complete in.
+                    unsigned int archiveTicket = _archiveWriter.valid() ? _archiveWriter->reserve() : 0;
+                    _writeThreadPool->run(new WriteOperation(_writeThreadPool.get(), this, parent, filename, archiveTicket));
                 }
                 else
                 {
+                    ScopedMemoryStage stage("writeSubTile");
+
                     osg::ref_ptr<osg::Node> node = parent->createSubTileScene();
                     if (node.valid())
                     {
@@ -1988,10 +2413,22 @@ void DataSet::_buildDestination(bool writeToDisk)
 
     if (!_archive && !_archiveName.empty())
     {
-        unsigned int indexBlockSizeHint=4096;
-        _archive = osgDB::openArchive(_archiveName, osgDB::Archive::CREATE, indexBlockSizeHint);
+        if (TileContainer::isContainerFileName(_archiveName))
+        {
+            std::string containerName = getTileContainerFileName();
+            osg::ref_ptr<TileContainer> container = new TileContainer;
+            if (container->open(containerName, osgDB::Archive::CREATE)) _archive = container.get();
+            else log(osg::WARN, "Error: unable to create tile container %s",containerName.c_str());
+        }
+        else
+        {
+            unsigned int indexBlockSizeHint=4096;
+            _archive = osgDB::openArchive(_archiveName, osgDB::Archive::CREATE, indexBlockSizeHint);
+        }
     }
 
+    if (_archive.valid()) _archiveWriter = new ArchiveWriter(_archive.get());
+
     if (_destinationGraph.valid())
     {
 #ifdef NEW_NAMING
@@ -2000,6 +2437,11 @@ void DataSet::_buildDestination(bool writeToDisk)
         std::string filename = _directory+_tileBasename+_tileExtension;
 #endif
 
+        TileContainer* container = dynamic_cast<TileContainer*>(_archive.get());
+        if (container && !getGenerateSubtile()) container->setMasterFileName(filename);
+
+        if (writeToDisk && !_archive.valid() && !getDisableWrites()) _prepareOutputDirectories();
+
         if (_archive.valid())
         {
             log(osg::NOTICE, "started DataSet::writeDestination(%s)",_archiveName.c_str());
@@ -2060,29 +2502,66 @@ void DataSet::_buildDestination(bool writeToDisk)
 
                 log(osg::INFO, "New level");
 
-                Level::iterator prev_itr = level.begin();
-                _readRow(prev_itr->second);
-                Level::iterator curr_itr = prev_itr;
-                ++curr_itr;
-                for(;
-                    curr_itr!=level.end();
-                    ++curr_itr)
+                if (!getPatchExtents().empty())
                 {
-                    _readRow(curr_itr->second);
+                    unsigned int numTiles = 0;
+                    unsigned int numRegenerated = 0;
+                    for(Level::iterator litr = level.begin(); litr != level.end(); ++litr)
+                    {
+                        for(Row::iterator ritr = litr->second.begin(); ritr != litr->second.end(); ++ritr)
+                        {
+                            ++numTiles;
+                            if (requiresRegeneration(ritr->second)) ++numRegenerated;
+                        }
+                    }
+                    log(osg::NOTICE, "Level %u regenerating %u of %u tiles affected by patch",qitr->first,numRegenerated,numTiles);
+                }
 
-                    _equalizeRow(prev_itr->second);
-                    if (writeToDisk) _writeRow(prev_itr->second);
+                System* system = System::instance().get();
+                unsigned int numDatasetCacheHits = system->getNumDatasetCacheHits();
+                unsigned int numDatasetCacheMisses = system->getNumDatasetCacheMisses();
 
-                    prev_itr = curr_itr;
+                if (getZOrderTraversal())
+                {
+                    _buildLevelInZOrder(qitr->first, level, writeToDisk);
                 }
+                else
+                {
+                    Level::iterator prev_itr = level.begin();
+                    _readRow(prev_itr->second);
+                    Level::iterator curr_itr = prev_itr;
+                    ++curr_itr;
+                    for(;
+                        curr_itr!=level.end();
+                        ++curr_itr)
+                    {
+                        _readRow(curr_itr->second);
 
-                _equalizeRow(prev_itr->second);
+                        _equalizeRow(prev_itr->second);
+                        if (writeToDisk) _writeRow(prev_itr->second);
 
-                if (writeToDisk)
-                {
-                    if (writeToDisk) _writeRow(prev_itr->second);
+                        prev_itr = curr_itr;
+                    }
+
+                    _equalizeRow(prev_itr->second);
+
+                    if (writeToDisk)
+                    {
+                        if (writeToDisk) _writeRow(prev_itr->second);
+                    }
                 }
 
+                log(osg::NOTICE, "Level %u dataset cache hits=%u misses=%u",qitr->first,
+                    system->getNumDatasetCacheHits()-numDatasetCacheHits,
+                    system->getNumDatasetCacheMisses()-numDatasetCacheMisses);
+
+                logTerrainResolutions();
+
+                log(osg::NOTICE, "Level %u memory usage %.1fMB, peak %.1fMB",qitr->first,
+                    MemoryTracker::instance()->getCurrentTotal()/(1024.0*1024.0),
+                    MemoryTracker::instance()->getPeakTotal()/(1024.0*1024.0));
+                if (_taskFile.valid()) MemoryTracker::instance()->setTaskProperties(*_taskFile);
+
 #if 0
                 if (_writeThreadPool.valid()) _writeThreadPool->waitForCompletion();
 #endif
@@ -2102,6 +2581,7 @@ void DataSet::_buildDestination(bool writeToDisk)
         }
 
         if (_writeThreadPool.valid()) _writeThreadPool->waitForCompletion();
+        if (_writeQueue.valid()) _writeQueue->flush();
 
     }
     else
@@ -2109,6 +2589,13 @@ void DataSet::_buildDestination(bool writeToDisk)
         log(osg::WARN, "Error: no scene graph to output, no file written.");
     }
 
+    if (_archiveWriter.valid())
+    {
+        _archiveWriter->flush();
+        log(osg::INFO, "Archive writer held at most %u outstanding tickets",_archiveWriter->getMaxNumPendingTickets());
+        _archiveWriter = 0;
+    }
+
     if (_archive.valid()) _archive->close();
 
     osgDB::Registry::instance()->setOptions(previous_options.get());
@@ -2297,6 +2784,9 @@ bool DataSet::addTerrain(osgTerrain::TerrainTile* terrainTile, unsigned int revi
         if (layer)
         {
             addLayer(vpb::Source::IMAGE, layer, i, revisionNumber);
+
+            // a task given only the sources overlapping its subtile may have none on a layer, it still needs the layer's texture unit.
+            if (_numTextureLevels<i+1) _numTextureLevels = i+1;
         }
     }
 
@@ -2686,6 +3176,33 @@ bool DataSet::generateTasks(TaskManager* taskManager)
 
 }
 
+bool DataSet::computeTileCounts(std::vector<unsigned int>& numTiles, std::vector<unsigned int>& numSubdividedTiles)
+{
+    numTiles.clear();
+    numSubdividedTiles.clear();
+
+    loadSources();
+
+    if (!prepareForDestinationGraphCreation()) return false;
+
+    unsigned int maxLevel = computeMaximumLevel(getMaximumNumOfLevels());
+
+    // the root tile is split into C1 x R1 tiles at level 1, after which each tile is split into four.
+    numTiles.push_back(1);
+    for(unsigned int level=0; level<=maxLevel; ++level)
+    {
+        TilePairMap tileMap;
+        createTileMap(level, tileMap);
+        numSubdividedTiles.push_back(tileMap.size());
+
+        if (tileMap.empty() || level==maxLevel) break;
+
+        numTiles.push_back(level==0 ? _C1*_R1 : tileMap.size()*4);
+    }
+
+    return true;
+}
+
 void DataSet::selectAppropriateSplitLevels()
 {
     unsigned int maxLevel = computeMaximumLevel(getMaximumNumOfLevels());
@@ -2797,6 +3314,23 @@ std::string DataSet::getTaskName(unsigned int level, unsigned int X, unsigned in
     }
 }
 
+std::string DataSet::getTileContainerFileName() const
+{
+    std::string containerName = _archiveName;
+    if (getGenerateSubtile())
+    {
+        std::ostringstream os;
+        os << osgDB::getNameLessExtension(_archiveName) << "_subtile_L"<<getSubtileLevel()<<"_X"<<getSubtileX()<<"_Y"<<getSubtileY()
+           << "." << osgDB::getFileExtension(_archiveName);
+        containerName = os.str();
+    }
+
+    // place containers given without a path in the build directory, so that the names of the files within are relative to it.
+    if (osgDB::getFilePath(containerName).empty()) containerName = getDirectory() + containerName;
+
+    return containerName;
+}
+
 std::string DataSet::getSubtileName(unsigned int level, unsigned int X, unsigned int Y) const
 {
     std::ostringstream os;
@@ -2884,6 +3418,8 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
     std::string fileCacheName;
     if (System::instance()->getFileCache()) fileCacheName = System::instance()->getFileCache()->getFileName();
 
+    std::string metadataCacheName = System::instance()->getMetadataCacheFileName();
+
     bool logging = getNotifyLevel() > ALWAYS;
 
 
@@ -2900,6 +3436,11 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
             app<<" --cache "<<fileCacheName;
         }
 
+        if (!metadataCacheName.empty())
+        {
+            app<<" --metadata-cache "<<metadataCacheName;
+        }
+
         if (logging)
         {
             std::ostringstream logfile;
@@ -2907,9 +3448,11 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
             app<<" --log "<<logfile.str();
         }
 
-        taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(0,0,0));
+        taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(0,0,0), "root");
     }
 
+    computePatchExtents();
+
     // create the tilemaps for the required split levels
     TilePairMap intermediateTileMap;
     if (getDistributedBuildSecondarySplitLevel()!=0)
@@ -2961,6 +3504,11 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --cache "<<fileCacheName;
             }
 
+            if (!metadataCacheName.empty())
+            {
+                app<<" --metadata-cache "<<metadataCacheName;
+            }
+
             if (logging)
             {
                 std::ostringstream logfile;
@@ -2970,7 +3518,7 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --log "<<logfile.str();
             }
 
-            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY));
+            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY), "intermediate");
 
             ++taskCount;
         }
@@ -3017,6 +3565,11 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --cache "<<fileCacheName;
             }
 
+            if (!metadataCacheName.empty())
+            {
+                app<<" --metadata-cache "<<metadataCacheName;
+            }
+
             if (logging)
             {
                 std::ostringstream logfile;
@@ -3035,7 +3588,7 @@ bool DataSet::generateTasksImplementation(TaskManager* taskManager)
                 app<<" --log "<<logfile.str();
             }
 
-            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY));
+            taskManager->addTask(taskfile.str(), app.str(), sourceFile, getDatabaseRevisionBaseFileName(level,tileX,tileY), "leaf");
 
             ++taskCount;
         }
@@ -3110,7 +3663,40 @@ int DataSet::run()
         }
     }
 
-    int result = _run();
+    std::string traceFileName = getTraceFileName();
+    if (!traceFileName.empty())
+    {
+        if (_taskFile.valid())
+        {
+            // tasks of a distributed build each write their own trace for vpbmaster to merge.
+            traceFileName = osgDB::getNameLessExtension(_taskFile->getFileName()) + ".trace.json";
+            _taskFile->setProperty("trace file", traceFileName);
+            Trace::instance()->setProcessName(osgDB::getSimpleFileName(osgDB::getNameLessExtension(_taskFile->getFileName())));
+        }
+        Trace::instance()->setEnabled(true);
+    }
+
+    MemoryTracker::instance()->resetPeaks();
+    MemoryTracker::instance()->setMaximumMemory(double(getMemoryBudget())*1024.0*1024.0);
+
+    int result = 0;
+    {
+        ScopedSpan span("run");
+        result = _run();
+    }
+
+    if (_writeQueue.valid())
+    {
+        // flush any files still queued so the DatabaseRevision lists are complete before they are written.
+        _writeQueue->stopThreads();
+
+        WriteQueue::Statistics stats = _writeQueue->getStatistics();
+        log(osg::NOTICE, "Write-behind wrote %u files, %.1fMB, %u failed",stats.numFiles, stats.numBytes/(1024.0*1024.0), stats.numFailed);
+        log(osg::NOTICE, "Write-behind maximum queue depth %u, maximum queued %.1fMB, %u writes blocked on the buffer",stats.maxQueueDepth, stats.maxQueuedBytes/(1024.0*1024.0), stats.numBlockedWrites);
+        log(osg::NOTICE, "Write-behind latency average %.3fs, maximum %.3fs",stats.averageLatency(), stats.maxLatency);
+
+        _writeQueue = 0;
+    }
 
     if (_databaseRevision.valid())
     {
@@ -3134,6 +3720,25 @@ int DataSet::run()
         }
     }
 
+    MemoryTracker* memoryTracker = MemoryTracker::instance();
+    log(osg::NOTICE, "Peak memory usage %.1fMB, destination images %.1fMB, destination height fields %.1fMB, source buffers %.1fMB, write queue %.1fMB",
+        memoryTracker->getPeakTotal()/(1024.0*1024.0),
+        memoryTracker->getPeak(MemoryTracker::DESTINATION_IMAGES)/(1024.0*1024.0),
+        memoryTracker->getPeak(MemoryTracker::DESTINATION_HEIGHTFIELDS)/(1024.0*1024.0),
+        memoryTracker->getPeak(MemoryTracker::SOURCE_BUFFERS)/(1024.0*1024.0),
+        memoryTracker->getPeak(MemoryTracker::WRITE_QUEUE)/(1024.0*1024.0));
+    if (getMemoryBudget()>0) log(osg::NOTICE, "Memory budget %uMB held back %u tile reads",getMemoryBudget(),memoryTracker->getNumThrottledReads());
+    if (_taskFile.valid()) memoryTracker->setTaskProperties(*_taskFile);
+
+    if (!traceFileName.empty())
+    {
+        Trace::instance()->setEnabled(false);
+        if (Trace::instance()->write(traceFileName))
+        {
+            log(osg::NOTICE, "Wrote %u trace spans to %s",Trace::instance()->getNumSpans(),traceFileName.c_str());
+        }
+    }
+
     if (getBuildLog())
     {
         popOperationLog();
@@ -3182,6 +3787,14 @@ int DataSet::_run()
         }
     }
 
+    if (getWriteBehindBufferSize()>0 && _archiveName.empty() && !getDisableWrites())
+    {
+        log(osg::NOTICE,"Starting %u write-behind threads with a %uMB buffer.",getNumWriteBehindThreads(),getWriteBehindBufferSize());
+        _writeQueue = new WriteQueue(getNumWriteBehindThreads(), double(getWriteBehindBufferSize())*1024.0*1024.0, getSyncWrites());
+        _writeQueue->setCallback(new WriteQueueCallback(this));
+        _writeQueue->startThreads();
+    }
+
 
     loadSources();
 
@@ -3196,6 +3809,20 @@ int DataSet::_run()
         return 1;
     }
 
+    if (_taskFile.valid())
+    {
+        // record the number of tiles built so vpbsizes can work out the cost per tile from the task.
+        unsigned int numTiles = 0;
+        for(QuadMap::iterator qitr = _quadMap.begin(); qitr != _quadMap.end(); ++qitr)
+        {
+            for(Level::iterator litr = qitr->second.begin(); litr != qitr->second.end(); ++litr)
+            {
+                numTiles += litr->second.size();
+            }
+        }
+        _taskFile->setProperty("tiles", numTiles);
+    }
+
 
     bool requiresGenerationOfTiles = getGenerateTiles();
 
@@ -12,6 +12,7 @@
 */
 
 #include <vpb/DatabaseBuilder>
+#include <vpb/SourceManifest>
 
 #include <iostream>
 #include <string>
@@ -129,6 +130,16 @@ class VPBReaderWriter : public osgDB::ReaderWriter
             std::string fileName = osgDB::findDataFile( file, opt );
             if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
 
+            if (vpb::SourceManifest::isManifestFile(fileName))
+            {
+                osg::ref_ptr<vpb::SourceManifest> manifest = new vpb::SourceManifest;
+                if (!manifest->open(fileName, opt)) return ReadResult::ERROR_IN_READING_FILE;
+
+                osg::Node* node = manifest->createTerrainTile();
+                if (!node) return ReadResult::ERROR_IN_READING_FILE;
+                return node;
+            }
+
             // code for setting up the database path so that internally referenced file are searched for on relative paths.
             osg::ref_ptr<Options> local_opt = opt ? static_cast<Options*>(opt->clone(osg::CopyOp::SHALLOW_COPY)) : new Options;
             local_opt->setDatabasePath(osgDB::getFilePath(fileName));
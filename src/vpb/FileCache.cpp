@@ -15,28 +15,313 @@
 #include <vpb/System>
 #include <vpb/BuildLog>
 #include <vpb/DataSet>
+#include <vpb/FileUtils>
+#include <vpb/BinaryStream>
 
 #include <osg/io_utils>
 #include <osgDB/FileNameUtils>
 
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <sstream>
+
 using namespace vpb;
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Binary cache file layout, all values are stored in native byte order:
+//
+//   header  : char magic[8] "VPBCACHE", uint32 version, uint32 byte order tag
+//   segment : uint32 magic, uint32 numRecords, uint64 payloadSize, uint64 indexChecksum, uint64 reserved
+//             IndexEntry originalIndex[numRecords]  - { uint64 hash, uint64 offset } sorted by original source file hash
+//             IndexEntry fileIndex[numRecords]      - { uint64 hash, uint64 offset } sorted by file name hash
+//             records
+//
+// Segments are only ever appended, with the <cache>.lock file held, so several tasks can sync
+// to the same cache.  Only the last segment can be partially written so it alone has its index
+// checksum verified on load.  Compaction rewrites the whole cache to a temporary file that is
+// then renamed over the original, so readers always see a complete file.
+//
+namespace FileCacheBinary
+{
+
+const char s_magic[8] = { 'V','P','B','C','A','C','H','E' };
+const uint32_t s_version = 1;
+const uint32_t s_byteOrderTag = 0x01020304;
+const uint32_t s_segmentMagic = 0x53425056;
+const uint32_t s_flagRemoved = 1;
+
+const size_t s_headerSize = 16;
+const size_t s_segmentHeaderSize = 32;
+const size_t s_indexEntrySize = 16;
+
+inline uint64_t indexHash(const char* index, unsigned int i) { return getValue<uint64_t>(index + i*s_indexEntrySize); }
+inline uint64_t indexOffset(const char* index, unsigned int i) { return getValue<uint64_t>(index + i*s_indexEntrySize + 8); }
+
+/** return the position of the first index entry with a hash not less than key.*/
+inline unsigned int lowerBound(const char* index, unsigned int numRecords, uint64_t key)
+{
+    unsigned int lo = 0;
+    unsigned int hi = numRecords;
+    while(lo<hi)
+    {
+        unsigned int mid = lo + (hi-lo)/2;
+        if (indexHash(index, mid)<key) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+struct IndexEntry
+{
+    IndexEntry(uint64_t in_hash, uint64_t in_offset): hash(in_hash), offset(in_offset) {}
+
+    bool operator < (const IndexEntry& rhs) const
+    {
+        if (hash<rhs.hash) return true;
+        if (rhs.hash<hash) return false;
+        return offset<rhs.offset;
+    }
+
+    uint64_t hash;
+    uint64_t offset;
+};
+typedef std::vector<IndexEntry> Index;
+
+void writeRecord(BinaryWriter& w, const FileDetails& fd, uint32_t flags)
+{
+    const SpatialProperties& sp = fd.getSpatialProperties();
+    const osg::Matrixd& m = sp._geoTransform;
+
+    w.write(flags);
+    w.writeString(fd.getOriginalSourceFileName());
+    w.writeString(fd.getFileName());
+    w.writeString(fd.getHostName());
+    w.writeString(fd.getBuildApplication());
+    w.writeString(sp._cs.valid() ? sp._cs->getCoordinateSystem() : std::string());
+    w.write(sp._extents.xMin()); w.write(sp._extents.yMin()); w.write(sp._extents.xMax()); w.write(sp._extents.yMax());
+    w.write(m(0,0)); w.write(m(0,1)); w.write(m(1,0)); w.write(m(1,1)); w.write(m(3,0)); w.write(m(3,1));
+    w.write(static_cast<int32_t>(sp._numValuesX));
+    w.write(static_cast<int32_t>(sp._numValuesY));
+    w.write(static_cast<int32_t>(sp._numValuesZ));
+    w.write(static_cast<uint32_t>(sp._dataType));
+}
+
+void writeHeader(std::string& buffer)
+{
+    BinaryWriter w(buffer);
+    buffer.append(s_magic, sizeof(s_magic));
+    w.write(s_version);
+    w.write(s_byteOrderTag);
+}
+
+void writeSegment(std::string& buffer, const FileCache::Variants& details, const std::vector<uint32_t>& flags)
+{
+    std::string records;
+    BinaryWriter rw(records);
+
+    Index originalIndex;
+    Index fileIndex;
+
+    unsigned int i = 0;
+    for(FileCache::Variants::const_iterator itr = details.begin();
+        itr != details.end();
+        ++itr, ++i)
+    {
+        const FileDetails& fd = *(*itr);
+        uint64_t offset = records.size();
+        originalIndex.push_back(IndexEntry(hashBytes(fd.getOriginalSourceFileName()), offset));
+        fileIndex.push_back(IndexEntry(hashBytes(fd.getFileName()), offset));
+        writeRecord(rw, fd, flags[i]);
+    }
+
+    // sorting on hash then offset keeps records that share a hash in the order they were written
+    std::sort(originalIndex.begin(), originalIndex.end());
+    std::sort(fileIndex.begin(), fileIndex.end());
+
+    std::string index;
+    BinaryWriter iw(index);
+    for(Index::iterator itr = originalIndex.begin(); itr != originalIndex.end(); ++itr) { iw.write(itr->hash); iw.write(itr->offset); }
+    for(Index::iterator itr = fileIndex.begin(); itr != fileIndex.end(); ++itr) { iw.write(itr->hash); iw.write(itr->offset); }
+
+    BinaryWriter w(buffer);
+    w.write(s_segmentMagic);
+    w.write(static_cast<uint32_t>(details.size()));
+    w.write(static_cast<uint64_t>(index.size()+records.size()));
+    w.write(hashBytes(index));
+    w.write(static_cast<uint64_t>(0));
+    buffer.append(index);
+    buffer.append(records);
+}
+
+/** scan the segments of a binary cache, returning false if the data isn't a binary cache.
+  * validEnd is set to the end of the last complete segment.*/
+bool scan(const char* data, size_t size, std::vector<const char*>& segments, size_t& validEnd)
+{
+    validEnd = 0;
+
+    if (size<s_headerSize || memcmp(data, s_magic, sizeof(s_magic))!=0) return false;
+
+    if (getValue<uint32_t>(data+12)!=s_byteOrderTag)
+    {
+        log(osg::WARN,"Error: binary cache file written with a different byte order, please convert it via the text format.");
+        return false;
+    }
+
+    if (getValue<uint32_t>(data+8)>s_version)
+    {
+        log(osg::WARN,"Error: binary cache file version %d not supported.",getValue<uint32_t>(data+8));
+        return false;
+    }
+
+    size_t offset = s_headerSize;
+    validEnd = offset;
+    while(offset+s_segmentHeaderSize <= size)
+    {
+        const char* header = data+offset;
+        if (getValue<uint32_t>(header)!=s_segmentMagic) break;
+
+        uint64_t numRecords = getValue<uint32_t>(header+4);
+        uint64_t payloadSize = getValue<uint64_t>(header+8);
+        uint64_t indexSize = numRecords*2*s_indexEntrySize;
+        if (payloadSize > size-offset-s_segmentHeaderSize || indexSize > payloadSize) break;
+
+        bool lastSegment = (offset+s_segmentHeaderSize+payloadSize == size);
+        if (lastSegment && hashBytes(header+s_segmentHeaderSize, indexSize)!=getValue<uint64_t>(header+16)) break;
+
+        segments.push_back(header);
+
+        offset += s_segmentHeaderSize+payloadSize;
+        validEnd = offset;
+    }
+
+    return true;
+}
+
+}
+
+using namespace FileCacheBinary;
+
+namespace vpb
+{
+
+/** Decodes binary cache records, sharing the CoordinateSystemNode of records with identical WKT
+  * so the coordinate system type is only computed once per distinct coordinate system.*/
+class FileCacheRecordDecoder
+{
+public:
+
+    FileCacheRecordDecoder(FileCache::CoordinateSystemMap& coordinateSystemMap):
+        _coordinateSystemMap(coordinateSystemMap) {}
+
+    bool decodeOriginal(const char* records, size_t recordsSize, uint64_t offset, std::string& original)
+    {
+        if (offset>=recordsSize) return false;
+        BinaryReader r(records+offset, recordsSize-offset);
+        uint32_t flags;
+        return r.read(flags) && r.readString(original);
+    }
+
+    FileDetails* decode(const char* records, size_t recordsSize, uint64_t offset, bool& removed)
+    {
+        if (offset>=recordsSize) return 0;
+
+        BinaryReader r(records+offset, recordsSize-offset);
+
+        osg::ref_ptr<FileDetails> fd = new FileDetails;
+        SpatialProperties& sp = fd->getSpatialProperties();
+
+        uint32_t flags = 0;
+        std::string cs;
+        double minX, minY, maxX, maxY;
+        osg::Matrixd m;
+        int32_t sizeX, sizeY, sizeZ;
+        uint32_t dataType;
+
+        if (!r.read(flags) ||
+            !r.readString(fd->getOriginalSourceFileName()) ||
+            !r.readString(fd->getFileName()) ||
+            !r.readString(fd->getHostName()) ||
+            !r.readString(fd->getBuildApplication()) ||
+            !r.readString(cs) ||
+            !r.read(minX) || !r.read(minY) || !r.read(maxX) || !r.read(maxY) ||
+            !r.read(m(0,0)) || !r.read(m(0,1)) || !r.read(m(1,0)) || !r.read(m(1,1)) || !r.read(m(3,0)) || !r.read(m(3,1)) ||
+            !r.read(sizeX) || !r.read(sizeY) || !r.read(sizeZ) ||
+            !r.read(dataType))
+        {
+            log(osg::WARN,"Error: corrupt record in binary cache file.");
+            return 0;
+        }
+
+        removed = (flags & s_flagRemoved)!=0;
+
+        if (!cs.empty())
+        {
+            FileCache::CoordinateSystemMap::iterator itr = _coordinateSystemMap.find(cs);
+            if (itr==_coordinateSystemMap.end())
+            {
+                osg::ref_ptr<osg::CoordinateSystemNode> csn = new osg::CoordinateSystemNode;
+                csn->setCoordinateSystem(cs);
+                itr = _coordinateSystemMap.insert(FileCache::CoordinateSystemMap::value_type(cs, FileCache::CoordinateSystemEntry(csn.get(), getCoordinateSystemType(csn.get())==GEOGRAPHIC))).first;
+            }
+            sp._cs = itr->second.first;
+            sp._extents._isGeographic = itr->second.second;
+        }
+
+        sp._extents._min.set(minX,minY);
+        sp._extents._max.set(maxX,maxY);
+        sp._geoTransform = m;
+        sp._numValuesX = sizeX;
+        sp._numValuesY = sizeY;
+        sp._numValuesZ = sizeZ;
+        sp._dataType = static_cast<SpatialProperties::DataType>(dataType);
+
+        return fd.release();
+    }
+
+protected:
+
+    FileCache::CoordinateSystemMap& _coordinateSystemMap;
+};
+
+}
+
 FileCache::FileCache()
 {
+    _format = TEXT_FORMAT;
+    _maximumNumSegments = 16;
     _requiresWrite = false;
+    _requiresRewrite = false;
+    _allResolved = false;
+    _localHostName = getLocalHostName();
 }
 
 
 FileCache::FileCache(const FileCache& fc,const osg::CopyOp& copyop):
     osg::Object(fc, copyop)
 {
+    _format = fc._format;
+    _maximumNumSegments = fc._maximumNumSegments;
     _requiresWrite = false;
+    _requiresRewrite = false;
+    _allResolved = false;
+    _localHostName = getLocalHostName();
 }
 
 FileCache::~FileCache()
 {
 }
 
+void FileCache::setFormat(Format format)
+{
+    if (_format==format) return;
+
+    _format = format;
+    _requiresWrite = true;
+    _requiresRewrite = true;
+}
+
 bool FileCache::read(const std::string& filename)
 {
     log(osg::NOTICE,"FileCache::read(%s)",filename.c_str());
@@ -50,15 +335,30 @@ bool FileCache::read(const std::string& filename)
 
     _filename = filename;
 
+    char magic[sizeof(s_magic)];
+    FILE* fp = vpb::fopen(foundFile.c_str(), "rb");
+    bool binary = fp && fread(magic, 1, sizeof(magic), fp)==sizeof(magic) && memcmp(magic, s_magic, sizeof(magic))==0;
+    if (fp) vpb::fclose(fp);
+
+    if (binary) return readBinary(foundFile);
+    else return readText(foundFile);
+}
+
+bool FileCache::readText(const std::string& foundFile)
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    _format = TEXT_FORMAT;
+
     osgDB::ifstream fin(foundFile.c_str());
-    
+
     bool emptyBefore = _variantMap.empty();
-    
+
     if (fin)
     {
         osgDB::Input fr;
         fr.attach(&fin);
-        
+
         std::string str;
 
         while(!fr.eof())
@@ -104,7 +404,7 @@ bool FileCache::read(const std::string& filename)
                     if (fr.read("cs",str))
                     {
                         if (!fd->getSpatialProperties()._cs) fd->getSpatialProperties()._cs = new osg::CoordinateSystemNode;
-                        
+
                         fd->getSpatialProperties()._cs->setCoordinateSystem(str);
                          fd->getSpatialProperties()._extents._isGeographic = getCoordinateSystemType(fd->getSpatialProperties()._cs.get())==GEOGRAPHIC;
 
@@ -141,20 +441,77 @@ bool FileCache::read(const std::string& filename)
                 ++fr;
 
                 itrAdvanced = true;
-                
-                addFileDetails(fd.get());
+
+                insertFileDetails(fd.get());
 
             }
-            
+
             if (!itrAdvanced) ++fr;
         }
     }
-    
+
     _requiresWrite = !emptyBefore;
+    _requiresRewrite = _requiresWrite;
 
     return false;
 }
- 
+
+bool FileCache::readBinary(const std::string& foundFile)
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+    if (!mappedFile->open(foundFile))
+    {
+        log(osg::WARN,"Error: could not open cache file '%s'",foundFile.c_str());
+        return false;
+    }
+
+    std::vector<const char*> segmentHeaders;
+    size_t validEnd = 0;
+    if (!scan(mappedFile->data(), mappedFile->size(), segmentHeaders, validEnd))
+    {
+        log(osg::WARN,"Error: cache file '%s' is not a valid binary cache.",foundFile.c_str());
+        return false;
+    }
+
+    if (validEnd<mappedFile->size())
+    {
+        log(osg::WARN,"Warning: ignoring incomplete trailing segment of cache file '%s'.",foundFile.c_str());
+    }
+
+    // merging into an already populated cache needs the binary contents in memory before it can be rewritten.
+    bool emptyBefore = _variantMap.empty();
+
+    releaseBinary();
+
+    _format = BINARY_FORMAT;
+
+    assignSegments(mappedFile.get(), segmentHeaders);
+
+    unsigned int numRecords = 0;
+    for(Segments::iterator itr = _segments.begin(); itr != _segments.end(); ++itr)
+    {
+        numRecords += itr->numRecords;
+    }
+
+    log(osg::NOTICE,"FileCache::read(%s) binary cache with %d segments, %d records",foundFile.c_str(),int(_segments.size()),numRecords);
+
+    if (!emptyBefore)
+    {
+        resolveAll();
+        _requiresWrite = true;
+        _requiresRewrite = true;
+    }
+    else
+    {
+        _requiresWrite = false;
+        _requiresRewrite = false;
+    }
+
+    return true;
+}
+
 bool FileCache::open(const std::string& filename)
 {
     std::string foundFile = osgDB::findDataFile(filename);
@@ -162,9 +519,10 @@ bool FileCache::open(const std::string& filename)
     {
         setFileName(filename);
         _requiresWrite = true;
+        _requiresRewrite = true;
         return false;
     }
-    
+
     return read(foundFile);
 }
 
@@ -172,89 +530,415 @@ bool FileCache::write(const std::string& filename)
 {
     log(osg::NOTICE,"FileCache::write(%s)",filename.c_str());
 
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+    if (_format==BINARY_FORMAT) return writeBinary(filename);
+    else return writeText(filename);
+}
+
+bool FileCache::writeText(const std::string& filename)
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    resolveAll();
+
+    std::ostringstream str;
+    str<<filename<<".tmp."<<vpb::getpid();
+    std::string tmpFileName = str.str();
+
+    {
+        osgDB::Output fout(tmpFileName.c_str());
+        if (!fout)
+        {
+            log(osg::WARN,"Error: unable to open temporary cache file '%s' for writing.",tmpFileName.c_str());
+            return false;
+        }
+
+        fout.precision(15);
+
+        for(VariantMap::iterator itr = _variantMap.begin();
+            itr != _variantMap.end();
+            ++itr)
+        {
+            Variants& variants = itr->second;
+            for(Variants::iterator vitr = variants.begin();
+                vitr != variants.end();
+                ++vitr)
+            {
+                FileDetails* fd = vitr->get();
+
+                fout.indent()<<"FileDetails {"<<std::endl;
+                fout.moveIn();
+
+                if (!fd->getBuildApplication().empty())
+                {
+                    fout.indent()<<"build "<<fout.wrapString(fd->getBuildApplication())<<std::endl;
+                }
+
+                if (!fd->getHostName().empty())
+                {
+                    fout.indent()<<"hostname "<<fout.wrapString(fd->getHostName())<<std::endl;
+                }
+
+                if (!fd->getOriginalSourceFileName().empty())
+                {
+                    fout.indent()<<"original "<<fout.wrapString(fd->getOriginalSourceFileName())<<std::endl;
+                }
+
+                if (!fd->getFileName().empty())
+                {
+                    fout.indent()<<"file "<<fout.wrapString(fd->getFileName())<<std::endl;
+                }
+
+                if (fd->getSpatialProperties()._cs.valid() && !fd->getSpatialProperties()._cs->getCoordinateSystem().empty())
+                {
+                    fout.indent()<<"cs "<<fout.wrapString(fd->getSpatialProperties()._cs->getCoordinateSystem())<<std::endl;
+                }
+
+                if (fd->getSpatialProperties()._extents.valid())
+                {
+                    const GeospatialExtents& extents = fd->getSpatialProperties()._extents;
+                    fout.indent()<<"extents "<<extents.xMin()<<" "<<extents.yMin()<<" "<<extents.xMax()<<" "<<extents.yMax()<<std::endl;
+                }
+
+                if (!fd->getSpatialProperties()._geoTransform.isIdentity())
+                {
+                    const osg::Matrixd& m = fd->getSpatialProperties()._geoTransform;
+                    fout.indent()<<"geoTransform "<<m(0,0)<<" "<<m(0,1)<<" "<<m(1,0)<<" "<<m(1,1)<<" "<<m(3,0)<<" "<<m(3,1)<<std::endl;
+                }
+
+                if (fd->getSpatialProperties()._numValuesX>0 || fd->getSpatialProperties()._numValuesY>0 || fd->getSpatialProperties()._numValuesZ>0)
+                {
+                    fout.indent()<<"size "<<fd->getSpatialProperties()._numValuesX<<" "<<fd->getSpatialProperties()._numValuesY<<" "<<fd->getSpatialProperties()._numValuesZ<<std::endl;
+                }
+
+                fout.moveOut();
+                fout.indent()<<"}"<<std::endl;
+
+
+            }
+        }
+    }
+
+    if (vpb::rename(tmpFileName.c_str(), filename.c_str())!=0)
+    {
+        log(osg::WARN,"Error: unable to write cache file '%s'.",filename.c_str());
+        remove(tmpFileName.c_str());
+        return false;
+    }
 
     _filename = filename;
     _requiresWrite = false;
+    _requiresRewrite = false;
+    _pendingChanges.clear();
 
-    osgDB::Output fout(filename.c_str());
+    releaseBinary();
 
-    fout.precision(15);
+    return true;
+}
 
+bool FileCache::writeBinary(const std::string& filename)
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    resolveAll();
+
+    Variants details;
     for(VariantMap::iterator itr = _variantMap.begin();
         itr != _variantMap.end();
         ++itr)
     {
-        Variants& variants = itr->second;
-        for(Variants::iterator vitr = variants.begin();
-            vitr != variants.end();
-            ++vitr)
+        details.insert(details.end(), itr->second.begin(), itr->second.end());
+    }
+    std::vector<uint32_t> flags(details.size(), 0);
+
+    std::string buffer;
+    writeHeader(buffer);
+    writeSegment(buffer, details, flags);
+
+    {
+        ScopedFileLock fileLock(filename);
+        if (!writeFileAtomically(filename, buffer)) return false;
+    }
+
+    _filename = filename;
+    _requiresWrite = false;
+    _requiresRewrite = false;
+    _pendingChanges.clear();
+
+    // everything is now in memory so the old mapping is no longer required.
+    releaseBinary();
+
+    return true;
+}
+
+bool FileCache::appendBinarySegment()
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    if (_pendingChanges.empty())
+    {
+        _requiresWrite = false;
+        return true;
+    }
+
+    Variants details;
+    std::vector<uint32_t> flags;
+    for(PendingChanges::iterator itr = _pendingChanges.begin();
+        itr != _pendingChanges.end();
+        ++itr)
+    {
+        details.push_back(itr->fd);
+        flags.push_back(itr->removed ? s_flagRemoved : 0);
+    }
+
+    std::string buffer;
+    writeSegment(buffer, details, flags);
+
+    ScopedFileLock fileLock(_filename);
+
+    // find the end of the last complete segment, discarding anything left by an interrupted append.
+    size_t validEnd = 0;
+    unsigned int numSegments = 0;
+    {
+        osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+        std::vector<const char*> segmentHeaders;
+        if (!mappedFile->open(_filename) || !scan(mappedFile->data(), mappedFile->size(), segmentHeaders, validEnd))
         {
-            FileDetails* fd = vitr->get();
-            
-            fout.indent()<<"FileDetails {"<<std::endl;
-            fout.moveIn();
-            
-            if (!fd->getBuildApplication().empty())
-            {
-                fout.indent()<<"build "<<fout.wrapString(fd->getBuildApplication())<<std::endl;
-            }
+            log(osg::WARN,"Error: unable to append to cache file '%s', not a valid binary cache.",_filename.c_str());
+            return false;
+        }
+        numSegments = segmentHeaders.size();
+    }
 
-            if (!fd->getHostName().empty())
-            {
-                fout.indent()<<"hostname "<<fout.wrapString(fd->getHostName())<<std::endl;
-            }
+    int fileID = vpb::open(_filename.c_str(), O_RDWR);
+    if (fileID<0)
+    {
+        log(osg::WARN,"Error: unable to open cache file '%s' for appending.",_filename.c_str());
+        return false;
+    }
 
-            if (!fd->getOriginalSourceFileName().empty())
-            {
-                fout.indent()<<"original "<<fout.wrapString(fd->getOriginalSourceFileName())<<std::endl;
-            }
-            
-            if (!fd->getFileName().empty())
-            {
-                fout.indent()<<"file "<<fout.wrapString(fd->getFileName())<<std::endl;
-            }
-            
-            if (fd->getSpatialProperties()._cs.valid() && !fd->getSpatialProperties()._cs->getCoordinateSystem().empty())
-            {
-                fout.indent()<<"cs "<<fout.wrapString(fd->getSpatialProperties()._cs->getCoordinateSystem())<<std::endl;
-            }
+    bool ok = vpb::ftruncate(fileID, validEnd)==0 &&
+              vpb::lseek(fileID, validEnd, SEEK_SET)==static_cast<off_t>(validEnd);
 
-            if (fd->getSpatialProperties()._extents.valid())
-            {
-                const GeospatialExtents& extents = fd->getSpatialProperties()._extents;
-                fout.indent()<<"extents "<<extents.xMin()<<" "<<extents.yMin()<<" "<<extents.xMax()<<" "<<extents.yMax()<<std::endl;
-            }
-                        
-            if (!fd->getSpatialProperties()._geoTransform.isIdentity())
+    size_t total = 0;
+    while(ok && total<buffer.size())
+    {
+        ssize_t numWritten = vpb::write(fileID, buffer.data()+total, buffer.size()-total);
+        if (numWritten<=0) ok = false;
+        else total += numWritten;
+    }
+
+    if (ok) vpb::fsync(fileID);
+    vpb::close(fileID);
+
+    if (!ok)
+    {
+        log(osg::WARN,"Error: failed to append segment to cache file '%s'.",_filename.c_str());
+        return false;
+    }
+
+    log(osg::INFO,"FileCache::sync() appended %d changes to %s",int(_pendingChanges.size()),_filename.c_str());
+
+    _pendingChanges.clear();
+    _requiresWrite = false;
+
+    return numSegments+1 <= _maximumNumSegments;
+}
+
+bool FileCache::sync()
+{
+    if (!_requiresWrite) return false;
+
+    if (_format==BINARY_FORMAT && !_requiresRewrite && osgDB::fileExists(_filename))
+    {
+        if (appendBinarySegment()) return true;
+
+        // too many segments, or the append failed, so rewrite the cache as a single segment.
+        return compact();
+    }
+
+    return write(_filename);
+}
+
+bool FileCache::compact()
+{
+    if (_format!=BINARY_FORMAT || _filename.empty()) return false;
+
+    log(osg::NOTICE,"FileCache::compact(%s)",_filename.c_str());
+
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    ScopedFileLock fileLock(_filename);
+
+    if (!_requiresRewrite && osgDB::fileExists(_filename))
+    {
+        // rebuild from the current file contents, which may include segments appended by other processes,
+        // then replay the changes made in memory that have yet to be written.
+        osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+        std::vector<const char*> segmentHeaders;
+        size_t validEnd = 0;
+        if (mappedFile->open(_filename) && scan(mappedFile->data(), mappedFile->size(), segmentHeaders, validEnd))
+        {
+            _variantMap.clear();
+            _variantIndexMap.clear();
+            _fileDetailsMap.clear();
+            releaseBinary();
+
+            assignSegments(mappedFile.get(), segmentHeaders);
+
+            resolveAll();
+
+            for(PendingChanges::iterator itr = _pendingChanges.begin();
+                itr != _pendingChanges.end();
+                ++itr)
             {
-                const osg::Matrixd& m = fd->getSpatialProperties()._geoTransform;
-                fout.indent()<<"geoTransform "<<m(0,0)<<" "<<m(0,1)<<" "<<m(1,0)<<" "<<m(1,1)<<" "<<m(3,0)<<" "<<m(3,1)<<std::endl;
+                if (itr->removed) eraseFileDetails(itr->fd.get());
+                else insertFileDetails(itr->fd.get());
             }
-            
-            if (fd->getSpatialProperties()._numValuesX>0 || fd->getSpatialProperties()._numValuesY>0 || fd->getSpatialProperties()._numValuesZ>0)
+        }
+    }
+
+    resolveAll();
+
+    Variants details;
+    for(VariantMap::iterator itr = _variantMap.begin();
+        itr != _variantMap.end();
+        ++itr)
+    {
+        details.insert(details.end(), itr->second.begin(), itr->second.end());
+    }
+    std::vector<uint32_t> flags(details.size(), 0);
+
+    std::string buffer;
+    writeHeader(buffer);
+    writeSegment(buffer, details, flags);
+
+    if (!writeFileAtomically(_filename, buffer)) return false;
+
+    _requiresWrite = false;
+    _requiresRewrite = false;
+    _pendingChanges.clear();
+
+    releaseBinary();
+
+    return true;
+}
+
+void FileCache::assignSegments(MappedFile* mappedFile, const std::vector<const char*>& segmentHeaders)
+{
+    _mappedFile = mappedFile;
+
+    for(std::vector<const char*>::const_iterator itr = segmentHeaders.begin();
+        itr != segmentHeaders.end();
+        ++itr)
+    {
+        const char* header = *itr;
+
+        Segment segment;
+        segment.numRecords = getValue<uint32_t>(header+4);
+        segment.originalIndex = header + s_segmentHeaderSize;
+        segment.fileIndex = segment.originalIndex + segment.numRecords*s_indexEntrySize;
+        segment.records = segment.fileIndex + segment.numRecords*s_indexEntrySize;
+        segment.recordsSize = getValue<uint64_t>(header+8) - segment.numRecords*2*s_indexEntrySize;
+        _segments.push_back(segment);
+    }
+}
+
+void FileCache::releaseBinary()
+{
+    _segments.clear();
+    _mappedFile = 0;
+    _resolvedOriginals.clear();
+    _allResolved = false;
+}
+
+void FileCache::resolveOriginal(const std::string& originalFileName)
+{
+    if (_segments.empty() || _allResolved) return;
+    if (!_resolvedOriginals.insert(originalFileName).second) return;
+
+    FileCacheRecordDecoder decoder(_coordinateSystemMap);
+
+    uint64_t key = hashBytes(originalFileName);
+    for(Segments::iterator sitr = _segments.begin();
+        sitr != _segments.end();
+        ++sitr)
+    {
+        const Segment& segment = *sitr;
+        for(unsigned int i = lowerBound(segment.originalIndex, segment.numRecords, key);
+            i<segment.numRecords && indexHash(segment.originalIndex, i)==key;
+            ++i)
+        {
+            bool removed = false;
+            osg::ref_ptr<FileDetails> fd = decoder.decode(segment.records, segment.recordsSize, indexOffset(segment.originalIndex, i), removed);
+            if (!fd || fd->getOriginalSourceFileName()!=originalFileName) continue;
+
+            if (removed) eraseFileDetails(fd.get());
+            else insertFileDetails(fd.get());
+        }
+    }
+}
+
+void FileCache::resolveFile(const std::string& filename)
+{
+    if (_segments.empty() || _allResolved) return;
+
+    FileCacheRecordDecoder decoder(_coordinateSystemMap);
+
+    uint64_t key = hashBytes(filename);
+    std::string original;
+    for(Segments::iterator sitr = _segments.begin();
+        sitr != _segments.end();
+        ++sitr)
+    {
+        const Segment& segment = *sitr;
+        for(unsigned int i = lowerBound(segment.fileIndex, segment.numRecords, key);
+            i<segment.numRecords && indexHash(segment.fileIndex, i)==key;
+            ++i)
+        {
+            if (decoder.decodeOriginal(segment.records, segment.recordsSize, indexOffset(segment.fileIndex, i), original))
             {
-                fout.indent()<<"size "<<fd->getSpatialProperties()._numValuesX<<" "<<fd->getSpatialProperties()._numValuesY<<" "<<fd->getSpatialProperties()._numValuesZ<<std::endl;
+                resolveOriginal(original);
             }
-            
-            fout.moveOut();
-            fout.indent()<<"}"<<std::endl;
-            
-            
         }
     }
-
-    return false;
 }
 
-void FileCache::addFileDetails(FileDetails* fd)
+void FileCache::resolveAll()
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+    if (_segments.empty() || _allResolved) return;
 
-    _requiresWrite = true;
-    
+    FileCacheRecordDecoder decoder(_coordinateSystemMap);
+
+    std::string original;
+    for(Segments::iterator sitr = _segments.begin();
+        sitr != _segments.end();
+        ++sitr)
+    {
+        const Segment& segment = *sitr;
+        for(unsigned int i = 0; i<segment.numRecords; ++i)
+        {
+            uint64_t offset = indexOffset(segment.originalIndex, i);
+
+            // originals already resolved are up to date, and may have in memory changes on top.
+            if (!decoder.decodeOriginal(segment.records, segment.recordsSize, offset, original) ||
+                _resolvedOriginals.count(original)!=0) continue;
+
+            bool removed = false;
+            osg::ref_ptr<FileDetails> fd = decoder.decode(segment.records, segment.recordsSize, offset, removed);
+            if (!fd) continue;
+
+            if (removed) eraseFileDetails(fd.get());
+            else insertFileDetails(fd.get());
+        }
+    }
+
+    _allResolved = true;
+}
+
+void FileCache::insertFileDetails(FileDetails* fd)
+{
     _fileDetailsMap[fd->getFileName()] = fd;
-    
+
     Variants& variants = _variantMap[fd->getOriginalSourceFileName()];
     for(Variants::iterator vitr = variants.begin();
         vitr != variants.end();
@@ -266,20 +950,19 @@ void FileCache::addFileDetails(FileDetails* fd)
             return;
         }
     }
-    
+
     log(osg::INFO,"FileCache::addFileDetails(%s) added",fd->getFileName().c_str());
 
     variants.push_back(fd);
+
+    updateVariantIndex(fd->getOriginalSourceFileName());
 }
 
-void FileCache::removeFileDetails(FileDetails* fd)
+void FileCache::eraseFileDetails(FileDetails* fd)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
-
-    _requiresWrite = true;
-
     FileDetailsMap::iterator fdItr = _fileDetailsMap.find(fd->getFileName());
-    if (fdItr != _fileDetailsMap.end())
+    if (fdItr != _fileDetailsMap.end() &&
+        (fdItr->second==fd || fdItr->second->getHostName()==fd->getHostName()))
     {
         _fileDetailsMap.erase(fdItr);
     }
@@ -292,68 +975,166 @@ void FileCache::removeFileDetails(FileDetails* fd)
         vitr != variants.end();
         ++vitr)
     {
-        if (*vitr == fd)
+        if (*vitr == fd ||
+            ((*vitr)->getFileName()==fd->getFileName() && (*vitr)->getHostName()==fd->getHostName()))
         {
             variants.erase(vitr);
+            updateVariantIndex(fd->getOriginalSourceFileName());
             return;
         }
     }
-    
 }
 
-bool FileCache::getSpatialProperties(const std::string& filename, SpatialProperties& sp)
+void FileCache::addFileDetails(FileDetails* fd)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
 
-    FileDetailsMap::iterator itr = _fileDetailsMap.find(filename);
-    if (itr != _fileDetailsMap.end())
+    _requiresWrite = true;
+
+    resolveOriginal(fd->getOriginalSourceFileName());
+
+    insertFileDetails(fd);
+
+    _pendingChanges.push_back(PendingChange(fd, false));
+}
+
+void FileCache::removeFileDetails(FileDetails* fd)
+{
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    _requiresWrite = true;
+
+    resolveOriginal(fd->getOriginalSourceFileName());
+
+    eraseFileDetails(fd);
+
+    _pendingChanges.push_back(PendingChange(fd, true));
+}
+
+unsigned int FileCache::getCoordinateSystemID(const osg::CoordinateSystemNode* csn)
+{
+    if (!csn) return 0;
+
+    const std::string& wkt = csn->getCoordinateSystem();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_coordinateSystemIDMutex);
+
+    CoordinateSystemIDMap::iterator itr = _coordinateSystemIDMap.find(wkt);
+    if (itr != _coordinateSystemIDMap.end()) return itr->second;
+
+    // a new WKT string may still describe one of the coordinate systems already seen, so compare it with the first string of each.
+    unsigned int id = 0;
+    for(unsigned int i=0; i<_coordinateSystemList.size(); ++i)
     {
-        sp = itr->second->getSpatialProperties();
-        return true;
+        osg::ref_ptr<osg::CoordinateSystemNode> existing = new osg::CoordinateSystemNode(csn->getFormat(), _coordinateSystemList[i]);
+        if (areCoordinateSystemEquivalent(existing.get(), csn))
+        {
+            id = i+1;
+            break;
+        }
     }
-    else
+
+    if (id==0)
     {
-        return false;
+        _coordinateSystemList.push_back(wkt);
+        id = _coordinateSystemList.size();
     }
+
+    _coordinateSystemIDMap[wkt] = id;
+    return id;
 }
 
-std::string FileCache::getOptimimumFile(const std::string& filename, const osg::CoordinateSystemNode* csn)
+void FileCache::requireResolvedOriginal(const std::string& originalFileName)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+    {
+        OpenThreads::ScopedReadLock lock(_variantMapMutex);
+        if (isResolved(originalFileName)) return;
+    }
+
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+    resolveOriginal(originalFileName);
+}
 
-    VariantMap::iterator itr = _variantMap.find(filename);
-    if (itr==_variantMap.end())
+void FileCache::updateVariantIndex(const std::string& originalFileName)
+{
+    VariantMap::iterator itr = _variantMap.find(originalFileName);
+    if (itr==_variantMap.end() || itr->second.empty())
     {
-        log(osg::NOTICE,"FileCache::getOptimimumFile(%s) no variants found returning '%s'",filename.c_str(),filename.c_str());
-        return filename;
+        _variantIndexMap.erase(originalFileName);
+        return;
     }
-    
-    Variants& variants = itr->second;
 
-    FileDetails* fd_closest = 0;
-    double res_closest = DBL_MAX;
-    
+    VariantIndex& index = _variantIndexMap[originalFileName];
+    index.clear();
 
-    // first check cached files on
-    std::string hostname = getLocalHostName();
+    Variants& variants = itr->second;
     for(Variants::iterator vitr = variants.begin();
         vitr != variants.end();
         ++vitr)
     {
         FileDetails* fd = vitr->get();
         const SpatialProperties& fd_sp = fd->getSpatialProperties();
-        if (vpb::areCoordinateSystemEquivalent(fd_sp._cs.get(), csn))
+
+        // variants without a usable resolution can never be selected, so leave them out of the index.
+        double resolution = fd_sp.computeResolution();
+        if (resolution!=resolution) continue;
+
+        index.push_back(VariantIndexEntry(getCoordinateSystemID(fd_sp._cs.get()), resolution, fd->getHostName()==_localHostName, fd));
+    }
+
+    std::sort(index.begin(), index.end());
+}
+
+bool FileCache::getSpatialProperties(const std::string& filename, SpatialProperties& sp)
+{
+    {
+        OpenThreads::ScopedReadLock lock(_variantMapMutex);
+
+        FileDetailsMap::iterator itr = _fileDetailsMap.find(filename);
+        if (itr != _fileDetailsMap.end())
         {
-            double res = fd_sp.computeResolution();
-            if (res<res_closest || (res==res_closest && fd->getHostName()==hostname))
-            {
-                fd_closest = fd;
-                res_closest = res;
-            }
+            sp = itr->second->getSpatialProperties();
+            return true;
         }
+
+        if (_segments.empty() || _allResolved) return false;
     }
-    
-    if (fd_closest) return fd_closest->getFileName();
+
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    resolveFile(filename);
+
+    FileDetailsMap::iterator itr = _fileDetailsMap.find(filename);
+    if (itr != _fileDetailsMap.end())
+    {
+        sp = itr->second->getSpatialProperties();
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+std::string FileCache::getOptimimumFile(const std::string& filename, const osg::CoordinateSystemNode* csn)
+{
+    unsigned int csID = getCoordinateSystemID(csn);
+
+    requireResolvedOriginal(filename);
+
+    OpenThreads::ScopedReadLock lock(_variantMapMutex);
+
+    VariantIndexMap::const_iterator itr = _variantIndexMap.find(filename);
+    if (itr==_variantIndexMap.end())
+    {
+        log(osg::NOTICE,"FileCache::getOptimimumFile(%s) no variants found returning '%s'",filename.c_str(),filename.c_str());
+        return filename;
+    }
+
+    // entries are sorted by resolution with local files first, so the first entry with matching coordinate system is the closest.
+    const VariantIndex& index = itr->second;
+    VariantIndex::const_iterator first = std::lower_bound(index.begin(), index.end(), VariantIndexEntry(csID, -DBL_MAX, true));
+    if (first != index.end() && first->csID==csID) return first->fd->getFileName();
 
     // osg::notify(osg::NOTICE)<<"FileCache::getOptimimumFile("<<filename<<") no suitable variants found returning ''"<<std::endl;
     return std::string();
@@ -361,89 +1142,69 @@ std::string FileCache::getOptimimumFile(const std::string& filename, const osg::
 
 std::string FileCache::getOptimimumFile(const std::string& filename, const SpatialProperties& sp)
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
-    
     osg::NotifySeverity level = osg::INFO;
 
-    VariantMap::iterator itr = _variantMap.find(filename);
-    if (itr==_variantMap.end())
+    unsigned int csID = getCoordinateSystemID(sp._cs.get());
+
+    requireResolvedOriginal(filename);
+
+    OpenThreads::ScopedReadLock lock(_variantMapMutex);
+
+    VariantIndexMap::const_iterator itr = _variantIndexMap.find(filename);
+    if (itr==_variantIndexMap.end())
     {
         log(level,"FileCache::getOptimimumFile(%s) no variants found returning '%s'",filename.c_str(),filename.c_str());
         return filename;
     }
-    
-    Variants& variants = itr->second;
 
-    FileDetails* fd_closest_below = 0;
-    double res_closest_below = -DBL_MAX;
-    
-    FileDetails* fd_closest_above = 0;
-    double res_closest_above = DBL_MAX;
-    
-    // first check cached files on
-    std::string hostname = getLocalHostName();
-    for(Variants::iterator vitr = variants.begin();
-        vitr != variants.end();
-        ++vitr)
+    const VariantIndex& index = itr->second;
+    VariantIndex::const_iterator first = std::lower_bound(index.begin(), index.end(), VariantIndexEntry(csID, -DBL_MAX, true));
+    VariantIndex::const_iterator last = std::lower_bound(first, index.end(), VariantIndexEntry(csID+1, -DBL_MAX, true));
+
+    // variants before split have a resolution ratio >= 1.0, those from split onwards a ratio < 1.0.
+    double resolution = sp.computeResolution();
+    VariantIndex::const_iterator split = std::upper_bound(first, last, VariantIndexEntry(csID, resolution, false));
+
+    // closest above is the coarsest variant no coarser than required, preferring local files of equal resolution.
+    const VariantIndexEntry* closest_above = 0;
+    for(VariantIndex::const_iterator vitr = split;
+        vitr != first;)
     {
-        FileDetails* fd = vitr->get();
-        const SpatialProperties& fd_sp = fd->getSpatialProperties();
-        if (fd_sp.compatible(sp))
-        {
-            double resolutionRatio = fd_sp.computeResolutionRatio(sp);
-            if (resolutionRatio < 1.0)
-            {
-                if ( resolutionRatio > res_closest_below || 
-                    (resolutionRatio==res_closest_below && fd->getHostName()==hostname))
-                {
-                    fd_closest_below = fd;
-                    res_closest_below = resolutionRatio;
-                }
-            }
-            else if (resolutionRatio>=1.0)
-            {
-                if (resolutionRatio < res_closest_above || 
-                    (resolutionRatio==res_closest_above && fd->getHostName()==hostname))
-                {
-                    fd_closest_above = fd;
-                    res_closest_above = resolutionRatio;
-                }
-            }
-        }
-        else
-        {
-#if 0
-            log(level,"  FileDetails(%s) not compatible ",fd->getFileName().c_str());
-            log(level,"  FileDetails fd(%f,\t%f,\t%f,\t%f)",fd_sp._extents.xMin(), fd_sp._extents.xMax(), fd_sp._extents.yMin(), fd_sp._extents.yMax());
-            log(level,"              sp(%f,\t%f,\t%f,\t%f)",sp._extents.xMin(), sp._extents.xMax(), sp._extents.yMin(), sp._extents.yMax());
-#endif
-        }
+        --vitr;
+        if (closest_above && vitr->resolution!=closest_above->resolution) break;
+        if (!vitr->fd->getSpatialProperties().intersects(sp)) continue;
+        if (!closest_above || (vitr->local && !closest_above->local)) closest_above = &(*vitr);
     }
-    
-    if (fd_closest_above)
+
+    if (closest_above)
     {
-        if (fd_closest_above->getHostName()==hostname)
+        if (closest_above->local)
         {
-            log(level,"FileCache::getOptimimumFile(%s) found local closest_above variant '%s'",filename.c_str(),fd_closest_above->getFileName().c_str());
+            log(level,"FileCache::getOptimimumFile(%s) found local closest_above variant '%s'",filename.c_str(),closest_above->fd->getFileName().c_str());
         }
         else
         {
-            log(level,"FileCache::getOptimimumFile(%s) found remote closest_above variant '%s'",filename.c_str(),fd_closest_above->getFileName().c_str());
+            log(level,"FileCache::getOptimimumFile(%s) found remote closest_above variant '%s'",filename.c_str(),closest_above->fd->getFileName().c_str());
         }
-        return fd_closest_above->getFileName();
+        return closest_above->fd->getFileName();
     }
-    
-    if (fd_closest_below)
+
+    // closest below is the finest variant coarser than required, local files come first for equal resolutions.
+    for(VariantIndex::const_iterator vitr = split;
+        vitr != last;
+        ++vitr)
     {
-        if (fd_closest_below->getHostName()==hostname)
+        if (!vitr->fd->getSpatialProperties().intersects(sp)) continue;
+
+        if (vitr->local)
         {
-            log(level,"FileCache::getOptimimumFile(%s) found local fd_closest_below variant '%s'",filename.c_str(),fd_closest_below->getFileName().c_str());
+            log(level,"FileCache::getOptimimumFile(%s) found local fd_closest_below variant '%s'",filename.c_str(),vitr->fd->getFileName().c_str());
         }
         else
         {
-            log(level,"FileCache::getOptimimumFile(%s) found remote fd_closest_below variant '%s'",filename.c_str(),fd_closest_below->getFileName().c_str());
+            log(level,"FileCache::getOptimimumFile(%s) found remote fd_closest_below variant '%s'",filename.c_str(),vitr->fd->getFileName().c_str());
         }
-        return fd_closest_below->getFileName();
+        return vitr->fd->getFileName();
     }
 
     log(level,"FileCache::getOptimimumFile(%s) no suitable variants found returning ''",filename.c_str());
@@ -452,11 +1213,17 @@ std::string FileCache::getOptimimumFile(const std::string& filename, const Spati
 
 void FileCache::clear()
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_variantMapMutex);
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
 
     _requiresWrite = true;
+    _requiresRewrite = true;
     
     _variantMap.clear();
+    _variantIndexMap.clear();
+    _fileDetailsMap.clear();
+    _pendingChanges.clear();
+
+    releaseBinary();
     
     log(osg::NOTICE,"FileCache::clear()");
 }
@@ -592,6 +1359,11 @@ void FileCache::buildOverviews(osgTerrain::TerrainTile* source)
     {
         Source* source = itr->get();
 
+        {
+            OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+            resolveOriginal(source->getFileName());
+        }
+
         VariantMap::iterator vmitr = _variantMap.find(source->getFileName());
         if (vmitr != _variantMap.end())
         {
@@ -669,6 +1441,11 @@ void FileCache::mirror(Machine* machine, osgTerrain::TerrainTile* source)
     {
         Source* source = itr->get();
 
+        {
+            OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+            resolveOriginal(source->getFileName());
+        }
+
         VariantMap::iterator vmitr = _variantMap.find(source->getFileName());
         if (vmitr != _variantMap.end())
         {
@@ -769,6 +1546,10 @@ bool FileCache::copyFileToMachine(FileDetails* fd, Machine* machine)
 
 void FileCache::report(std::ostream& out)
 {
+    OpenThreads::ScopedWriteLock lock(_variantMapMutex);
+
+    resolveAll();
+
     for(VariantMap::iterator itr = _variantMap.begin();
         itr != _variantMap.end();
         ++itr)
@@ -12,7 +12,14 @@
 */
 
 #include <vpb/FilePathManager>
+#include <vpb/BuildLog>
+
+#include <osg/Math>
+
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
+#include <vector>
 
 using namespace vpb;
 
@@ -46,14 +53,17 @@ osgDB::FileType FilePathManager::getFileType(const std::string& filename)
 
 bool FilePathManager::checkWritePermissionAndEnsurePathAvailability(const std::string& filename)
 {
+    std::string path = osgDB::getFilePath(filename);
+    if (path.empty()) path = ".";
+
+    // prepared paths are only modified before writing starts so don't need the lock.
+    if (!_preparedPaths.empty() && isPathPrepared(getPreparedPathName(path))) return true;
+
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
 
     FilePathPermissionMap::iterator itr = _filePathWritePermissionMap.find(filename);
     if (itr != _filePathWritePermissionMap.end()) return itr->second;
 
-    std::string path = osgDB::getFilePath(filename);
-    if (path.empty()) path = ".";
-    
     itr = _filePathWritePermissionMap.find(path);
     if (itr != _filePathWritePermissionMap.end()) return itr->second;
 
@@ -80,3 +90,147 @@ bool FilePathManager::checkWritePermissionAndEnsurePathAvailability(const std::s
     _filePathWritePermissionMap[path] = false;
     return false;
 }
+
+std::string FilePathManager::getPreparedPathName(const std::string& path)
+{
+    std::string name = vpb::simplifyFileName(path);
+    while (name.size()>1 && (name[name.size()-1]=='/' || name[name.size()-1]=='\\')) name.erase(name.size()-1);
+    if (name.empty()) name = ".";
+    return name;
+}
+
+/** Work shared between the threads creating the directories of one depth.*/
+struct CreateDirectoriesWork
+{
+    CreateDirectoriesWork(const std::vector<std::string>& in_directories):
+        directories(in_directories),
+        next(0),
+        results(in_directories.size(), 1) {}
+
+    const std::vector<std::string>&     directories;
+    OpenThreads::Mutex                  mutex;
+    unsigned int                        next;
+    std::vector<int>                    results;
+
+    void createDirectories()
+    {
+        while(true)
+        {
+            unsigned int i;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+                if (next>=directories.size()) return;
+                i = next++;
+            }
+
+            const std::string& path = directories[i];
+            osgDB::FileType type = osgDB::fileType(path);
+            if (type==osgDB::FILE_NOT_FOUND)
+            {
+                // another process may be creating the same directory so recheck on failure.
+                if (vpb::mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IRWXO)!=0) type = osgDB::fileType(path);
+                else type = osgDB::DIRECTORY;
+            }
+
+            results[i] = (type==osgDB::DIRECTORY) ? 0 : 1;
+        }
+    }
+};
+
+class CreateDirectoriesThread : public OpenThreads::Thread
+{
+    public:
+
+        CreateDirectoriesThread(CreateDirectoriesWork& work): _work(work) {}
+
+        virtual void run() { _work.createDirectories(); }
+
+    protected:
+
+        CreateDirectoriesWork& _work;
+};
+
+unsigned int FilePathManager::preparePaths(const PathSet& directories, unsigned int numThreads)
+{
+    // collect the directories and all their parents, grouped by depth, so that each depth can be
+    // created in parallel once the one above it exists.
+    typedef std::map<unsigned int, PathSet> DepthMap;
+    DepthMap depthMap;
+    for(PathSet::const_iterator itr = directories.begin();
+        itr != directories.end();
+        ++itr)
+    {
+        std::string path = getPreparedPathName(*itr);
+        if (path==".") continue;
+
+        unsigned int depth = 0;
+        for(std::string::size_type pos = 1; pos<path.size(); ++pos)
+        {
+            if (path[pos]=='/' || path[pos]=='\\')
+            {
+                // skip drive and root directories.
+                if (!(pos==2 && path[1]==':')) depthMap[depth++].insert(path.substr(0, pos));
+            }
+        }
+        depthMap[depth].insert(path);
+    }
+
+    unsigned int numFailed = 0;
+    PathSet failedPaths;
+    for(DepthMap::iterator ditr = depthMap.begin();
+        ditr != depthMap.end();
+        ++ditr)
+    {
+        std::vector<std::string> paths(ditr->second.begin(), ditr->second.end());
+        CreateDirectoriesWork work(paths);
+
+        unsigned int numThreadsForDepth = osg::minimum(numThreads, static_cast<unsigned int>(paths.size()));
+        if (numThreadsForDepth<=1)
+        {
+            work.createDirectories();
+        }
+        else
+        {
+            std::vector< CreateDirectoriesThread* > threads;
+            for(unsigned int i=0; i<numThreadsForDepth; ++i)
+            {
+                threads.push_back(new CreateDirectoriesThread(work));
+                threads.back()->startThread();
+            }
+
+            for(unsigned int i=0; i<threads.size(); ++i)
+            {
+                threads[i]->join();
+                delete threads[i];
+            }
+        }
+
+        for(unsigned int i=0; i<paths.size(); ++i)
+        {
+            if (work.results[i]!=0)
+            {
+                log(osg::WARN,"Error: could not create output directory %s",paths[i].c_str());
+                failedPaths.insert(paths[i]);
+            }
+        }
+    }
+
+    for(PathSet::const_iterator itr = directories.begin();
+        itr != directories.end();
+        ++itr)
+    {
+        std::string path = getPreparedPathName(*itr);
+        if (failedPaths.count(path)==0 && vpb::access(path.c_str(), W_OK)==0)
+        {
+            _preparedPaths.insert(path);
+        }
+        else
+        {
+            ++numFailed;
+        }
+    }
+
+    log(osg::INFO,"Prepared %u output directories, %u failed",static_cast<unsigned int>(directories.size())-numFailed,numFailed);
+
+    return numFailed;
+}
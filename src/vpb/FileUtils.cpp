@@ -3,6 +3,8 @@
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 
+#include <sstream>
+
 #ifdef WIN32
 
     #define WIN32_LEAN_AND_MEAN 1
@@ -35,6 +37,7 @@
     off_t   vpb::lseek(int fildes, off_t offset, int whence)      { return ::_lseek(fildes, offset, whence); }
     int     vpb::lockf(int fildes, int function, off_t size)      { return 0; }
     int     vpb::ftruncate(int fildes, off_t length)              { return ::_chsize(fildes, length); }
+    int     vpb::rename(const char* oldpath, const char* newpath) { return ::MoveFileExA(oldpath, newpath, MOVEFILE_REPLACE_EXISTING) ? 0 : -1; }
     void    vpb::sync()                                           { (void) ::_flushall(); }
     int     vpb::fsync(int fd)                                    { if (fd) return ::_commit(fd); return 0; }
     int     vpb::getpid()                                         { return ::_getpid(); }
@@ -65,6 +68,7 @@
     off_t   vpb::lseek(int fildes, off_t offset, int whence)      { return ::lseek(fildes, offset, whence); }
     int     vpb::lockf(int fildes, int function, off_t size)      { return ::lockf(fildes, function, size); }
     int     vpb::ftruncate(int fildes, off_t length)              { return ::ftruncate(fildes, length); }
+    int     vpb::rename(const char* oldpath, const char* newpath) { return ::rename(oldpath, newpath); }
     void    vpb::sync()                                           { ::sync(); }
     int     vpb::fsync(int fildes)                                { return ::fsync(fildes); }
     int     vpb::getpid()                                         { return ::getpid(); }
@@ -185,3 +189,72 @@ std::string vpb::simplifyFileName(const std::string& filename)
     return simplifiedName;
 }
 
+bool vpb::writeFileAtomically(const std::string& filename, const std::string& data)
+{
+    std::ostringstream str;
+    str<<filename<<".tmp."<<vpb::getpid();
+    std::string tmpFileName = str.str();
+
+    FILE* fp = vpb::fopen(tmpFileName.c_str(), "wb");
+    if (!fp)
+    {
+        log(osg::WARN,"Error: unable to open temporary file '%s' for writing.",tmpFileName.c_str());
+        return false;
+    }
+
+    bool ok = data.empty() || fwrite(data.data(), 1, data.size(), fp)==data.size();
+    ok = (fflush(fp)==0) && ok;
+    if (ok) vpb::fsync(fileno(fp));
+    vpb::fclose(fp);
+
+    if (!ok || vpb::rename(tmpFileName.c_str(), filename.c_str())!=0)
+    {
+        log(osg::WARN,"Error: unable to write file '%s'.",filename.c_str());
+        remove(tmpFileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int vpb::syncDirectory(const std::string& path)
+{
+#ifdef WIN32
+    return 0;
+#else
+    int fd = vpb::open(path.empty() ? "." : path.c_str(), O_RDONLY);
+    if (fd<0) return -1;
+
+    int result = vpb::fsync(fd);
+    vpb::close(fd);
+    return result;
+#endif
+}
+
+vpb::ScopedFileLock::ScopedFileLock(const std::string& filename):
+    _fileID(-1),
+    _locked(false)
+{
+    std::string lockFileName = filename + ".lock";
+    if (vpb::access(lockFileName.c_str(), F_OK)!=0)
+    {
+        FILE* file = vpb::fopen(lockFileName.c_str(), "a");
+        if (file) vpb::fclose(file);
+    }
+
+    _fileID = vpb::open(lockFileName.c_str(), O_RDWR);
+    _locked = _fileID>=0 && vpb::lockf(_fileID, F_LOCK, 0)==0;
+    if (!_locked)
+    {
+        log(osg::WARN,"Warning: unable to lock '%s', concurrent writes to '%s' are not protected.",lockFileName.c_str(),filename.c_str());
+    }
+}
+
+vpb::ScopedFileLock::~ScopedFileLock()
+{
+    if (_fileID>=0)
+    {
+        if (_locked) vpb::lockf(_fileID, F_ULOCK, 0);
+        vpb::close(_fileID);
+    }
+}
@@ -0,0 +1,150 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/GridIndexCache>
+#include <vpb/VertexCacheOptimizer>
+
+#include <OpenThreads/ScopedLock>
+
+using namespace vpb;
+
+osg::ref_ptr<GridIndexCache>& GridIndexCache::instance()
+{
+    static osg::ref_ptr<GridIndexCache> s_GridIndexCache = new GridIndexCache;
+    return s_GridIndexCache;
+}
+
+GridIndexCache::GridIndexCache()
+{
+}
+
+GridIndexCache::~GridIndexCache()
+{
+}
+
+osg::DrawElements* GridIndexCache::createDrawElements(GLenum mode, const IndexList& indices)
+{
+    unsigned int maxIndex = 0;
+    for(IndexList::const_iterator itr = indices.begin();
+        itr != indices.end();
+        ++itr)
+    {
+        if (*itr>maxIndex) maxIndex = *itr;
+    }
+
+    if (maxIndex<=0xffff) return new osg::DrawElementsUShort(mode, indices.begin(), indices.end());
+    else return new osg::DrawElementsUInt(mode, indices.begin(), indices.end());
+}
+
+void GridIndexCache::computeGridTriangles(unsigned int numColumns, unsigned int numRows, IndexList& indices)
+{
+    indices.clear();
+    if (numColumns<2 || numRows<2) return;
+
+    indices.reserve(2*3*(numColumns-1)*(numRows-1));
+    for(unsigned int r=0; r<numRows-1; ++r)
+    {
+        for(unsigned int c=0; c<numColumns-1; ++c)
+        {
+            unsigned int i00 = (r)*numColumns+c;
+            unsigned int i10 = (r)*numColumns+c+1;
+            unsigned int i01 = (r+1)*numColumns+c;
+            unsigned int i11 = (r+1)*numColumns+c+1;
+
+            indices.push_back(i01);
+            indices.push_back(i00);
+            indices.push_back(i10);
+
+            indices.push_back(i01);
+            indices.push_back(i10);
+            indices.push_back(i11);
+        }
+    }
+}
+
+void GridIndexCache::computeSkirt(unsigned int numColumns, unsigned int numRows, IndexList& indices)
+{
+    indices.clear();
+    if (numColumns<2 || numRows<2) return;
+
+    unsigned int firstSkirtVertexIndex = numColumns*numRows;
+    unsigned int vi = firstSkirtVertexIndex;
+    indices.reserve(2*(numColumns*2 + numRows*2 - 4)+2);
+
+    // bottom
+    for(unsigned int c=0; c<numColumns-1; ++c)
+    {
+        indices.push_back(c);
+        indices.push_back(vi++);
+    }
+    // right
+    for(unsigned int r=0; r<numRows-1; ++r)
+    {
+        indices.push_back(r*numColumns+numColumns-1);
+        indices.push_back(vi++);
+    }
+    // top
+    for(unsigned int c=numColumns-1; c>0; --c)
+    {
+        indices.push_back((numRows-1)*numColumns+c);
+        indices.push_back(vi++);
+    }
+    // left
+    for(unsigned int r=numRows-1; r>0; --r)
+    {
+        indices.push_back(r*numColumns);
+        indices.push_back(vi++);
+    }
+
+    indices.push_back(0);
+    indices.push_back(firstSkirtVertexIndex);
+}
+
+osg::DrawElements* GridIndexCache::getGridTriangles(unsigned int numColumns, unsigned int numRows, bool optimizeVertexCache)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    DrawElementsMap& drawElementsMap = optimizeVertexCache ? _optimizedGridTriangles : _gridTriangles;
+    osg::ref_ptr<osg::DrawElements>& drawElements = drawElementsMap[GridSize(numColumns, numRows)];
+    if (!drawElements)
+    {
+        IndexList indices;
+        computeGridTriangles(numColumns, numRows, indices);
+        if (optimizeVertexCache) VertexCacheOptimizer().optimizeTriangleOrder(indices, numColumns*numRows);
+        drawElements = createDrawElements(GL_TRIANGLES, indices);
+    }
+    return drawElements.get();
+}
+
+osg::DrawElements* GridIndexCache::getSkirt(unsigned int numColumns, unsigned int numRows)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    osg::ref_ptr<osg::DrawElements>& drawElements = _skirts[GridSize(numColumns, numRows)];
+    if (!drawElements)
+    {
+        IndexList indices;
+        computeSkirt(numColumns, numRows, indices);
+        drawElements = createDrawElements(GL_QUAD_STRIP, indices);
+    }
+    return drawElements.get();
+}
+
+void GridIndexCache::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _gridTriangles.clear();
+    _optimizedGridTriangles.clear();
+    _skirts.clear();
+}
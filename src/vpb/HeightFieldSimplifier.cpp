@@ -0,0 +1,202 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/HeightFieldSimplifier>
+
+#include <osg/Math>
+#include <osg/Vec3d>
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+using namespace vpb;
+
+HeightFieldSimplifier::HeightFieldSimplifier(double maximumError):
+    _maximumError(maximumError),
+    _numColumns(0),
+    _numRows(0),
+    _vertices(0),
+    _squareSize(1),
+    _numSquareColumns(0),
+    _numSquareRows(0),
+    _numErrorColumns(0),
+    _numErrorRows(0)
+{
+}
+
+bool HeightFieldSimplifier::simplify(unsigned int numColumns, unsigned int numRows, const osg::Vec3Array& vertices, IndexList& triangles)
+{
+    triangles.clear();
+
+    if (numColumns<2 || numRows<2 || vertices.size()<numColumns*numRows) return false;
+
+    _numColumns = numColumns;
+    _numRows = numRows;
+    _vertices = &vertices;
+
+    // cover the grid with squares no wider than its narrowest side so the squares add at most three times
+    // the grid's area beyond its edges.
+    unsigned int minimumSize = osg::minimum(numColumns, numRows)-1;
+    _squareSize = 1;
+    while(_squareSize*2<=minimumSize) _squareSize *= 2;
+
+    _numSquareColumns = (numColumns-2)/_squareSize + 1;
+    _numSquareRows = (numRows-2)/_squareSize + 1;
+    _numErrorColumns = _numSquareColumns*_squareSize + 1;
+    _numErrorRows = _numSquareRows*_squareSize + 1;
+
+    computeErrors();
+
+    // split each square along the diagonal from its bottom left corner and refine the two triangles.
+    for(unsigned int j=0; j<_numSquareRows; ++j)
+    {
+        for(unsigned int i=0; i<_numSquareColumns; ++i)
+        {
+            int c0 = i*_squareSize;
+            int r0 = j*_squareSize;
+            int c1 = c0+_squareSize;
+            int r1 = r0+_squareSize;
+            addTriangles(c0, r0, c1, r1, c1, r0, triangles);
+            addTriangles(c1, r1, c0, r0, c0, r1, triangles);
+        }
+    }
+
+    _vertices = 0;
+    _errors.clear();
+
+    return true;
+}
+
+void HeightFieldSimplifier::computeErrors()
+{
+    _errors.assign(_numErrorColumns*_numErrorRows, 0.0);
+
+    // walk up the bintree a level at a time, a triangle's bound needs the final bounds of its children's
+    // midpoints, which are only complete once both triangles sharing each child's hypotenuse are done.
+    for(unsigned int size=2; size<=_squareSize; size*=2)
+    {
+        int half = size/2;
+        int quarter = size/4;
+
+        // midpoints of square edges of this size, their triangles have the centres of the two adjacent squares as
+        // apexes and the centres of the four half size squares around the midpoint as child midpoints.
+        int edgeChildOffsets[8] = { -quarter, -quarter, quarter, -quarter, quarter, quarter, -quarter, quarter };
+        unsigned int numEdgeChildren = quarter>0 ? 4 : 0;
+
+        for(unsigned int r=0; r<_numErrorRows; r+=size)
+        {
+            for(unsigned int c=half; c<_numErrorColumns; c+=size)
+            {
+                computeMidpointError(c, r, c-half, r, c+half, r, edgeChildOffsets, numEdgeChildren);
+            }
+        }
+
+        for(unsigned int r=half; r<_numErrorRows; r+=size)
+        {
+            for(unsigned int c=0; c<_numErrorColumns; c+=size)
+            {
+                computeMidpointError(c, r, c, r-half, c, r+half, edgeChildOffsets, numEdgeChildren);
+            }
+        }
+
+        // centres of squares of this size, their triangles share the square's diagonal and have the midpoints of
+        // the square's edges as child midpoints.  Below the top level each square's diagonal runs through the
+        // centre of the square it is a quadrant of.
+        int centerChildOffsets[8] = { 0, -half, half, 0, 0, half, -half, 0 };
+
+        for(unsigned int r=half; r<_numErrorRows; r+=size)
+        {
+            for(unsigned int c=half; c<_numErrorColumns; c+=size)
+            {
+                unsigned int c0 = c-half;
+                unsigned int r0 = r-half;
+                bool diagonalFromBottomLeft = size==_squareSize || ((c0/size)%2)==((r0/size)%2);
+                if (diagonalFromBottomLeft) computeMidpointError(c, r, c0, r0, c+half, r+half, centerChildOffsets, 4);
+                else computeMidpointError(c, r, c+half, r0, c0, r+half, centerChildOffsets, 4);
+            }
+        }
+    }
+}
+
+void HeightFieldSimplifier::computeMidpointError(unsigned int mc, unsigned int mr, unsigned int ac, unsigned int ar, unsigned int bc, unsigned int br,
+                                                 const int* childOffsets, unsigned int numChildren)
+{
+    // the children's interpolation differs from the triangle's by at most the midpoint's distance from the
+    // hypotenuse, so adding it to the children's bounds bounds the triangle's error over all the grid
+    // vertices it covers.
+    double childError = 0.0;
+    for(unsigned int i=0; i<numChildren; ++i)
+    {
+        int c = int(mc)+childOffsets[i*2];
+        int r = int(mr)+childOffsets[i*2+1];
+        if (c>=0 && r>=0 && c<int(_numErrorColumns) && r<int(_numErrorRows))
+        {
+            childError = osg::maximum(childError, _errors[errorIndex(c,r)]);
+        }
+    }
+
+    double error;
+    if (!inside(mc, mr))
+    {
+        // beyond the grid, only pass on the bounds of the children so triangles straddling the grid's edges split.
+        error = childError;
+    }
+    else if (mc==0 || mr==0 || mc==_numColumns-1 || mr==_numRows-1 || !inside(ac, ar) || !inside(bc, br))
+    {
+        // keep all the vertices on the edges of the grid.
+        error = DBL_MAX;
+    }
+    else
+    {
+        osg::Vec3d interpolated = (osg::Vec3d(vertex(ac, ar)) + osg::Vec3d(vertex(bc, br)))*0.5;
+        error = osg::minimum((osg::Vec3d(vertex(mc, mr)) - interpolated).length() + childError, DBL_MAX);
+    }
+
+    double& midpointError = _errors[errorIndex(mc, mr)];
+    midpointError = osg::maximum(midpointError, error);
+}
+
+void HeightFieldSimplifier::addTriangles(int ac, int ar, int bc, int br, int cc, int cr, IndexList& triangles) const
+{
+    // a hypotenuse longer than a cell diagonal has a midpoint, split there if the triangle's bound is too large,
+    // the triangle across the hypotenuse shares the midpoint's bound so splits too.
+    int dc = bc-ac;
+    int dr = br-ar;
+    if ((dc%2)==0 && (dr%2)==0)
+    {
+        int mc = ac+dc/2;
+        int mr = ar+dr/2;
+        if (_errors[errorIndex(mc, mr)]>_maximumError)
+        {
+            addTriangles(ac, ar, cc, cr, mc, mr, triangles);
+            addTriangles(cc, cr, bc, br, mc, mr, triangles);
+            return;
+        }
+    }
+
+    // triangles straddling the grid's edges always split, so any with a corner beyond the grid lie outside it.
+    if (!inside(ac, ar) || !inside(bc, br) || !inside(cc, cr)) return;
+
+    triangles.push_back(index(ac, ar));
+    if (dc*(cr-ar) - dr*(cc-ac) > 0)
+    {
+        triangles.push_back(index(bc, br));
+        triangles.push_back(index(cc, cr));
+    }
+    else
+    {
+        triangles.push_back(index(cc, cr));
+        triangles.push_back(index(bc, br));
+    }
+}
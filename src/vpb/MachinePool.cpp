@@ -71,6 +71,9 @@ void MachineOperation::operator () (osg::Object* object)
             if (!_task->getProperty("duration",duration))
             {
                 duration = osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+
+                // keep the duration with the task so that later builds can be planned from it, see vpbsizes.
+                _task->setProperty("duration",duration);
             }
 
             if (result==0)
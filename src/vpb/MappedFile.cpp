@@ -0,0 +1,135 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/MappedFile>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#ifndef WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+#endif
+
+using namespace vpb;
+
+MappedFile::MappedFile():
+    _data(0),
+    _size(0),
+    _mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+
+    _filename = filename;
+
+#ifndef WIN32
+    int fd = vpb::open(filename.c_str(), O_RDONLY);
+    if (fd<0) return false;
+
+    struct stat buf;
+    if (fstat(fd, &buf)!=0)
+    {
+        vpb::close(fd);
+        return false;
+    }
+
+    _size = buf.st_size;
+
+    if (_size==0)
+    {
+        // nothing to map, use an empty buffer so that valid() still reports success.
+        vpb::close(fd);
+        _buffer.resize(1);
+        _data = &_buffer.front();
+        return true;
+    }
+
+    void* ptr = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr!=MAP_FAILED)
+    {
+        vpb::close(fd);
+        _data = static_cast<const char*>(ptr);
+        _mapped = true;
+        return true;
+    }
+
+    log(osg::INFO,"MappedFile::open(%s) mmap failed, falling back to read.",filename.c_str());
+
+    _buffer.resize(_size);
+    size_t total = 0;
+    while(total<_size)
+    {
+        ssize_t numRead = vpb::read(fd, &_buffer[total], _size-total);
+        if (numRead<=0) break;
+        total += numRead;
+    }
+    vpb::close(fd);
+
+    if (total!=_size)
+    {
+        log(osg::WARN,"MappedFile::open(%s) unable to read whole file.",filename.c_str());
+        _buffer.clear();
+        _size = 0;
+        return false;
+    }
+
+    _data = &_buffer.front();
+    return true;
+#else
+    FILE* fp = vpb::fopen(filename.c_str(), "rb");
+    if (!fp) return false;
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    _size = length>0 ? length : 0;
+    _buffer.resize(_size+1);
+    size_t total = _size>0 ? fread(&_buffer.front(), 1, _size, fp) : 0;
+    vpb::fclose(fp);
+
+    if (total!=_size)
+    {
+        log(osg::WARN,"MappedFile::open(%s) unable to read whole file.",filename.c_str());
+        _buffer.clear();
+        _size = 0;
+        return false;
+    }
+
+    _data = &_buffer.front();
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifndef WIN32
+    if (_mapped && _data)
+    {
+        munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+    _data = 0;
+    _size = 0;
+    _mapped = false;
+    _buffer.clear();
+}
@@ -0,0 +1,257 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/MemoryTracker>
+#include <vpb/Task>
+
+#include <OpenThreads/ScopedLock>
+
+#include <iomanip>
+
+using namespace vpb;
+
+static const double s_megabyte = 1024.0*1024.0;
+
+MemoryTracker::Stage::Stage():
+    numActive(0),
+    peakTotal(0.0),
+    totalTime(0.0)
+{
+    for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i) peak[i] = 0.0;
+}
+
+MemoryTracker::MemoryTracker():
+    _currentTotal(0.0),
+    _maximumMemory(0.0),
+    _numActiveReads(0),
+    _numThrottledReads(0)
+{
+    for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i) _current[i] = 0.0;
+}
+
+MemoryTracker::~MemoryTracker()
+{
+}
+
+MemoryTracker* MemoryTracker::instance()
+{
+    static osg::ref_ptr<MemoryTracker> s_memoryTracker = new MemoryTracker;
+    return s_memoryTracker.get();
+}
+
+const char* MemoryTracker::getCategoryName(Category category)
+{
+    switch(category)
+    {
+        case(DESTINATION_IMAGES): return "destination images";
+        case(DESTINATION_HEIGHTFIELDS): return "destination height fields";
+        case(SOURCE_BUFFERS): return "source buffers";
+        case(WRITE_QUEUE): return "write queue";
+        default: return "unknown";
+    }
+}
+
+void MemoryTracker::updatePeaks(Stage& stage)
+{
+    for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i)
+    {
+        if (_current[i]>stage.peak[i]) stage.peak[i] = _current[i];
+    }
+    if (_currentTotal>stage.peakTotal) stage.peakTotal = _currentTotal;
+}
+
+void MemoryTracker::allocated(Category category, double bytes)
+{
+    if (bytes<=0.0) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _current[category] += bytes;
+    _currentTotal += bytes;
+
+    updatePeaks(_overall);
+    for(Stages::iterator itr = _stages.begin(); itr != _stages.end(); ++itr)
+    {
+        if (itr->second.numActive>0) updatePeaks(itr->second);
+    }
+}
+
+void MemoryTracker::released(Category category, double bytes)
+{
+    if (bytes<=0.0) return;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        _current[category] -= bytes;
+        _currentTotal -= bytes;
+    }
+
+    if (_maximumMemory>0.0) _memoryReleased.broadcast();
+}
+
+double MemoryTracker::getCurrent(Category category) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _current[category];
+}
+
+double MemoryTracker::getPeak(Category category) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _overall.peak[category];
+}
+
+double MemoryTracker::getCurrentTotal() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _currentTotal;
+}
+
+double MemoryTracker::getPeakTotal() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _overall.peakTotal;
+}
+
+void MemoryTracker::beginStage(const char* name)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    Stage& stage = _stages[name];
+    ++stage.numActive;
+    updatePeaks(stage);
+}
+
+void MemoryTracker::endStage(const char* name, double duration)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    Stages::iterator itr = _stages.find(name);
+    if (itr != _stages.end())
+    {
+        if (itr->second.numActive>0) --(itr->second.numActive);
+        itr->second.totalTime += duration;
+    }
+}
+
+void MemoryTracker::setMaximumMemory(double bytes)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _maximumMemory = bytes;
+    }
+
+    // wake any waiting reads so they re-check against the new budget.
+    _memoryReleased.broadcast();
+}
+
+void MemoryTracker::beginRead()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    // a read always proceeds when no others are in progress, as the memory it is waiting for may only
+    // be released once it has been read, such as when a row has to be complete before it is written.
+    if (_maximumMemory>0.0 && _currentTotal>_maximumMemory && _numActiveReads>0)
+    {
+        ++_numThrottledReads;
+        while (_maximumMemory>0.0 && _currentTotal>_maximumMemory && _numActiveReads>0)
+        {
+            _memoryReleased.wait(&_mutex);
+        }
+    }
+
+    ++_numActiveReads;
+}
+
+void MemoryTracker::endRead()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_numActiveReads>0) --_numActiveReads;
+    }
+
+    if (_maximumMemory>0.0) _memoryReleased.broadcast();
+}
+
+unsigned int MemoryTracker::getNumThrottledReads() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numThrottledReads;
+}
+
+void MemoryTracker::resetPeaks()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _overall = Stage();
+    updatePeaks(_overall);
+
+    _stages.clear();
+    _numThrottledReads = 0;
+}
+
+void MemoryTracker::report(std::ostream& out) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out.setf(std::ios::fixed, std::ios::floatfield);
+    out.precision(1);
+
+    out<<"Memory usage (MB)"<<std::endl;
+    out<<"    "<<std::setw(28)<<std::left<<"total"<<std::right<<" current "<<std::setw(10)<<_currentTotal/s_megabyte<<" peak "<<std::setw(10)<<_overall.peakTotal/s_megabyte<<std::endl;
+    for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i)
+    {
+        out<<"    "<<std::setw(28)<<std::left<<getCategoryName(Category(i))<<std::right<<" current "<<std::setw(10)<<_current[i]/s_megabyte<<" peak "<<std::setw(10)<<_overall.peak[i]/s_megabyte<<std::endl;
+    }
+
+    if (_maximumMemory>0.0)
+    {
+        out<<"    budget "<<_maximumMemory/s_megabyte<<", "<<_numThrottledReads<<" reads throttled"<<std::endl;
+    }
+
+    out<<"Peak memory usage (MB) and time by stage"<<std::endl;
+    for(Stages::const_iterator itr = _stages.begin(); itr != _stages.end(); ++itr)
+    {
+        const Stage& stage = itr->second;
+        out<<"    "<<std::setw(28)<<std::left<<itr->first<<std::right<<" total "<<std::setw(10)<<stage.peakTotal/s_megabyte<<", time "<<stage.totalTime<<"s";
+        for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i)
+        {
+            out<<", "<<getCategoryName(Category(i))<<" "<<stage.peak[i]/s_megabyte;
+        }
+        out<<std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void MemoryTracker::setTaskProperties(Task& task) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    task.setProperty("memory current MB", _currentTotal/s_megabyte);
+    task.setProperty("memory peak MB", _overall.peakTotal/s_megabyte);
+    for(unsigned int i=0; i<NUMBER_OF_CATEGORIES; ++i)
+    {
+        task.setProperty(std::string("memory peak MB ")+getCategoryName(Category(i)), _overall.peak[i]/s_megabyte);
+    }
+
+    for(Stages::const_iterator itr = _stages.begin(); itr != _stages.end(); ++itr)
+    {
+        task.setProperty(std::string("memory peak MB stage ")+itr->first, itr->second.peakTotal/s_megabyte);
+        task.setProperty(std::string("time stage ")+itr->first, itr->second.totalTime);
+    }
+}
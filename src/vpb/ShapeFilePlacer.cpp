@@ -17,6 +17,7 @@
 #include <vpb/DataSet>
 #include <vpb/HeightFieldMapper>
 #include <vpb/ExtrudeVisitor>
+#include <vpb/VertexCacheOptimizer>
 #include <vpb/System>
 
 #include <osg/NodeVisitor>
@@ -539,6 +540,11 @@ class ShapeFileOverlapingHeightFieldPlacer : public osg::NodeVisitor
                             osgUtil::SmoothingVisitor sv;
                             sv.smooth(*clonedGeom);  // this will replace the normal vector with a new one
 
+                            if (_dt._dataSet->getOptimizeVertexCache())
+                            {
+                                _vertexCacheOptimizer.optimize(*clonedGeom, _vertexCacheStatistics);
+                            }
+
                         }
                     }
                 }
@@ -569,6 +575,8 @@ class ShapeFileOverlapingHeightFieldPlacer : public osg::NodeVisitor
         }
         
         osg::Node * getCreatedModel() { return _createdModel.get(); }
+
+        const VertexCacheOptimizer::Statistics& getVertexCacheStatistics() const { return _vertexCacheStatistics; }
         
     private:
         
@@ -585,6 +593,9 @@ class ShapeFileOverlapingHeightFieldPlacer : public osg::NodeVisitor
         typedef std::list<std::string> StringStack;
         StringStack _typeAttributeNameStack;
         StringStack _heightAttributeNameStack;
+
+        VertexCacheOptimizer _vertexCacheOptimizer;
+        VertexCacheOptimizer::Statistics _vertexCacheStatistics;
 };
 
 
@@ -601,6 +612,13 @@ bool ShapeFilePlacer::place(DestinationTile& destinationTile, osg::Node* model)
     ShapeFileOverlapingHeightFieldPlacer shapePlacer(destinationTile, *hf);
     model->accept(shapePlacer);
 
+    const VertexCacheOptimizer::Statistics& statistics = shapePlacer.getVertexCacheStatistics();
+    if (statistics.numTriangles>0)
+    {
+        log(osg::INFO,"Vertex cache optimization of %d triangles, ACMR %f before, %f after",
+            statistics.numTriangles, statistics.getACMRBefore(), statistics.getACMRAfter());
+    }
+
 #if 0
     osg::Material * mat = new osg::Material;
     mat->setDiffuse(osg::Material::FRONT, osg::Vec4f(1.0f,1.0f,1.0f,1.0f));
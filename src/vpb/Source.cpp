@@ -148,6 +148,25 @@ void Source::loadSourceData()
             }
         }
 
+        SourceMetadataCache* metadataCache = System::instance()->getSourceMetadataCache();
+        if (metadataCache && isMetadataCacheable())
+        {
+            SourceMetadataCache::Entry entry;
+            if (metadataCache->getEntry(getFileName(), _dataType, entry))
+            {
+                log(osg::INFO,"Source::loadSourceData() %s assigned from SourceMetadataCache",_filename.c_str());
+
+                osg::ref_ptr<SourceData> sourceData = new SourceData(this);
+                sourceData->assignSpatialProperties(entry.spatialProperties);
+                sourceData->_hasGCPs = entry.hasGCPs;
+                _sourceData = sourceData;
+
+                assignCoordinateSystemAndGeoTransformAccordingToParameterPolicy();
+
+                return;
+            }
+        }
+
         _sourceData = SourceData::readData(this);
 
 
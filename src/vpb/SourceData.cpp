@@ -15,6 +15,7 @@
 #include <vpb/Destination>
 #include <vpb/DataSet>
 #include <vpb/System>
+#include <vpb/MemoryTracker>
 
 #include <osg/Notify>
 #include <osg/io_utils>
@@ -166,6 +167,100 @@ float SourceData::getInterpolatedValue(GDALRasterBand *band, double x, double y,
     return result;
 }
 
+bool SourceData::readSpatialProperties(GeospatialDataset* gdalDataSet, SpatialProperties& sp, bool& hasGCPs)
+{
+    if (!gdalDataSet || !gdalDataSet->getGDALDataset()) return false;
+
+    sp._numValuesX = gdalDataSet->GetRasterXSize();
+    sp._numValuesY = gdalDataSet->GetRasterYSize();
+    sp._numValuesZ = gdalDataSet->GetRasterCount();
+    hasGCPs = gdalDataSet->GetGCPCount()!=0;
+
+    const char* pszSourceSRS = gdalDataSet->GetProjectionRef();
+    if (!pszSourceSRS || strlen(pszSourceSRS)==0) pszSourceSRS = gdalDataSet->GetGCPProjection();
+    
+    sp._cs = new osg::CoordinateSystemNode("WKT",pszSourceSRS);
+
+    double geoTransform[6];
+    if (gdalDataSet->GetGeoTransform(geoTransform)==CE_None)
+    {
+#ifdef SHIFT_RASTER_BY_HALF_CELL
+        // shift the transform to the middle of the cell if a raster interpreted as vector
+        if (sp._dataType == VECTOR)
+        {
+            geoTransform[0] += 0.5 * geoTransform[1];
+            geoTransform[3] += 0.5 * geoTransform[5];
+        }
+#endif
+        sp._geoTransform.set( geoTransform[1],    geoTransform[4],    0.0,    0.0,
+                              geoTransform[2],    geoTransform[5],    0.0,    0.0,
+                              0.0,                0.0,                1.0,    0.0,
+                              geoTransform[0],    geoTransform[3],    0.0,    1.0);
+                                
+        sp.computeExtents();
+
+    }
+    else if (gdalDataSet->GetGCPCount()>0 && gdalDataSet->GetGCPProjection())
+    {
+        log(osg::INFO,"    Using GCP's");
+
+
+        /* -------------------------------------------------------------------- */
+        /*      Create a transformation object from the source to               */
+        /*      destination coordinate system.                                  */
+        /* -------------------------------------------------------------------- */
+        void *hTransformArg = 
+            GDALCreateGenImgProjTransformer( gdalDataSet->getGDALDataset(), pszSourceSRS, 
+                                             NULL, pszSourceSRS, 
+                                             TRUE, 0.0, 1 );
+
+        if ( hTransformArg == NULL )
+        {
+            log(osg::INFO," failed to create transformer");
+            return false;
+        }
+
+        /* -------------------------------------------------------------------- */
+        /*      Get approximate output definition.                              */
+        /* -------------------------------------------------------------------- */
+        double adfDstGeoTransform[6];
+        int nPixels=0, nLines=0;
+        if( GDALSuggestedWarpOutput( gdalDataSet->getGDALDataset(), 
+                                     GDALGenImgProjTransform, hTransformArg, 
+                                     adfDstGeoTransform, &nPixels, &nLines )
+            != CE_None )
+        {
+            log(osg::INFO," failed to create warp");
+            return false;
+        }
+
+        GDALDestroyGenImgProjTransformer( hTransformArg );
+
+
+        sp._geoTransform.set( adfDstGeoTransform[1],    adfDstGeoTransform[4],    0.0,    0.0,
+                              adfDstGeoTransform[2],    adfDstGeoTransform[5],    0.0,    0.0,
+                              0.0,                0.0,                1.0,    0.0,
+                              adfDstGeoTransform[0],    adfDstGeoTransform[3],    0.0,    1.0);
+
+        sp.computeExtents();
+        
+    }
+    else
+    {
+        log(osg::INFO,"    No GeoTransform or GCP's - unable to compute position in space");
+        
+        sp._geoTransform.set( 1.0,    0.0,    0.0,    0.0,
+                              0.0,    1.0,    0.0,    0.0,
+                              0.0,    0.0,    1.0,    0.0,
+                              0.0,    0.0,    0.0,    1.0);
+                                
+        sp.computeExtents();
+
+    }
+
+    return true;
+}
+
 SourceData* SourceData::readData(Source* source)
 {
     if (!source) return 0;
@@ -222,98 +317,14 @@ SourceData* SourceData::readData(Source* source)
 
             if (gdalDataSet.valid())
             {
-                SourceData* data = new SourceData(source);
+                osg::ref_ptr<SourceData> data = new SourceData(source);
 
                 // need to set vector or raster
                 data->_dataType = source->_dataType;
 
-                data->_numValuesX = gdalDataSet->GetRasterXSize();
-                data->_numValuesY = gdalDataSet->GetRasterYSize();
-                data->_numValuesZ = gdalDataSet->GetRasterCount();
-                data->_hasGCPs = gdalDataSet->GetGCPCount()!=0;
-
-                const char* pszSourceSRS = gdalDataSet->GetProjectionRef();
-                if (!pszSourceSRS || strlen(pszSourceSRS)==0) pszSourceSRS = gdalDataSet->GetGCPProjection();
-                
-                data->_cs = new osg::CoordinateSystemNode("WKT",pszSourceSRS);
+                if (!readSpatialProperties(gdalDataSet.get(), *data, data->_hasGCPs)) return 0;
 
-                double geoTransform[6];
-                if (gdalDataSet->GetGeoTransform(geoTransform)==CE_None)
-                {
-#ifdef SHIFT_RASTER_BY_HALF_CELL
-                    // shift the transform to the middle of the cell if a raster interpreted as vector
-                    if (data->_dataType == VECTOR)
-                    {
-                        geoTransform[0] += 0.5 * geoTransform[1];
-                        geoTransform[3] += 0.5 * geoTransform[5];
-                    }
-#endif
-                    data->_geoTransform.set( geoTransform[1],    geoTransform[4],    0.0,    0.0,
-                                             geoTransform[2],    geoTransform[5],    0.0,    0.0,
-                                             0.0,                0.0,                1.0,    0.0,
-                                             geoTransform[0],    geoTransform[3],    0.0,    1.0);
-                                            
-                    data->computeExtents();
-
-                }
-                else if (gdalDataSet->GetGCPCount()>0 && gdalDataSet->GetGCPProjection())
-                {
-                    log(osg::INFO,"    Using GCP's");
-
-
-                    /* -------------------------------------------------------------------- */
-                    /*      Create a transformation object from the source to               */
-                    /*      destination coordinate system.                                  */
-                    /* -------------------------------------------------------------------- */
-                    void *hTransformArg = 
-                        GDALCreateGenImgProjTransformer( gdalDataSet->getGDALDataset(), pszSourceSRS, 
-                                                         NULL, pszSourceSRS, 
-                                                         TRUE, 0.0, 1 );
-
-                    if ( hTransformArg == NULL )
-                    {
-                        log(osg::INFO," failed to create transformer");
-                        return NULL;
-                    }
-
-                    /* -------------------------------------------------------------------- */
-                    /*      Get approximate output definition.                              */
-                    /* -------------------------------------------------------------------- */
-                    double adfDstGeoTransform[6];
-                    int nPixels=0, nLines=0;
-                    if( GDALSuggestedWarpOutput( gdalDataSet->getGDALDataset(), 
-                                                 GDALGenImgProjTransform, hTransformArg, 
-                                                 adfDstGeoTransform, &nPixels, &nLines )
-                        != CE_None )
-                    {
-                        log(osg::INFO," failed to create warp");
-                        return NULL;
-                    }
-
-                    GDALDestroyGenImgProjTransformer( hTransformArg );
-
-
-                    data->_geoTransform.set( adfDstGeoTransform[1],    adfDstGeoTransform[4],    0.0,    0.0,
-                                             adfDstGeoTransform[2],    adfDstGeoTransform[5],    0.0,    0.0,
-                                             0.0,                0.0,                1.0,    0.0,
-                                             adfDstGeoTransform[0],    adfDstGeoTransform[3],    0.0,    1.0);
-
-                    data->computeExtents();
-                    
-                }
-                else
-                {
-                    log(osg::INFO,"    No GeoTransform or GCP's - unable to compute position in space");
-                    
-                    data->_geoTransform.set( 1.0,    0.0,    0.0,    0.0,
-                                             0.0,    1.0,    0.0,    0.0,
-                                             0.0,    0.0,    1.0,    0.0,
-                                             0.0,    0.0,    0.0,    1.0);
-                                            
-                    data->computeExtents();
-
-                }
-                return data;
+                return data.release();
             }
         }
     case(Source::MODEL):
@@ -538,6 +549,8 @@ void SourceData::readImage(DestinationData& destination)
                 log(osg::INFO,"reading RGB");
 
                 unsigned char* tempImage = new unsigned char[readWidth*readHeight*pixelSpace];
+                double tempImageSize = double(readWidth*readHeight*pixelSpace);
+                MemoryTracker::instance()->allocated(MemoryTracker::SOURCE_BUFFERS, tempImageSize);
 
 
                 /* New code courtesy of Frank Warmerdam of the GDAL group */
@@ -648,6 +661,8 @@ void SourceData::readImage(DestinationData& destination)
                 if (doResample || readWidth!=destWidth || readHeight!=destHeight)
                 {
                     unsigned char* destImage = new unsigned char[destWidth*destHeight*pixelSpace];
+                    double destImageSize = double(destWidth*destHeight*pixelSpace);
+                    MemoryTracker::instance()->allocated(MemoryTracker::SOURCE_BUFFERS, destImageSize);
 
                     // rescale image by hand as glu seem buggy....
                     for(int j=0;j<destHeight;++j)
@@ -786,7 +801,9 @@ void SourceData::readImage(DestinationData& destination)
                     }
 
                     delete [] tempImage;
+                    MemoryTracker::instance()->released(MemoryTracker::SOURCE_BUFFERS, tempImageSize);
                     tempImage = destImage;
+                    tempImageSize = destImageSize;
                 }
 
                 // now copy into destination image
@@ -897,6 +914,7 @@ void SourceData::readImage(DestinationData& destination)
                 }
 
                 delete [] tempImage;
+                MemoryTracker::instance()->released(MemoryTracker::SOURCE_BUFFERS, tempImageSize);
 
             }
             else
@@ -1087,6 +1105,8 @@ void SourceData::readHeightField(DestinationData& destination)
 
                     // read data into temporary array
                     float* heightData = new float [ destWidth*destHeight ];
+                    double heightDataSize = double(destWidth*destHeight)*double(sizeof(float));
+                    MemoryTracker::instance()->allocated(MemoryTracker::SOURCE_BUFFERS, heightDataSize);
 
                     //bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,floatdata,destWidth,destHeight,GDT_Float32,numBytesPerZvalue,lineSpace);
                     bandSelected->RasterIO(GF_Read,windowX,_numValuesY-(windowY+windowHeight),windowWidth,windowHeight,heightData,destWidth,destHeight,GDT_Float32,0,0);
@@ -1105,6 +1125,7 @@ void SourceData::readHeightField(DestinationData& destination)
                     }
 
                     delete [] heightData;
+                    MemoryTracker::instance()->released(MemoryTracker::SOURCE_BUFFERS, heightDataSize);
                 }
             }
         }
@@ -0,0 +1,581 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/SourceManifest>
+#include <vpb/SourceMetadataCache>
+#include <vpb/BinaryStream>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+#include <vpb/System>
+
+#include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+
+#include <osgTerrain/Layer>
+
+#include <math.h>
+#include <string.h>
+#include <sstream>
+
+using namespace vpb;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Source manifest file layout, all values are stored in native byte order:
+//
+//   header  : char magic[8] "VPBSRCMF", uint32 version, uint32 byte order tag, uint64 headSize, uint64 headChecksum
+//   head    : uint8 hasTileSystem, double extents[4], uint8 isGeographic, int32 numColumns, int32 numRows,
+//             string shell,
+//             uint32 numLayers, per layer int32 layerNum, uint32 minLevel, uint32 maxLevel,
+//                                         uint32 firstRecord, uint32 numRecords, string name
+//             uint32 numRecords, per record double extents[4], uint64 offset, uint32 size, uint64 checksum
+//   records : record payloads, addressed by offset from the end of the head
+//
+// The shell is the TerrainTile, in osg2 binary format, with each indexed composite layer
+// replaced by an empty CompositeLayer.  Records have invalid extents when their source's
+// extents aren't known, so they are never culled.
+//
+namespace SourceManifestBinary
+{
+
+const char s_magic[8] = { 'V','P','B','S','R','C','M','F' };
+const uint32_t s_version = 2;
+const uint32_t s_byteOrderTag = 0x01020304;
+
+const size_t s_headerSize = 32;
+
+enum RecordType
+{
+    COMPOUND_NAME_RECORD = 0,
+    PROXY_LAYER_RECORD = 1
+};
+
+/** Only plain CompositeLayers of compound names and ProxyLayers are indexed, anything else is left in the shell.*/
+bool isIndexable(osgTerrain::Layer* layer)
+{
+    osgTerrain::CompositeLayer* compositeLayer = dynamic_cast<osgTerrain::CompositeLayer*>(layer);
+    if (!compositeLayer || strcmp(compositeLayer->className(),"CompositeLayer")!=0) return false;
+    if (compositeLayer->getLocator() || compositeLayer->getValidDataOperator()) return false;
+
+    for(unsigned int i=0; i<compositeLayer->getNumLayers(); ++i)
+    {
+        osgTerrain::Layer* child = compositeLayer->getLayer(i);
+        if (child && (strcmp(child->className(),"ProxyLayer")!=0 || child->getValidDataOperator())) return false;
+    }
+    return true;
+}
+
+void writeExtents(BinaryWriter& w, const GeospatialExtents& extents)
+{
+    w.write(extents.xMin()); w.write(extents.yMin()); w.write(extents.xMax()); w.write(extents.yMax());
+}
+
+bool readExtents(BinaryReader& r, GeospatialExtents& extents)
+{
+    return r.read(extents.xMin()) && r.read(extents.yMin()) && r.read(extents.xMax()) && r.read(extents.yMax());
+}
+
+void writeProxyLayer(BinaryWriter& w, osgTerrain::Layer* layer)
+{
+    w.writeString(layer->getName());
+    w.writeString(layer->getFileName());
+    w.write(static_cast<uint32_t>(layer->getMinLevel()));
+    w.write(static_cast<uint32_t>(layer->getMaxLevel()));
+
+    osgTerrain::Locator* locator = layer->getLocator();
+    w.write(static_cast<uint8_t>(locator ? 1 : 0));
+    if (locator)
+    {
+        const osg::Matrixd& m = locator->getTransform();
+        w.writeString(locator->getFormat());
+        w.writeString(locator->getCoordinateSystem());
+        for(unsigned int i=0; i<16; ++i) w.write(m.ptr()[i]);
+        w.write(static_cast<uint8_t>(locator->getDefinedInFile() ? 1 : 0));
+        w.write(static_cast<uint8_t>(locator->getTransformScaledByResolution() ? 1 : 0));
+        w.write(static_cast<int32_t>(locator->getCoordinateSystemType()));
+    }
+}
+
+osgTerrain::ProxyLayer* readProxyLayer(BinaryReader& r)
+{
+    std::string name, fileName;
+    uint32_t minLevel, maxLevel;
+    uint8_t hasLocator = 0;
+    if (!r.readString(name) || !r.readString(fileName) || !r.read(minLevel) || !r.read(maxLevel) || !r.read(hasLocator)) return 0;
+
+    osg::ref_ptr<osgTerrain::ProxyLayer> layer = new osgTerrain::ProxyLayer;
+    layer->setName(name);
+    layer->setFileName(fileName);
+    layer->setMinLevel(minLevel);
+    layer->setMaxLevel(maxLevel);
+
+    if (hasLocator)
+    {
+        std::string format, cs;
+        osg::Matrixd m;
+        uint8_t definedInFile, scaledByResolution;
+        int32_t csType;
+        if (!r.readString(format) || !r.readString(cs)) return 0;
+        for(unsigned int i=0; i<16; ++i)
+        {
+            if (!r.read(m.ptr()[i])) return 0;
+        }
+        if (!r.read(definedInFile) || !r.read(scaledByResolution) || !r.read(csType)) return 0;
+
+        osgTerrain::Locator* locator = new osgTerrain::Locator;
+        locator->setFormat(format);
+        locator->setCoordinateSystem(cs);
+        locator->setTransform(m);
+        locator->setDefinedInFile(definedInFile!=0);
+        locator->setTransformScaledByResolution(scaledByResolution!=0);
+        locator->setCoordinateSystemType(static_cast<osgTerrain::Locator::CoordinateSystemType>(csType));
+        layer->setLocator(locator);
+    }
+
+    return layer.release();
+}
+
+}
+
+using namespace SourceManifestBinary;
+
+SourceManifest::SourceManifest():
+    _recordData(0),
+    _recordDataSize(0)
+{
+}
+
+SourceManifest::~SourceManifest()
+{
+}
+
+bool SourceManifest::isManifestFile(const std::string& filename)
+{
+    char magic[sizeof(s_magic)];
+    FILE* fp = vpb::fopen(filename.c_str(), "rb");
+    bool manifest = fp && fread(magic, 1, sizeof(magic), fp)==sizeof(magic) && memcmp(magic, s_magic, sizeof(magic))==0;
+    if (fp) vpb::fclose(fp);
+    return manifest;
+}
+
+bool SourceManifest::write(const std::string& filename, osgTerrain::TerrainTile* terrainTile,
+                           const TileSystem& tileSystem, const SourceExtentsMap& sourceExtents)
+{
+    if (!terrainTile) return false;
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osg2");
+    if (!rw)
+    {
+        log(osg::WARN,"Error: SourceManifest::write(%s) requires the osg2 plugin.",filename.c_str());
+        return false;
+    }
+
+    SourceMetadataCache* metadataCache = System::instance()->getSourceMetadataCache();
+
+    LayerEntries layers;
+    RecordEntries records;
+    std::string recordData;
+
+    // temporarily swap indexed layers for empty placeholders while the shell is serialized,
+    // the placeholders keep the color layer numbering of the shell intact.
+    typedef std::vector< osg::ref_ptr<osgTerrain::Layer> > Layers;
+    Layers originalLayers;
+
+    for(int layerNum=-1; layerNum<static_cast<int>(terrainTile->getNumColorLayers()); ++layerNum)
+    {
+        osgTerrain::Layer* layer = layerNum<0 ? terrainTile->getElevationLayer() : terrainTile->getColorLayer(layerNum);
+        originalLayers.push_back(layer);
+
+        if (!isIndexable(layer)) continue;
+
+        osgTerrain::CompositeLayer* compositeLayer = static_cast<osgTerrain::CompositeLayer*>(layer);
+
+        LayerEntry layerEntry;
+        layerEntry.layerNum = layerNum;
+        layerEntry.minLevel = compositeLayer->getMinLevel();
+        layerEntry.maxLevel = compositeLayer->getMaxLevel();
+        layerEntry.firstRecord = records.size();
+        layerEntry.numRecords = compositeLayer->getNumLayers();
+        layerEntry.name = compositeLayer->getName();
+        layers.push_back(layerEntry);
+
+        for(unsigned int i=0; i<compositeLayer->getNumLayers(); ++i)
+        {
+            std::string payload;
+            BinaryWriter w(payload);
+
+            osgTerrain::Layer* child = compositeLayer->getLayer(i);
+            std::string fileName = child ? child->getFileName() : compositeLayer->getFileName(i);
+            if (child)
+            {
+                w.write(static_cast<uint8_t>(PROXY_LAYER_RECORD));
+                writeProxyLayer(w, child);
+            }
+            else
+            {
+                w.write(static_cast<uint8_t>(COMPOUND_NAME_RECORD));
+                w.writeString(compositeLayer->getSetName(i));
+                w.writeString(fileName);
+            }
+
+            SourceMetadataCache::Entry entry;
+            bool hasMetadata = metadataCache && metadataCache->getEntry(fileName, SpatialProperties::RASTER, entry);
+            w.write(static_cast<uint8_t>(hasMetadata ? 1 : 0));
+            if (hasMetadata) SourceMetadataCache::writeEntry(w, entry);
+
+            RecordEntry record;
+            SourceExtentsMap::const_iterator eitr = sourceExtents.find(fileName);
+            if (tileSystem.valid() && eitr!=sourceExtents.end()) record.extents = eitr->second;
+            record.offset = recordData.size();
+            record.size = payload.size();
+            record.checksum = hashBytes(payload);
+            records.push_back(record);
+
+            recordData.append(payload);
+        }
+
+        if (layerNum<0) terrainTile->setElevationLayer(new osgTerrain::CompositeLayer);
+        else terrainTile->setColorLayer(layerNum, new osgTerrain::CompositeLayer);
+    }
+
+    std::stringstream shell;
+    osgDB::ReaderWriter::WriteResult result = rw->writeNode(*terrainTile, shell);
+
+    for(int layerNum=-1; layerNum<static_cast<int>(terrainTile->getNumColorLayers()); ++layerNum)
+    {
+        osgTerrain::Layer* layer = originalLayers[layerNum+1].get();
+        if (layerNum<0) terrainTile->setElevationLayer(layer);
+        else terrainTile->setColorLayer(layerNum, layer);
+    }
+
+    if (!result.success())
+    {
+        log(osg::WARN,"Error: SourceManifest::write(%s) unable to serialize TerrainTile.",filename.c_str());
+        return false;
+    }
+
+    std::string head;
+    BinaryWriter w(head);
+    w.write(static_cast<uint8_t>(tileSystem.valid() ? 1 : 0));
+    writeExtents(w, tileSystem.extents);
+    w.write(static_cast<uint8_t>(tileSystem.extents._isGeographic ? 1 : 0));
+    w.write(static_cast<int32_t>(tileSystem.numColumns));
+    w.write(static_cast<int32_t>(tileSystem.numRows));
+    w.writeString(shell.str());
+
+    w.write(static_cast<uint32_t>(layers.size()));
+    for(LayerEntries::const_iterator itr = layers.begin();
+        itr != layers.end();
+        ++itr)
+    {
+        w.write(static_cast<int32_t>(itr->layerNum));
+        w.write(static_cast<uint32_t>(itr->minLevel));
+        w.write(static_cast<uint32_t>(itr->maxLevel));
+        w.write(static_cast<uint32_t>(itr->firstRecord));
+        w.write(static_cast<uint32_t>(itr->numRecords));
+        w.writeString(itr->name);
+    }
+
+    w.write(static_cast<uint32_t>(records.size()));
+    for(RecordEntries::const_iterator itr = records.begin();
+        itr != records.end();
+        ++itr)
+    {
+        writeExtents(w, itr->extents);
+        w.write(itr->offset);
+        w.write(itr->size);
+        w.write(itr->checksum);
+    }
+
+    std::string data;
+    BinaryWriter hw(data);
+    data.append(s_magic, sizeof(s_magic));
+    hw.write(s_version);
+    hw.write(s_byteOrderTag);
+    hw.write(static_cast<uint64_t>(head.size()));
+    hw.write(hashBytes(head));
+    data.append(head);
+    data.append(recordData);
+
+    if (!writeFileAtomically(filename, data)) return false;
+
+    log(osg::INFO,"SourceManifest::write(%s) wrote %d layers, %d sources",filename.c_str(),int(layers.size()),int(records.size()));
+
+    return true;
+}
+
+bool SourceManifest::open(const std::string& filename, const osgDB::ReaderWriter::Options* options)
+{
+    osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+    if (!mappedFile->open(filename))
+    {
+        log(osg::WARN,"Error: unable to open source manifest '%s'.",filename.c_str());
+        return false;
+    }
+
+    const char* data = mappedFile->data();
+    size_t size = mappedFile->size();
+
+    if (size<s_headerSize ||
+        memcmp(data, s_magic, sizeof(s_magic))!=0 ||
+        getValue<uint32_t>(data+8)!=s_version ||
+        getValue<uint32_t>(data+12)!=s_byteOrderTag)
+    {
+        log(osg::WARN,"Error: '%s' is not a valid source manifest.",filename.c_str());
+        return false;
+    }
+
+    uint64_t headSize = getValue<uint64_t>(data+16);
+    uint64_t headChecksum = getValue<uint64_t>(data+24);
+    const char* head = data+s_headerSize;
+    if (headSize>size-s_headerSize || hashBytes(head, headSize)!=headChecksum)
+    {
+        log(osg::WARN,"Error: source manifest '%s' is corrupt.",filename.c_str());
+        return false;
+    }
+
+    TileSystem tileSystem;
+    std::string shell;
+    LayerEntries layers;
+    RecordEntries records;
+
+    BinaryReader r(head, headSize);
+    uint8_t hasTileSystem = 0, isGeographic = 0;
+    int32_t numColumns = 0, numRows = 0;
+    uint32_t numLayers = 0, numRecords = 0;
+    bool valid = r.read(hasTileSystem) &&
+                 readExtents(r, tileSystem.extents) &&
+                 r.read(isGeographic) &&
+                 r.read(numColumns) &&
+                 r.read(numRows) &&
+                 r.readString(shell) &&
+                 r.read(numLayers);
+
+    for(uint32_t i=0; valid && i<numLayers; ++i)
+    {
+        LayerEntry layerEntry;
+        int32_t layerNum;
+        uint32_t minLevel, maxLevel, firstRecord, layerRecords;
+        valid = r.read(layerNum) && r.read(minLevel) && r.read(maxLevel) &&
+                r.read(firstRecord) && r.read(layerRecords) && r.readString(layerEntry.name);
+
+        layerEntry.layerNum = layerNum;
+        layerEntry.minLevel = minLevel;
+        layerEntry.maxLevel = maxLevel;
+        layerEntry.firstRecord = firstRecord;
+        layerEntry.numRecords = layerRecords;
+        layers.push_back(layerEntry);
+    }
+
+    valid = valid && r.read(numRecords);
+    for(uint32_t i=0; valid && i<numRecords; ++i)
+    {
+        RecordEntry record;
+        valid = readExtents(r, record.extents) && r.read(record.offset) && r.read(record.size) && r.read(record.checksum);
+        record.extents._isGeographic = isGeographic!=0;
+        records.push_back(record);
+    }
+
+    for(LayerEntries::const_iterator itr = layers.begin();
+        valid && itr != layers.end();
+        ++itr)
+    {
+        valid = itr->firstRecord<=records.size() && itr->numRecords<=records.size()-itr->firstRecord;
+    }
+
+    if (!valid)
+    {
+        log(osg::WARN,"Error: source manifest '%s' is corrupt.",filename.c_str());
+        return false;
+    }
+
+    if (hasTileSystem)
+    {
+        tileSystem.extents._isGeographic = isGeographic!=0;
+        tileSystem.numColumns = numColumns;
+        tileSystem.numRows = numRows;
+    }
+    else
+    {
+        tileSystem = TileSystem();
+    }
+
+    // set up the database path so that files referenced by the shell are searched for relative to the manifest.
+    osg::ref_ptr<osgDB::ReaderWriter::Options> local_opt = options ?
+        static_cast<osgDB::ReaderWriter::Options*>(options->clone(osg::CopyOp::SHALLOW_COPY)) :
+        new osgDB::ReaderWriter::Options;
+    local_opt->setDatabasePath(osgDB::getFilePath(filename));
+
+    _mappedFile = mappedFile;
+    _options = local_opt.get();
+    _tileSystem = tileSystem;
+    _shell.swap(shell);
+    _layers.swap(layers);
+    _records.swap(records);
+    _recordData = head+headSize;
+    _recordDataSize = size-s_headerSize-headSize;
+
+    log(osg::INFO,"SourceManifest::open(%s) found %d layers, %d sources",filename.c_str(),int(_layers.size()),int(_records.size()));
+
+    return true;
+}
+
+bool SourceManifest::computeSubtileExtents(unsigned int level, unsigned int tileX, unsigned int tileY, GeospatialExtents& extents) const
+{
+    if (!_tileSystem.valid()) return false;
+
+    const GeospatialExtents& destinationExtents = _tileSystem.extents;
+    if (level==0)
+    {
+        extents = destinationExtents;
+        return true;
+    }
+
+    // same tile system as DataSet::computeCoverage(), level 1 has numColumns x numRows tiles and each level doubles both.
+    double numTilesAtLevel = pow(2.0, double(level-1));
+    double tileWidth = (destinationExtents.xMax()-destinationExtents.xMin()) / (numTilesAtLevel * double(_tileSystem.numColumns));
+    double tileHeight = (destinationExtents.yMax()-destinationExtents.yMin()) / (numTilesAtLevel * double(_tileSystem.numRows));
+
+    extents = GeospatialExtents(destinationExtents.xMin() + tileWidth * double(tileX),
+                                destinationExtents.yMin() + tileHeight * double(tileY),
+                                destinationExtents.xMin() + tileWidth * double(tileX+1),
+                                destinationExtents.yMin() + tileHeight * double(tileY+1),
+                                destinationExtents._isGeographic);
+    return true;
+}
+
+bool SourceManifest::readRecord(const RecordEntry& record, osgTerrain::CompositeLayer* compositeLayer)
+{
+    if (record.offset>_recordDataSize || record.size>_recordDataSize-record.offset) return false;
+
+    const char* payload = _recordData+record.offset;
+    if (hashBytes(payload, record.size)!=record.checksum) return false;
+
+    BinaryReader r(payload, record.size);
+
+    uint8_t recordType = 0;
+    if (!r.read(recordType)) return false;
+
+    osg::ref_ptr<osgTerrain::ProxyLayer> layer;
+    std::string setName, fileName;
+    if (recordType==PROXY_LAYER_RECORD)
+    {
+        layer = readProxyLayer(r);
+        if (!layer) return false;
+    }
+    else if (recordType==COMPOUND_NAME_RECORD)
+    {
+        if (!r.readString(setName) || !r.readString(fileName)) return false;
+    }
+    else
+    {
+        return false;
+    }
+
+    uint8_t hasMetadata = 0;
+    if (!r.read(hasMetadata)) return false;
+
+    if (hasMetadata)
+    {
+        SourceMetadataCache::Entry entry;
+        if (!SourceMetadataCache::readEntry(r, entry)) return false;
+
+        // the entry is still validated against the file when the source is loaded.
+        System::instance()->getSourceMetadataCache()->addEntry(entry, false);
+    }
+
+    if (layer.valid()) compositeLayer->addLayer(layer.get());
+    else compositeLayer->addLayer(setName, fileName);
+
+    return true;
+}
+
+osgTerrain::TerrainTile* SourceManifest::createTerrainTile(const GeospatialExtents* extents)
+{
+    if (!_mappedFile) return 0;
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osg2");
+    if (!rw)
+    {
+        log(osg::WARN,"Error: SourceManifest::createTerrainTile() requires the osg2 plugin.");
+        return 0;
+    }
+
+    std::istringstream shell(_shell);
+    osgDB::ReaderWriter::ReadResult result = rw->readNode(shell, _options.get());
+    osg::ref_ptr<osgTerrain::TerrainTile> terrainTile = dynamic_cast<osgTerrain::TerrainTile*>(result.getNode());
+    if (!terrainTile)
+    {
+        log(osg::WARN,"Error: unable to read TerrainTile from source manifest '%s'.",_mappedFile->getFileName().c_str());
+        return 0;
+    }
+
+    // models and shapefiles are placed at the highest level any raster source reaches,
+    // so when there are any they need all the raster sources to end up in the same place.
+    if (extents && terrainTile->getNumChildren()!=0)
+    {
+        log(osg::INFO,"SourceManifest::createTerrainTile() loading all sources as TerrainTile has models.");
+        extents = 0;
+    }
+
+    System* system = System::instance();
+    if (!system->getSourceMetadataCache()) system->setSourceMetadataCache(new SourceMetadataCache);
+
+    unsigned int numRecordsRead = 0;
+    for(LayerEntries::const_iterator itr = _layers.begin();
+        itr != _layers.end();
+        ++itr)
+    {
+        osg::ref_ptr<osgTerrain::CompositeLayer> compositeLayer = new osgTerrain::CompositeLayer;
+        compositeLayer->setName(itr->name);
+        compositeLayer->setMinLevel(itr->minLevel);
+        compositeLayer->setMaxLevel(itr->maxLevel);
+
+        for(unsigned int i=itr->firstRecord; i<itr->firstRecord+itr->numRecords; ++i)
+        {
+            const RecordEntry& record = _records[i];
+            if (extents && record.extents.valid() && !record.extents.intersects(*extents)) continue;
+
+            if (!readRecord(record, compositeLayer.get()))
+            {
+                log(osg::WARN,"Error: source manifest '%s' has a corrupt record.",_mappedFile->getFileName().c_str());
+                return 0;
+            }
+            ++numRecordsRead;
+        }
+
+        if (itr->layerNum<0) terrainTile->setElevationLayer(compositeLayer.get());
+        else terrainTile->setColorLayer(itr->layerNum, compositeLayer.get());
+    }
+
+    log(osg::INFO,"SourceManifest::createTerrainTile() read %d of %d sources",numRecordsRead,int(_records.size()));
+
+    return terrainTile.release();
+}
+
+osgTerrain::TerrainTile* SourceManifest::createTerrainTile(unsigned int level, unsigned int tileX, unsigned int tileY)
+{
+    GeospatialExtents extents;
+    if (!computeSubtileExtents(level, tileX, tileY, extents)) return createTerrainTile();
+
+    // pad the subtile so that sources whose extents the task computes slightly differently,
+    // such as when reading a reprojected copy from the FileCache, are still included.
+    double marginX = (extents.xMax()-extents.xMin())*0.25;
+    double marginY = (extents.yMax()-extents.yMin())*0.25;
+    extents.xMin() -= marginX;
+    extents.xMax() += marginX;
+    extents.yMin() -= marginY;
+    extents.yMax() += marginY;
+
+    return createTerrainTile(&extents);
+}
@@ -0,0 +1,454 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/SourceMetadataCache>
+#include <vpb/SourceData>
+#include <vpb/ThreadPool>
+#include <vpb/MappedFile>
+#include <vpb/BinaryStream>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace vpb;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Metadata cache file layout, all values are stored in native byte order:
+//
+//   header  : char magic[8] "VPBMDATA", uint32 version, uint32 byte order tag
+//   record  : uint32 payloadSize, uint64 payloadChecksum, payload
+//
+// Records are only ever appended, with the <cache>.lock file held, and a later record for a
+// file supersedes earlier ones.  Reading stops at the first record that is truncated or fails
+// its checksum, which can only be the tail left by an interrupted append.
+//
+namespace SourceMetadataCacheBinary
+{
+
+const char s_magic[8] = { 'V','P','B','M','D','A','T','A' };
+const uint32_t s_version = 2;
+const uint32_t s_byteOrderTag = 0x01020304;
+
+const size_t s_headerSize = 16;
+const size_t s_recordHeaderSize = 12;
+
+/** don't bother compacting small files, they are cheap to read whatever their contents.*/
+const unsigned int s_minimumRecordsToCompact = 1024;
+
+bool statFile(const std::string& filename, int64_t& modificationTime, uint64_t& fileSize)
+{
+    struct stat s;
+    if (stat(filename.c_str(), &s)!=0) return false;
+
+    // keep the sub-second part of the modification time where the platform provides it, so rewriting
+    // a file within a second of it being probed still invalidates the entry.
+    modificationTime = static_cast<int64_t>(s.st_mtime)*1000000000;
+#if defined(__linux__) || defined(__CYGWIN__)
+    modificationTime += static_cast<int64_t>(s.st_mtim.tv_nsec);
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+    modificationTime += static_cast<int64_t>(s.st_mtimespec.tv_nsec);
+#endif
+    fileSize = static_cast<uint64_t>(s.st_size);
+    return true;
+}
+
+void writeHeader(std::string& buffer)
+{
+    BinaryWriter w(buffer);
+    buffer.append(s_magic, sizeof(s_magic));
+    w.write(s_version);
+    w.write(s_byteOrderTag);
+}
+
+void writeEntry(BinaryWriter& w, const SourceMetadataCache::Entry& entry)
+{
+    const SpatialProperties& sp = entry.spatialProperties;
+    const osg::Matrixd& m = sp._geoTransform;
+
+    w.writeString(entry.filename);
+    w.write(entry.modificationTime);
+    w.write(entry.fileSize);
+    w.write(static_cast<uint32_t>(sp._dataType));
+    w.writeString(sp._cs.valid() ? sp._cs->getCoordinateSystem() : std::string());
+    w.write(sp._extents.xMin()); w.write(sp._extents.yMin()); w.write(sp._extents.xMax()); w.write(sp._extents.yMax());
+    w.write(static_cast<uint8_t>(sp._extents._isGeographic ? 1 : 0));
+    w.write(m(0,0)); w.write(m(0,1)); w.write(m(1,0)); w.write(m(1,1)); w.write(m(3,0)); w.write(m(3,1));
+    w.write(static_cast<int32_t>(sp._numValuesX));
+    w.write(static_cast<int32_t>(sp._numValuesY));
+    w.write(static_cast<int32_t>(sp._numValuesZ));
+    w.write(static_cast<uint8_t>(entry.hasGCPs ? 1 : 0));
+}
+
+void writeRecord(std::string& buffer, const SourceMetadataCache::Entry& entry)
+{
+    std::string payload;
+    BinaryWriter w(payload);
+    writeEntry(w, entry);
+
+    BinaryWriter rw(buffer);
+    rw.write(static_cast<uint32_t>(payload.size()));
+    rw.write(hashBytes(payload));
+    buffer.append(payload);
+}
+
+bool readEntry(BinaryReader& r, SourceMetadataCache::Entry& entry, std::string& cs)
+{
+    SpatialProperties& sp = entry.spatialProperties;
+    osg::Matrixd& m = sp._geoTransform;
+
+    uint32_t dataType = 0;
+    uint8_t isGeographic = 0;
+    uint8_t hasGCPs = 0;
+    int32_t sizeX, sizeY, sizeZ;
+
+    if (!r.readString(entry.filename) ||
+        !r.read(entry.modificationTime) ||
+        !r.read(entry.fileSize) ||
+        !r.read(dataType) ||
+        !r.readString(cs) ||
+        !r.read(sp._extents.xMin()) || !r.read(sp._extents.yMin()) || !r.read(sp._extents.xMax()) || !r.read(sp._extents.yMax()) ||
+        !r.read(isGeographic) ||
+        !r.read(m(0,0)) || !r.read(m(0,1)) || !r.read(m(1,0)) || !r.read(m(1,1)) || !r.read(m(3,0)) || !r.read(m(3,1)) ||
+        !r.read(sizeX) || !r.read(sizeY) || !r.read(sizeZ) ||
+        !r.read(hasGCPs))
+    {
+        return false;
+    }
+
+    sp._dataType = static_cast<SpatialProperties::DataType>(dataType);
+    sp._extents._isGeographic = isGeographic!=0;
+    sp._numValuesX = sizeX;
+    sp._numValuesY = sizeY;
+    sp._numValuesZ = sizeZ;
+    entry.hasGCPs = hasGCPs!=0;
+
+    return true;
+}
+
+}
+
+using namespace SourceMetadataCacheBinary;
+
+SourceMetadataCache::SourceMetadataCache():
+    _numRecordsInFile(0)
+{
+}
+
+SourceMetadataCache::~SourceMetadataCache()
+{
+}
+
+unsigned int SourceMetadataCache::getNumEntries() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _entryMap.size();
+}
+
+bool SourceMetadataCache::open(const std::string& filename)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _filename = filename;
+    _entryMap.clear();
+    _pending.clear();
+    _numRecordsInFile = 0;
+
+    if (!osgDB::fileExists(filename)) return true;
+
+    osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+    if (!mappedFile->open(filename))
+    {
+        log(osg::WARN,"Error: unable to open metadata cache file '%s'.",filename.c_str());
+        return false;
+    }
+
+    size_t validEnd = 0;
+    _numRecordsInFile = readRecords(mappedFile->data(), mappedFile->size(), validEnd);
+    if (validEnd==0)
+    {
+        log(osg::WARN,"Error: '%s' is not a valid metadata cache file.",filename.c_str());
+        return false;
+    }
+
+    log(osg::INFO,"SourceMetadataCache::open(%s) read %d entries",filename.c_str(),int(_entryMap.size()));
+
+    return true;
+}
+
+unsigned int SourceMetadataCache::readRecords(const char* data, size_t size, size_t& validEnd)
+{
+    validEnd = 0;
+
+    if (size<s_headerSize ||
+        memcmp(data, s_magic, sizeof(s_magic))!=0 ||
+        getValue<uint32_t>(data+8)!=s_version ||
+        getValue<uint32_t>(data+12)!=s_byteOrderTag)
+    {
+        return 0;
+    }
+
+    unsigned int numRecords = 0;
+    size_t offset = s_headerSize;
+    while(offset+s_recordHeaderSize<=size)
+    {
+        uint32_t payloadSize = getValue<uint32_t>(data+offset);
+        uint64_t checksum = getValue<uint64_t>(data+offset+4);
+        const char* payload = data+offset+s_recordHeaderSize;
+
+        if (payloadSize>size-offset-s_recordHeaderSize || hashBytes(payload, payloadSize)!=checksum) break;
+
+        Entry entry;
+        std::string cs;
+        BinaryReader r(payload, payloadSize);
+        if (!SourceMetadataCacheBinary::readEntry(r, entry, cs)) break;
+
+        // entries added locally but not yet synced are newer than anything on disk.
+        if (_pending.count(entry.filename)==0)
+        {
+            if (!cs.empty())
+            {
+                osg::ref_ptr<osg::CoordinateSystemNode>& csn = _coordinateSystemMap[cs];
+                if (!csn) csn = new osg::CoordinateSystemNode("WKT", cs);
+                entry.spatialProperties._cs = csn;
+            }
+
+            _entryMap[entry.filename] = entry;
+        }
+
+        ++numRecords;
+        offset += s_recordHeaderSize + payloadSize;
+    }
+
+    if (offset<size)
+    {
+        log(osg::INFO,"SourceMetadataCache ignoring %d bytes of incomplete records.",int(size-offset));
+    }
+
+    validEnd = offset;
+    return numRecords;
+}
+
+bool SourceMetadataCache::getEntry(const std::string& filename, SpatialProperties::DataType dataType, Entry& entry)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+        EntryMap::const_iterator itr = _entryMap.find(filename);
+        if (itr == _entryMap.end() || itr->second.spatialProperties._dataType!=dataType) return false;
+
+        entry = itr->second;
+    }
+
+    int64_t modificationTime = 0;
+    uint64_t fileSize = 0;
+    if (!statFile(filename, modificationTime, fileSize) ||
+        modificationTime!=entry.modificationTime ||
+        fileSize!=entry.fileSize)
+    {
+        log(osg::INFO,"SourceMetadataCache::getEntry(%s) entry is stale.",filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void SourceMetadataCache::addEntry(const Entry& entry, bool requiresWrite)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    _entryMap[entry.filename] = entry;
+    if (requiresWrite) _pending.insert(entry.filename);
+}
+
+void SourceMetadataCache::writeEntry(BinaryWriter& writer, const Entry& entry)
+{
+    SourceMetadataCacheBinary::writeEntry(writer, entry);
+}
+
+bool SourceMetadataCache::readEntry(BinaryReader& reader, Entry& entry)
+{
+    std::string cs;
+    if (!SourceMetadataCacheBinary::readEntry(reader, entry, cs)) return false;
+
+    entry.spatialProperties._cs = cs.empty() ? 0 : new osg::CoordinateSystemNode("WKT", cs);
+    return true;
+}
+
+bool SourceMetadataCache::probe(const std::string& filename, SpatialProperties::DataType dataType, Entry& entry)
+{
+    entry.filename = filename;
+    if (!statFile(filename, entry.modificationTime, entry.fileSize)) return false;
+
+    // open directly rather than through System so that probes can run concurrently.
+    osg::ref_ptr<GeospatialDataset> dataset = new GeospatialDataset(filename, READ_ONLY);
+    if (!dataset->getGDALDataset()) return false;
+
+    entry.spatialProperties._dataType = dataType;
+    return SourceData::readSpatialProperties(dataset.get(), entry.spatialProperties, entry.hasGCPs);
+}
+
+class SourceProbeOperation : public BuildOperation
+{
+    public:
+
+        SourceProbeOperation(ThreadPool* threadPool, SourceMetadataCache* cache, const SourceMetadataCache::FileNameDataTypePair& file):
+            BuildOperation(threadPool, 0, std::string("SourceProbeOperation ")+file.first, false),
+            _cache(cache),
+            _file(file) {}
+
+        virtual void build()
+        {
+            SourceMetadataCache::Entry entry;
+            if (SourceMetadataCache::probe(_file.first, _file.second, entry))
+            {
+                _cache->addEntry(entry);
+            }
+            else
+            {
+                log(osg::INFO,"SourceMetadataCache unable to probe '%s'.",_file.first.c_str());
+            }
+        }
+
+        osg::ref_ptr<SourceMetadataCache>           _cache;
+        SourceMetadataCache::FileNameDataTypePair   _file;
+};
+
+void SourceMetadataCache::probe(const FileNameDataTypeList& files, unsigned int numThreads)
+{
+    if (files.empty()) return;
+
+    if (numThreads<=1 || files.size()==1)
+    {
+        for(FileNameDataTypeList::const_iterator itr = files.begin();
+            itr != files.end();
+            ++itr)
+        {
+            Entry entry;
+            if (probe(itr->first, itr->second, entry)) addEntry(entry);
+        }
+        return;
+    }
+
+    if (numThreads>files.size()) numThreads = files.size();
+
+    log(osg::INFO,"SourceMetadataCache::probe() probing %d files on %d threads",int(files.size()),numThreads);
+
+    osg::ref_ptr<ThreadPool> threadPool = new ThreadPool(numThreads, false);
+    threadPool->startThreads();
+
+    for(FileNameDataTypeList::const_iterator itr = files.begin();
+        itr != files.end();
+        ++itr)
+    {
+        threadPool->run(new SourceProbeOperation(threadPool.get(), this, *itr));
+    }
+
+    threadPool->waitForCompletion();
+}
+
+bool SourceMetadataCache::writeAll()
+{
+    std::string buffer;
+    writeHeader(buffer);
+    for(EntryMap::const_iterator itr = _entryMap.begin();
+        itr != _entryMap.end();
+        ++itr)
+    {
+        writeRecord(buffer, itr->second);
+    }
+
+    if (!writeFileAtomically(_filename, buffer)) return false;
+
+    _numRecordsInFile = _entryMap.size();
+
+    return true;
+}
+
+bool SourceMetadataCache::sync()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (_filename.empty() || _pending.empty()) return true;
+
+    ScopedFileLock fileLock(_filename);
+
+    // merge in records appended by other tasks since we read the file, and find the end of
+    // the last complete record so that the tail of an interrupted append is overwritten.
+    size_t validEnd = 0;
+    if (osgDB::fileExists(_filename))
+    {
+        osg::ref_ptr<MappedFile> mappedFile = new MappedFile;
+        if (mappedFile->open(_filename))
+        {
+            _numRecordsInFile = readRecords(mappedFile->data(), mappedFile->size(), validEnd);
+        }
+    }
+
+    bool result = true;
+    unsigned int numRecords = _numRecordsInFile + _pending.size();
+    if (validEnd==0 || (numRecords>=s_minimumRecordsToCompact && numRecords>2*_entryMap.size()))
+    {
+        log(osg::INFO,"SourceMetadataCache::sync() rewriting %s with %d entries",_filename.c_str(),int(_entryMap.size()));
+
+        result = writeAll();
+    }
+    else
+    {
+        std::string buffer;
+        for(FileNames::iterator itr = _pending.begin();
+            itr != _pending.end();
+            ++itr)
+        {
+            writeRecord(buffer, _entryMap[*itr]);
+        }
+
+        int fileID = vpb::open(_filename.c_str(), O_RDWR);
+        if (fileID<0)
+        {
+            log(osg::WARN,"Error: unable to open metadata cache file '%s' for appending.",_filename.c_str());
+            return false;
+        }
+
+        result = vpb::ftruncate(fileID, validEnd)==0 &&
+                 vpb::lseek(fileID, validEnd, SEEK_SET)==static_cast<off_t>(validEnd);
+
+        size_t total = 0;
+        while(result && total<buffer.size())
+        {
+            ssize_t numWritten = vpb::write(fileID, buffer.data()+total, buffer.size()-total);
+            if (numWritten<=0) result = false;
+            else total += numWritten;
+        }
+
+        if (result) vpb::fsync(fileID);
+        vpb::close(fileID);
+
+        if (!result)
+        {
+            log(osg::WARN,"Error: failed to append to metadata cache file '%s'.",_filename.c_str());
+        }
+        else
+        {
+            log(osg::INFO,"SourceMetadataCache::sync() appended %d entries to %s",int(_pending.size()),_filename.c_str());
+
+            _numRecordsInFile = numRecords;
+        }
+    }
+
+    if (result) _pending.clear();
+
+    return result;
+}
@@ -49,6 +49,7 @@ std::string& vpb::getLogDirectory() { return System::instance()->getLogDirectory
 std::string& vpb::getTaskDirectory() { return System::instance()->getTaskDirectory(); }
 std::string& vpb::getMachineFileName() { return System::instance()->getMachineFileName(); }
 std::string& vpb::getCacheFileName() { return System::instance()->getCacheFileName(); }
+std::string& vpb::getMetadataCacheFileName() { return System::instance()->getMetadataCacheFileName(); }
 unsigned int vpb::getMaxNumberOfFilesPerDirectory() { return System::instance()->getMaxNumberOfFilesPerDirectory(); }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -69,11 +70,15 @@ System::System()
     _trimOldestTiles = true;
     _numUnusedDatasetsToTrimFromCache = 10;
     _maxNumDatasets = (unsigned int)(double(vpb::getdtablesize()) * 0.8);
+    _numDatasetCacheHits = 0;
+    _numDatasetCacheMisses = 0;
     
     _logDirectory = "logs";
     _taskDirectory = "tasks";
     
     _maxNumberOfFilesPerDirectory = 1000;
+
+    _numSourceProbeThreads = 8;
     
     readEnvironmentVariables();
     
@@ -121,6 +126,7 @@ System::~System()
     _machinePool = 0;
     _taskManager = 0;
     _fileCache = 0;
+    _sourceMetadataCache = 0;
 }
 
 void System::readEnvironmentVariables()
@@ -192,6 +198,18 @@ void System::readEnvironmentVariables()
     {
         _cacheFileName = str;
     }
+
+    str = getenv("VPB_METADATA_CACHE_FILE");
+    if (str)
+    {
+        _metadataCacheFileName = str;
+    }
+
+    str = getenv("VPB_NUM_SOURCE_PROBE_THREADS");
+    if (str)
+    {
+        _numSourceProbeThreads = atoi(str);
+    }
     
 
     str = getenv("VPB_MAXIMUM_OF_FILES_PER_DIRECTORY");
@@ -206,6 +224,8 @@ void System::readArguments(osg::ArgumentParser& arguments)
     while (arguments.read("--machines",_machineFileName)) {}
 
     while (arguments.read("--cache",_cacheFileName)) {}
+
+    while (arguments.read("--metadata-cache",_metadataCacheFileName)) {}
 }
 
 FileCache* System::getFileCache()
@@ -219,6 +239,17 @@ FileCache* System::getFileCache()
     return _fileCache.get();
 }
 
+SourceMetadataCache* System::getSourceMetadataCache()
+{
+    if (!_sourceMetadataCache && !_metadataCacheFileName.empty())
+    {
+        _sourceMetadataCache = new SourceMetadataCache;
+        _sourceMetadataCache->open(_metadataCacheFileName);
+    }
+
+    return _sourceMetadataCache.get();
+}
+
 MachinePool* System::getMachinePool()
 {
     if (!_machinePool)
@@ -339,9 +370,12 @@ GeospatialDataset* System::openGeospatialDataset(const std::string& filename, Ac
     if (itr != _datasetMap.end())
     {
         //osg::notify(osg::NOTICE)<<"System::openGeospatialDataset("<<filename<<") returning existing entry, ref count "<<itr->second->referenceCount()<<std::endl;
+        ++_numDatasetCacheHits;
         return itr->second.get();
     }
 
+    ++_numDatasetCacheMisses;
+
     // make sure there is room available for this new Dataset
     if (_datasetMap.size()>=_maxNumDatasets) clearUnusedDatasets(_numUnusedDatasetsToTrimFromCache);
     
@@ -16,6 +16,7 @@
 #include <vpb/DatabaseBuilder>
 #include <vpb/System>
 #include <vpb/FileUtils>
+#include <vpb/Trace>
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
@@ -335,7 +336,7 @@ void TaskManager::addTask(Task* task)
 }
 
 void TaskManager::addTask(const std::string& taskFileName, const std::string& application, const std::string& sourceFile,
-                          const std::string& fileListBaseName)
+                          const std::string& fileListBaseName, const std::string& type)
 {
     osg::ref_ptr<Task> taskFile = new Task(taskFileName);
 
@@ -344,6 +345,7 @@ void TaskManager::addTask(const std::string& taskFileName, const std::string& ap
         taskFile->setProperty("application",application);
         taskFile->setProperty("source",sourceFile);
         taskFile->setProperty("fileListBaseName",fileListBaseName);
+        if (!type.empty()) taskFile->setProperty("type",type);
 
         taskFile->write();
 
@@ -451,6 +453,27 @@ bool TaskManager::generateTasksFromSource()
         bo->setDistributedBuildSecondarySplitLevel(dataset->getDistributedBuildSecondarySplitLevel());
         bo->setDistributedBuildSplitLevel(dataset->getDistributedBuildSplitLevel());
 
+        // pass on the extents of the patched sources so tasks only regenerate the tiles they affect.
+        bo->setPatchExtents(dataset->getPatchExtents());
+
+        // fix the destination coordinate system too, as tasks reading only some of the sources
+        // could otherwise take it from a different first source.
+        if (bo->getDestinationCoordinateSystem().empty() && !dataset->getDestinationCoordinateSystem().empty())
+        {
+            bo->setDestinationCoordinateSystem(dataset->getDestinationCoordinateSystem());
+        }
+
+        // record the tile system and source extents so tasks can skip sources outside their subtile.
+        _tileSystem.extents = dataset->getDestinationExtents();
+        dataset->getTileSystemDimensions(_tileSystem.numColumns, _tileSystem.numRows);
+
+        _sourceExtentsMap.clear();
+        for(CompositeSource::source_iterator itr(dataset->getSourceGraph());itr.valid();++itr)
+        {
+            SourceData* sd = (*itr)->getSourceData();
+            if (sd) _sourceExtentsMap[(*itr)->getFileName()] = sd->getExtents(dataset->getIntermediateCoordinateSystem());
+        }
+
         if (dataset->getBuildLog())
         {
             dataset->getBuildLog()->report(std::cout);
@@ -655,6 +678,32 @@ bool TaskManager::run()
 
     getMachinePool()->reportTimingStats();
 
+    if (getBuildOptions() && !getBuildOptions()->getTraceFileName().empty())
+    {
+        // merge the traces written by each task onto one timeline.
+        std::vector<std::string> traceFileNames;
+        for(TaskSetList::iterator tsItr = _taskSetList.begin();
+            tsItr != _taskSetList.end();
+            ++tsItr)
+        {
+            for(TaskSet::iterator itr = tsItr->begin();
+                itr != tsItr->end();
+                ++itr)
+            {
+                Task* task = itr->get();
+                task->read();
+
+                std::string traceFileName;
+                if (task->getProperty("trace file", traceFileName)) traceFileNames.push_back(traceFileName);
+            }
+        }
+
+        if (!traceFileNames.empty() && Trace::merge(traceFileNames, getBuildOptions()->getTraceFileName()))
+        {
+            log(osg::NOTICE,"Merged the traces of %u tasks into %s",static_cast<unsigned int>(traceFileNames.size()),getBuildOptions()->getTraceFileName().c_str());
+        }
+    }
+
     if (tasksFailed==0)
     {
         if (tasksPending==0) log(osg::NOTICE,"Finished run successfully.");
@@ -687,7 +736,10 @@ bool TaskManager::writeSource(const std::string& filename)
             }
         }
 
-        osgDB::writeNodeFile(*_terrainTile, _sourceFileName);
+        if (!SourceManifest::write(_sourceFileName, _terrainTile.get(), _tileSystem, _sourceExtentsMap))
+        {
+            throw std::string("Error: TaskManager::writeSource(")+filename+std::string("), unable to write source manifest.");
+        }
 
         // make sure the OS writes the file to disk
         vpb::sync();
@@ -0,0 +1,738 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/TileContainer>
+#include <vpb/BinaryStream>
+#include <vpb/FileUtils>
+#include <vpb/BuildLog>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+
+#include <sstream>
+
+using namespace vpb;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Container data file layout, all values are stored in native byte order:
+//
+//   header  : char magic[8] "VPBTILES", uint32 version, uint32 byte order tag
+//   record  : uint32 nameSize, uint32 reserved, uint64 dataSize, uint64 dataChecksum, name, data
+//
+// Index file layout, <container>.index:
+//
+//   header  : char magic[8] "VPBTINDX", uint32 version, uint32 byte order tag,
+//             uint64 size of the data file indexed, uint32 capacity, uint32 numFiles, string masterFileName
+//   slots   : capacity * { uint64 nameHash, uint64 recordOffset }, empty slots have a zero offset
+//
+// Slots are found by linear probing from nameHash modulo capacity.  Records are only ever
+// appended, reading the data file stops at the first record that is truncated or fails its
+// checksum, which can only be the tail left by an interrupted write.
+//
+namespace TileContainerBinary
+{
+
+const char s_dataMagic[8] = { 'V','P','B','T','I','L','E','S' };
+const char s_indexMagic[8] = { 'V','P','B','T','I','N','D','X' };
+const uint32_t s_version = 1;
+const uint32_t s_byteOrderTag = 0x01020304;
+
+const size_t s_headerSize = 16;
+const size_t s_recordHeaderSize = 24;
+
+const unsigned int s_minimumCapacity = 64;
+
+std::string createHeader(const char* magic)
+{
+    std::string header(magic, 8);
+    BinaryWriter w(header);
+    w.write(s_version);
+    w.write(s_byteOrderTag);
+    return header;
+}
+
+bool checkHeader(const char* data, size_t size, const char* magic)
+{
+    if (size<s_headerSize) return false;
+    if (memcmp(data, magic, 8)!=0) return false;
+    return getValue<uint32_t>(data+8)==s_version && getValue<uint32_t>(data+12)==s_byteOrderTag;
+}
+
+}
+
+using namespace TileContainerBinary;
+
+TileContainer::TileContainer():
+    _status(READ),
+    _dataFile(0),
+    _readFileID(-1),
+    _dataSize(0),
+    _numFiles(0)
+{
+}
+
+TileContainer::~TileContainer()
+{
+    close();
+}
+
+bool TileContainer::acceptsExtension(const std::string& extension) const
+{
+    return osgDB::equalCaseInsensitive(extension,"vpbc");
+}
+
+bool TileContainer::isContainerFileName(const std::string& filename)
+{
+    return osgDB::getLowerCaseFileExtension(filename)=="vpbc";
+}
+
+bool TileContainer::open(const std::string& filename, ArchiveStatus status)
+{
+    close();
+
+    _filename = filename;
+    _directory = osgDB::getFilePath(filename);
+    _status = status;
+
+    if (status==CREATE || (status==WRITE && !osgDB::fileExists(filename)))
+    {
+        _dataFile = vpb::fopen(filename.c_str(), "wb");
+        if (!_dataFile)
+        {
+            log(osg::WARN,"Error: TileContainer::open(%s) unable to create file.",filename.c_str());
+            return false;
+        }
+
+        std::string header = createHeader(s_dataMagic);
+        if (fwrite(header.data(), 1, header.size(), _dataFile)!=header.size())
+        {
+            log(osg::WARN,"Error: TileContainer::open(%s) unable to write header.",filename.c_str());
+            close();
+            return false;
+        }
+        _dataSize = header.size();
+
+        // any index left by a previous container of the same name no longer applies.
+        remove(getIndexFileName(filename).c_str());
+    }
+    else
+    {
+        _mappedFile = new MappedFile;
+        if (!_mappedFile->open(filename))
+        {
+            log(osg::WARN,"Error: TileContainer::open(%s) unable to open file.",filename.c_str());
+            _mappedFile = 0;
+            return false;
+        }
+
+        if (!checkHeader(_mappedFile->data(), _mappedFile->size(), s_dataMagic))
+        {
+            log(osg::WARN,"Error: TileContainer::open(%s) not a compatible tile container.",filename.c_str());
+            _mappedFile = 0;
+            return false;
+        }
+
+        _dataSize = _mappedFile->size();
+
+        uint64_t validEnd = _dataSize;
+        if (!readIndex())
+        {
+            log(osg::INFO,"TileContainer::open(%s) index missing or out of date, rebuilding.",filename.c_str());
+            rebuildIndex(validEnd);
+        }
+
+        if (status==READ) return true;
+
+        // switch from the read only mapping to appending.
+        _mappedFile = 0;
+
+        if (validEnd<_dataSize)
+        {
+            log(osg::NOTICE,"TileContainer::open(%s) discarding incomplete record at end of file.",filename.c_str());
+
+            int fileID = vpb::open(filename.c_str(), O_RDWR | O_BINARY);
+            bool truncated = fileID>=0 && vpb::ftruncate(fileID, static_cast<off_t>(validEnd))==0;
+            if (fileID>=0) vpb::close(fileID);
+
+            if (!truncated)
+            {
+                log(osg::WARN,"Error: TileContainer::open(%s) unable to truncate file.",filename.c_str());
+                close();
+                return false;
+            }
+
+            _dataSize = validEnd;
+        }
+
+        _dataFile = vpb::fopen(filename.c_str(), "ab");
+        if (!_dataFile)
+        {
+            log(osg::WARN,"Error: TileContainer::open(%s) unable to open file for appending.",filename.c_str());
+            close();
+            return false;
+        }
+    }
+
+    _readFileID = vpb::open(filename.c_str(), O_RDONLY | O_BINARY);
+
+    if (_slots.empty()) rehash(s_minimumCapacity);
+
+    return true;
+}
+
+void TileContainer::close()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (_dataFile)
+    {
+        bool ok = (fflush(_dataFile)==0);
+        if (ok) vpb::fsync(fileno(_dataFile));
+        vpb::fclose(_dataFile);
+        _dataFile = 0;
+
+        if (ok) writeIndex();
+        else log(osg::WARN,"Error: TileContainer::close() unable to flush %s, index not written.",_filename.c_str());
+    }
+
+    if (_readFileID>=0)
+    {
+        vpb::close(_readFileID);
+        _readFileID = -1;
+    }
+
+    _mappedFile = 0;
+    _dataSize = 0;
+    _masterFileName.clear();
+    _slots.clear();
+    _numFiles = 0;
+}
+
+void TileContainer::setMasterFileName(const std::string& filename)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _masterFileName = getContainedName(filename);
+}
+
+std::string TileContainer::getMasterFileName() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _masterFileName;
+}
+
+std::string TileContainer::getContainedName(const std::string& filename) const
+{
+    std::string name = vpb::simplifyFileName(filename);
+    for(std::string::iterator itr = name.begin(); itr != name.end(); ++itr)
+    {
+        if (*itr=='\\') *itr = '/';
+    }
+
+    if (!_directory.empty())
+    {
+        std::string prefix = vpb::simplifyFileName(_directory);
+        for(std::string::iterator itr = prefix.begin(); itr != prefix.end(); ++itr)
+        {
+            if (*itr=='\\') *itr = '/';
+        }
+        if (prefix[prefix.size()-1]!='/') prefix.push_back('/');
+
+        if (name.compare(0, prefix.size(), prefix)==0) name.erase(0, prefix.size());
+    }
+
+    while (name.compare(0, 2, "./")==0) name.erase(0, 2);
+
+    return name;
+}
+
+bool TileContainer::readRecordHeader(uint64_t offset, std::string& name, uint64_t& dataOffset, uint64_t& dataSize) const
+{
+    if (offset+s_recordHeaderSize>_dataSize) return false;
+
+    char header[s_recordHeaderSize];
+    if (_mappedFile.valid())
+    {
+        memcpy(header, _mappedFile->data()+offset, s_recordHeaderSize);
+    }
+    else
+    {
+        if (_readFileID<0) return false;
+        if (_dataFile) fflush(_dataFile);
+        if (vpb::lseek(_readFileID, static_cast<off_t>(offset), SEEK_SET)!=static_cast<off_t>(offset)) return false;
+        if (vpb::read(_readFileID, header, s_recordHeaderSize)!=static_cast<ssize_t>(s_recordHeaderSize)) return false;
+    }
+
+    uint32_t nameSize = getValue<uint32_t>(header);
+    dataSize = getValue<uint64_t>(header+8);
+    dataOffset = offset + s_recordHeaderSize + nameSize;
+
+    if (dataOffset+dataSize>_dataSize) return false;
+
+    if (_mappedFile.valid())
+    {
+        name.assign(_mappedFile->data()+offset+s_recordHeaderSize, nameSize);
+    }
+    else
+    {
+        name.resize(nameSize);
+        if (nameSize>0 && vpb::read(_readFileID, &name[0], nameSize)!=static_cast<ssize_t>(nameSize)) return false;
+    }
+
+    return true;
+}
+
+const TileContainer::Slot* TileContainer::findSlot(const std::string& name, uint64_t hash) const
+{
+    if (_slots.empty()) return 0;
+
+    size_t mask = _slots.size()-1;
+    for(size_t i = hash & mask; _slots[i].offset!=0; i = (i+1) & mask)
+    {
+        if (_slots[i].hash!=hash) continue;
+
+        std::string recordName;
+        uint64_t dataOffset, dataSize;
+        if (readRecordHeader(_slots[i].offset, recordName, dataOffset, dataSize) && recordName==name) return &_slots[i];
+    }
+    return 0;
+}
+
+void TileContainer::insertSlot(uint64_t hash, uint64_t offset) const
+{
+    size_t mask = _slots.size()-1;
+    size_t i = hash & mask;
+    while (_slots[i].offset!=0) i = (i+1) & mask;
+
+    _slots[i].hash = hash;
+    _slots[i].offset = offset;
+}
+
+void TileContainer::rehash(unsigned int capacity) const
+{
+    Slots previous;
+    previous.swap(_slots);
+
+    _slots.resize(capacity);
+    for(Slots::const_iterator itr = previous.begin();
+        itr != previous.end();
+        ++itr)
+    {
+        if (itr->offset!=0) insertSlot(itr->hash, itr->offset);
+    }
+}
+
+bool TileContainer::readIndex()
+{
+    osg::ref_ptr<MappedFile> indexFile = new MappedFile;
+    if (!indexFile->open(getIndexFileName(_filename))) return false;
+
+    if (!checkHeader(indexFile->data(), indexFile->size(), s_indexMagic)) return false;
+
+    BinaryReader r(indexFile->data()+s_headerSize, indexFile->size()-s_headerSize);
+
+    uint64_t dataSize = 0;
+    uint32_t capacity = 0;
+    uint32_t numFiles = 0;
+    std::string masterFileName;
+    if (!r.read(dataSize) || !r.read(capacity) || !r.read(numFiles) || !r.readString(masterFileName)) return false;
+
+    // an index written for a different version of the data file, or damaged, is rebuilt instead.
+    if (dataSize!=_dataSize) return false;
+    if (capacity<s_minimumCapacity || (capacity & (capacity-1))!=0 || numFiles>capacity/2) return false;
+    if (r.remaining()!=size_t(capacity)*sizeof(Slot)) return false;
+
+    _slots.resize(capacity);
+    memcpy(&_slots.front(), r.position(), size_t(capacity)*sizeof(Slot));
+
+    _numFiles = numFiles;
+    _masterFileName = masterFileName;
+
+    return true;
+}
+
+bool TileContainer::rebuildIndex(uint64_t& validEnd)
+{
+    _slots.clear();
+    _numFiles = 0;
+    rehash(s_minimumCapacity);
+
+    const char* data = _mappedFile->data();
+
+    uint64_t offset = s_headerSize;
+    while (offset<_dataSize)
+    {
+        std::string name;
+        uint64_t dataOffset, dataSize;
+        if (!readRecordHeader(offset, name, dataOffset, dataSize)) break;
+
+        uint64_t checksum = getValue<uint64_t>(data+offset+16);
+        if (hashBytes(data+dataOffset, size_t(dataSize))!=checksum) break;
+
+        uint64_t hash = hashBytes(name);
+        Slot* slot = const_cast<Slot*>(findSlot(name, hash));
+        if (slot)
+        {
+            slot->offset = offset;
+        }
+        else
+        {
+            if ((_numFiles+1)*2>_slots.size()) rehash(_slots.size()*2);
+            insertSlot(hash, offset);
+            ++_numFiles;
+        }
+
+        offset = dataOffset + dataSize;
+    }
+
+    validEnd = offset;
+
+    // the master file isn't recorded in the data file, fall back to the first file as an osga archive would.
+    if (_masterFileName.empty() && _numFiles>0)
+    {
+        std::string name;
+        uint64_t dataOffset, dataSize;
+        if (readRecordHeader(s_headerSize, name, dataOffset, dataSize)) _masterFileName = name;
+    }
+
+    return offset==_dataSize;
+}
+
+bool TileContainer::writeIndex()
+{
+    std::string buffer = createHeader(s_indexMagic);
+    BinaryWriter w(buffer);
+    w.write(_dataSize);
+    w.write(static_cast<uint32_t>(_slots.size()));
+    w.write(static_cast<uint32_t>(_numFiles));
+    w.writeString(_masterFileName);
+    if (!_slots.empty()) buffer.append(reinterpret_cast<const char*>(&_slots.front()), _slots.size()*sizeof(Slot));
+
+    return vpb::writeFileAtomically(getIndexFileName(_filename), buffer);
+}
+
+bool TileContainer::fileExists(const std::string& filename) const
+{
+    std::string name = getContainedName(filename);
+    uint64_t hash = hashBytes(name);
+
+    // in READ mode the index and data are never modified so no locking is required.
+    if (_mappedFile.valid()) return findSlot(name, hash)!=0;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return findSlot(name, hash)!=0;
+}
+
+osgDB::FileType TileContainer::getFileType(const std::string& filename) const
+{
+    if (fileExists(filename)) return osgDB::REGULAR_FILE;
+
+    // treat any prefix of a contained file name as a directory.
+    std::string prefix = getContainedName(filename);
+    if (!prefix.empty() && prefix[prefix.size()-1]!='/') prefix.push_back('/');
+
+    FileNameList fileNames;
+    getFileNames(fileNames);
+    for(FileNameList::const_iterator itr = fileNames.begin();
+        itr != fileNames.end();
+        ++itr)
+    {
+        if (itr->compare(0, prefix.size(), prefix)==0) return osgDB::DIRECTORY;
+    }
+
+    return osgDB::FILE_NOT_FOUND;
+}
+
+bool TileContainer::getFileNames(FileNameList& fileNames) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    for(Slots::const_iterator itr = _slots.begin();
+        itr != _slots.end();
+        ++itr)
+    {
+        std::string name;
+        uint64_t dataOffset, dataSize;
+        if (itr->offset!=0 && readRecordHeader(itr->offset, name, dataOffset, dataSize)) fileNames.push_back(name);
+    }
+
+    return !fileNames.empty();
+}
+
+unsigned int TileContainer::getNumFiles() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numFiles;
+}
+
+bool TileContainer::readFile(const std::string& filename, std::string& data) const
+{
+    std::string name = getContainedName(filename);
+    uint64_t hash = hashBytes(name);
+
+    std::string recordName;
+    uint64_t dataOffset, dataSize;
+
+    if (_mappedFile.valid())
+    {
+        const Slot* slot = findSlot(name, hash);
+        if (!slot || !readRecordHeader(slot->offset, recordName, dataOffset, dataSize)) return false;
+
+        data.assign(_mappedFile->data()+dataOffset, size_t(dataSize));
+        return true;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    const Slot* slot = findSlot(name, hash);
+    if (!slot || !readRecordHeader(slot->offset, recordName, dataOffset, dataSize)) return false;
+
+    // readRecordHeader leaves the file positioned at the start of the data.
+    data.resize(size_t(dataSize));
+    size_t total = 0;
+    while (total<data.size())
+    {
+        ssize_t numRead = vpb::read(_readFileID, &data[total], data.size()-total);
+        if (numRead<=0) return false;
+        total += numRead;
+    }
+    return true;
+}
+
+bool TileContainer::writeFile(const std::string& filename, const std::string& data) const
+{
+    std::string name = getContainedName(filename);
+    uint64_t hash = hashBytes(name);
+
+    std::string header;
+    BinaryWriter w(header);
+    w.write(static_cast<uint32_t>(name.size()));
+    w.write(static_cast<uint32_t>(0));
+    w.write(static_cast<uint64_t>(data.size()));
+    w.write(hashBytes(data));
+    header.append(name);
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (!_dataFile)
+    {
+        log(osg::WARN,"Error: TileContainer::writeFile(%s) container not open for writing.",filename.c_str());
+        return false;
+    }
+
+    uint64_t offset = _dataSize;
+
+    bool ok = fwrite(header.data(), 1, header.size(), _dataFile)==header.size() &&
+              (data.empty() || fwrite(data.data(), 1, data.size(), _dataFile)==data.size());
+    if (!ok)
+    {
+        // the end of the file is now unknown, so stop appending, reopening discards the incomplete record.
+        log(osg::WARN,"Error: TileContainer::writeFile(%s) unable to append to %s.",filename.c_str(),_filename.c_str());
+        vpb::fclose(_dataFile);
+        _dataFile = 0;
+        return false;
+    }
+
+    _dataSize += header.size() + data.size();
+
+    Slot* slot = const_cast<Slot*>(findSlot(name, hash));
+    if (slot)
+    {
+        slot->offset = offset;
+    }
+    else
+    {
+        if ((_numFiles+1)*2>_slots.size()) rehash(_slots.size()*2);
+        insertSlot(hash, offset);
+        ++_numFiles;
+    }
+
+    return true;
+}
+
+bool TileContainer::merge(const TileContainer& source)
+{
+    FileNameList fileNames;
+    source.getFileNames(fileNames);
+
+    for(FileNameList::const_iterator itr = fileNames.begin();
+        itr != fileNames.end();
+        ++itr)
+    {
+        std::string data;
+        if (!source.readFile(*itr, data) || !writeFile(*itr, data)) return false;
+    }
+
+    std::string masterFileName = source.getMasterFileName();
+    if (!masterFileName.empty())
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_masterFileName.empty()) _masterFileName = masterFileName;
+    }
+
+    return true;
+}
+
+static osgDB::ReaderWriter::ReadResult readObjectFromStream(osgDB::ReaderWriter* rw, std::istream& fin, const osgDB::Options* options) { return rw->readObject(fin, options); }
+static osgDB::ReaderWriter::ReadResult readImageFromStream(osgDB::ReaderWriter* rw, std::istream& fin, const osgDB::Options* options) { return rw->readImage(fin, options); }
+static osgDB::ReaderWriter::ReadResult readHeightFieldFromStream(osgDB::ReaderWriter* rw, std::istream& fin, const osgDB::Options* options) { return rw->readHeightField(fin, options); }
+static osgDB::ReaderWriter::ReadResult readNodeFromStream(osgDB::ReaderWriter* rw, std::istream& fin, const osgDB::Options* options) { return rw->readNode(fin, options); }
+
+osgDB::ReaderWriter::ReadResult TileContainer::read(ReadFunction function, const std::string& filename, const Options* options) const
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+    if (!rw) return ReadResult::FILE_NOT_HANDLED;
+
+    std::string data;
+    if (!readFile(filename, data)) return ReadResult::FILE_NOT_FOUND;
+
+    std::istringstream fin(data, std::ios::in | std::ios::binary);
+    return function(rw, fin, options);
+}
+
+osgDB::ReaderWriter::ReadResult TileContainer::readObject(const std::string& filename, const Options* options) const
+{
+    return read(readObjectFromStream, filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TileContainer::readImage(const std::string& filename, const Options* options) const
+{
+    return read(readImageFromStream, filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TileContainer::readHeightField(const std::string& filename, const Options* options) const
+{
+    return read(readHeightFieldFromStream, filename, options);
+}
+
+osgDB::ReaderWriter::ReadResult TileContainer::readNode(const std::string& filename, const Options* options) const
+{
+    return read(readNodeFromStream, filename, options);
+}
+
+static osgDB::ReaderWriter::WriteResult writeObjectToStream(osgDB::ReaderWriter* rw, const osg::Object& obj, std::ostream& fout, const osgDB::Options* options) { return rw->writeObject(obj, fout, options); }
+static osgDB::ReaderWriter::WriteResult writeImageToStream(osgDB::ReaderWriter* rw, const osg::Object& obj, std::ostream& fout, const osgDB::Options* options) { return rw->writeImage(static_cast<const osg::Image&>(obj), fout, options); }
+static osgDB::ReaderWriter::WriteResult writeHeightFieldToStream(osgDB::ReaderWriter* rw, const osg::Object& obj, std::ostream& fout, const osgDB::Options* options) { return rw->writeHeightField(static_cast<const osg::HeightField&>(obj), fout, options); }
+static osgDB::ReaderWriter::WriteResult writeNodeToStream(osgDB::ReaderWriter* rw, const osg::Object& obj, std::ostream& fout, const osgDB::Options* options) { return rw->writeNode(static_cast<const osg::Node&>(obj), fout, options); }
+
+osgDB::ReaderWriter::WriteResult TileContainer::write(WriteFunction function, const osg::Object& obj, const std::string& filename, const Options* options) const
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension(osgDB::getLowerCaseFileExtension(filename));
+    if (!rw) return WriteResult::FILE_NOT_HANDLED;
+
+    // serialize before taking the lock so that concurrent writes only serialize the append.
+    std::ostringstream fout(std::ios::out | std::ios::binary);
+    WriteResult result = function(rw, obj, fout, options);
+    if (!result.success()) return result;
+
+    if (!writeFile(filename, fout.str())) return WriteResult::ERROR_IN_WRITING_FILE;
+
+    return WriteResult::FILE_SAVED;
+}
+
+osgDB::ReaderWriter::WriteResult TileContainer::writeObject(const osg::Object& obj, const std::string& filename, const Options* options) const
+{
+    return write(writeObjectToStream, obj, filename, options);
+}
+
+osgDB::ReaderWriter::WriteResult TileContainer::writeImage(const osg::Image& image, const std::string& filename, const Options* options) const
+{
+    return write(writeImageToStream, image, filename, options);
+}
+
+osgDB::ReaderWriter::WriteResult TileContainer::writeHeightField(const osg::HeightField& heightField, const std::string& filename, const Options* options) const
+{
+    return write(writeHeightFieldToStream, heightField, filename, options);
+}
+
+osgDB::ReaderWriter::WriteResult TileContainer::writeNode(const osg::Node& node, const std::string& filename, const Options* options) const
+{
+    WriteResult result = write(writeNodeToStream, node, filename, options);
+    if (result.success())
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (_masterFileName.empty()) _masterFileName = getContainedName(filename);
+    }
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  TileContainerReaderWriter
+//
+
+class TileContainerReaderWriter : public osgDB::ReaderWriter
+{
+    public:
+
+        TileContainerReaderWriter()
+        {
+            supportsExtension("vpbc","VirtualPlanetBuilder tile container");
+
+            // route reads of "<container>.vpbc/<file>" through openArchive.
+            osgDB::Registry::instance()->addArchiveExtension("vpbc");
+        }
+
+        virtual const char* className() const { return "VPB TileContainer Reader/Writer"; }
+
+        virtual bool acceptsExtension(const std::string& extension) const
+        {
+            return osgDB::equalCaseInsensitive(extension,"vpbc");
+        }
+
+        virtual ReadResult openArchive(const std::string& file, ArchiveStatus status, unsigned int /*indexBlockSizeHint*/, const Options* options) const
+        {
+            std::string ext = osgDB::getFileExtension(file);
+            if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+
+            std::string fileName = file;
+            if (status==READ)
+            {
+                fileName = osgDB::findDataFile(file, options);
+                if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+            }
+
+            osg::ref_ptr<TileContainer> container = new TileContainer;
+            if (!container->open(fileName, status)) return ReadResult::ERROR_IN_READING_FILE;
+
+            return container.get();
+        }
+
+        virtual ReadResult readNode(const std::string& file, const Options* options) const
+        {
+            std::string ext = osgDB::getFileExtension(file);
+            if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+
+            std::string fileName = osgDB::findDataFile(file, options);
+            if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+
+            // the files within are found relative to the container, as though it were a directory.
+            osg::ref_ptr<Options> local_options = options ? static_cast<Options*>(options->clone(osg::CopyOp::SHALLOW_COPY)) : new Options;
+            local_options->setDatabasePath(fileName);
+
+            ReadResult result = osgDB::Registry::instance()->openArchive(fileName, osgDB::Archive::READ, 4096, local_options.get());
+            if (!result.validArchive()) return result;
+
+            osgDB::Archive* archive = result.getArchive();
+            return archive->readNode(archive->getMasterFileName(), local_options.get());
+        }
+};
+
+// now register with Registry to instantiate the above
+// reader/writer.
+REGISTER_OSGPLUGIN(vpbc, TileContainerReaderWriter)
@@ -0,0 +1,102 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/TileIndex>
+
+using namespace vpb;
+
+static inline uint64_t spreadBits(uint64_t v)
+{
+    v &= 0x1fffffffull;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+    v = (v | (v << 8))  & 0x00ff00ff00ff00ffull;
+    v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0full;
+    v = (v | (v << 2))  & 0x3333333333333333ull;
+    v = (v | (v << 1))  & 0x5555555555555555ull;
+    return v;
+}
+
+uint64_t TileIndex::computeMortonCode(unsigned int X, unsigned int Y)
+{
+    return spreadBits(X) | (spreadBits(Y) << 1);
+}
+
+TileIndex::TileIndex():
+    _size(0),
+    _shift(64)
+{
+}
+
+void TileIndex::clear()
+{
+    _entries.clear();
+    _size = 0;
+    _shift = 64;
+}
+
+void TileIndex::rehash(unsigned int capacity)
+{
+    Entries previous;
+    previous.swap(_entries);
+
+    _entries.resize(capacity);
+    _shift = 64;
+    for(unsigned int c=capacity; c>1; c>>=1) --_shift;
+    _size = 0;
+
+    for(Entries::iterator itr = previous.begin();
+        itr != previous.end();
+        ++itr)
+    {
+        if (itr->key==EMPTY_KEY) continue;
+
+        unsigned int mask = capacity-1;
+        unsigned int i = bucket(itr->key);
+        while (_entries[i].key!=EMPTY_KEY) i = (i+1) & mask;
+        _entries[i] = *itr;
+        ++_size;
+    }
+}
+
+void TileIndex::insert(unsigned int level, unsigned int X, unsigned int Y, CompositeDestination* tile)
+{
+    // keep the load factor at or below a half so probe sequences stay short.
+    if ((_size+1)*2 > _entries.size()) rehash(_entries.empty() ? 64 : _entries.size()*2);
+
+    uint64_t key = computeKey(level,X,Y);
+    unsigned int mask = _entries.size()-1;
+    unsigned int i = bucket(key);
+    while (_entries[i].key!=EMPTY_KEY && _entries[i].key!=key) i = (i+1) & mask;
+
+    if (_entries[i].key==EMPTY_KEY)
+    {
+        _entries[i].key = key;
+        ++_size;
+    }
+    _entries[i].tile = tile;
+}
+
+CompositeDestination* TileIndex::find(unsigned int level, unsigned int X, unsigned int Y) const
+{
+    if (_entries.empty()) return 0;
+
+    uint64_t key = computeKey(level,X,Y);
+    unsigned int mask = _entries.size()-1;
+    unsigned int i = bucket(key);
+    while (_entries[i].key!=EMPTY_KEY)
+    {
+        if (_entries[i].key==key) return _entries[i].tile;
+        i = (i+1) & mask;
+    }
+    return 0;
+}
@@ -0,0 +1,253 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/Trace>
+#include <vpb/BuildLog>
+
+#include <OpenThreads/ScopedLock>
+
+#include <osgDB/fstream>
+
+#include <iomanip>
+#include <sstream>
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+    #include <sys/timeb.h>
+#else
+    #include <sys/time.h>
+#endif
+
+using namespace vpb;
+
+bool Trace::s_enabled = false;
+
+/** Return the wall clock time in seconds since the epoch, used to align the traces of different processes.*/
+static double getEpochTime()
+{
+#if defined(WIN32) && !defined(__CYGWIN__)
+    struct _timeb tb;
+    _ftime(&tb);
+    return double(tb.time) + double(tb.millitm)*0.001;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return double(tv.tv_sec) + double(tv.tv_usec)*0.000001;
+#endif
+}
+
+static std::string escapeJSON(const std::string& str)
+{
+    std::string result;
+    for(std::string::const_iterator itr = str.begin(); itr != str.end(); ++itr)
+    {
+        switch(*itr)
+        {
+            case('"'): result += "\\\""; break;
+            case('\\'): result += "\\\\"; break;
+            case('\n'): result += "\\n"; break;
+            case('\t'): result += "\\t"; break;
+            default: if (static_cast<unsigned char>(*itr)>=32) result.push_back(*itr); break;
+        }
+    }
+    return result;
+}
+
+Trace::Trace():
+    _processName("osgdem"),
+    _startTick(osg::Timer::instance()->tick()),
+    _startEpochTime(getEpochTime())
+{
+}
+
+Trace::~Trace()
+{
+}
+
+Trace* Trace::instance()
+{
+    static osg::ref_ptr<Trace> s_trace = new Trace;
+    return s_trace.get();
+}
+
+void Trace::setEnabled(bool enabled)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (enabled && !s_enabled)
+    {
+        _startTick = osg::Timer::instance()->tick();
+        _startEpochTime = getEpochTime();
+    }
+
+    s_enabled = enabled;
+}
+
+void Trace::addSpan(const char* name, double startTime, double endTime, int level, int x, int y, const std::string& detail)
+{
+    OpenThreads::Thread* thread = OpenThreads::Thread::CurrentThread();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    // threads are numbered in the order they first record a span, the main thread isn't an OpenThreads::Thread so is 0.
+    unsigned int threadIndex = 0;
+    if (thread)
+    {
+        ThreadIndexMap::iterator itr = _threadIndexMap.find(thread);
+        if (itr != _threadIndexMap.end()) threadIndex = itr->second;
+        else
+        {
+            threadIndex = _threadIndexMap.size()+1;
+            _threadIndexMap[thread] = threadIndex;
+        }
+    }
+
+    _spans.push_back(Span());
+    Span& span = _spans.back();
+    span.name = name;
+    span.startTime = startTime;
+    span.endTime = endTime;
+    span.level = level;
+    span.x = x;
+    span.y = y;
+    span.thread = threadIndex;
+    span.detail = detail;
+}
+
+unsigned int Trace::getNumSpans() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _spans.size();
+}
+
+void Trace::clear()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _spans.clear();
+    _threadIndexMap.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Trace files are written with one event per line so that merge() can combine files and
+// renumber their process ids without a JSON parser:
+//
+//   {"traceEvents":[
+//   {"name":"process_name","ph":"M","pid":1,"tid":0,"args":{"name":"<process>"}},
+//   {"name":"<span>","cat":"vpb","ph":"X","ts":<us>,"dur":<us>,"pid":1,"tid":<thread>,"args":{...}},
+//   ],
+//   "displayTimeUnit":"ms"}
+//
+// Timestamps are microseconds since the epoch.
+//
+bool Trace::write(const std::string& filename) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    osgDB::ofstream fout(filename.c_str());
+    if (!fout)
+    {
+        log(osg::WARN, "Error: unable to open trace file %s for writing.",filename.c_str());
+        return false;
+    }
+
+    fout.setf(std::ios::fixed, std::ios::floatfield);
+    fout.precision(1);
+
+    fout<<"{\"traceEvents\":["<<std::endl;
+    fout<<"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\""<<escapeJSON(_processName)<<"\"}}";
+
+    fout<<","<<std::endl<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}";
+    for(unsigned int i=1; i<=_threadIndexMap.size(); ++i)
+    {
+        fout<<","<<std::endl<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"<<i<<",\"args\":{\"name\":\"thread "<<i<<"\"}}";
+    }
+
+    for(Spans::const_iterator itr = _spans.begin();
+        itr != _spans.end();
+        ++itr)
+    {
+        const Span& span = *itr;
+        fout<<","<<std::endl;
+        fout<<"{\"name\":\""<<span.name<<"\",\"cat\":\"vpb\",\"ph\":\"X\"";
+        fout<<",\"ts\":"<<(_startEpochTime+span.startTime)*1000000.0;
+        fout<<",\"dur\":"<<(span.endTime-span.startTime)*1000000.0;
+        fout<<",\"pid\":1,\"tid\":"<<span.thread<<",\"args\":{";
+
+        bool needComma = false;
+        if (span.level>=0)
+        {
+            fout<<"\"level\":"<<span.level<<",\"x\":"<<span.x<<",\"y\":"<<span.y;
+            needComma = true;
+        }
+        if (!span.detail.empty())
+        {
+            if (needComma) fout<<",";
+            fout<<"\"detail\":\""<<escapeJSON(span.detail)<<"\"";
+        }
+        fout<<"}}";
+    }
+
+    fout<<std::endl<<"],"<<std::endl;
+    fout<<"\"displayTimeUnit\":\"ms\"}"<<std::endl;
+
+    return !fout.fail();
+}
+
+bool Trace::merge(const std::vector<std::string>& filenames, const std::string& filename)
+{
+    osgDB::ofstream fout(filename.c_str());
+    if (!fout)
+    {
+        log(osg::WARN, "Error: unable to open trace file %s for writing.",filename.c_str());
+        return false;
+    }
+
+    fout<<"{\"traceEvents\":[";
+
+    bool firstEvent = true;
+    for(unsigned int i=0; i<filenames.size(); ++i)
+    {
+        osgDB::ifstream fin(filenames[i].c_str());
+        if (!fin)
+        {
+            log(osg::WARN, "Warning: unable to read trace file %s, leaving it out of %s.",filenames[i].c_str(),filename.c_str());
+            continue;
+        }
+
+        std::ostringstream pid;
+        pid<<"\"pid\":"<<(i+1)<<",";
+
+        std::string line;
+        while(std::getline(fin, line))
+        {
+            if (line.compare(0, 8, "{\"name\":")!=0) continue;
+
+            if (!line.empty() && line[line.size()-1]==',') line.erase(line.size()-1);
+
+            std::string::size_type start = line.find("\"pid\":");
+            if (start==std::string::npos) continue;
+            std::string::size_type end = line.find(',', start);
+            if (end==std::string::npos) continue;
+            line.replace(start, end-start+1, pid.str());
+
+            if (!firstEvent) fout<<",";
+            fout<<std::endl<<line;
+            firstEvent = false;
+        }
+    }
+
+    fout<<std::endl<<"],"<<std::endl;
+    fout<<"\"displayTimeUnit\":\"ms\"}"<<std::endl;
+
+    return !fout.fail();
+}
@@ -0,0 +1,339 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/VertexCacheOptimizer>
+#include <vpb/GridIndexCache>
+
+#include <algorithm>
+#include <deque>
+
+using namespace vpb;
+
+namespace VertexCacheOptimizerUtils
+{
+
+/** Reorders the elements of per vertex arrays, remap[oldIndex] = newIndex.  With checkOnly set arrays are
+  * left unchanged and just recorded as unhandled when they are of a type that can't be reordered.*/
+class RemapArray : public osg::ArrayVisitor
+{
+    public:
+
+        RemapArray(const VertexCacheOptimizer::IndexList& remap, bool checkOnly=false):
+            _remap(remap),
+            _checkOnly(checkOnly),
+            _unhandled(false) {}
+
+        template<class A>
+        void remap(A& array)
+        {
+            if (_checkOnly || array.size()!=_remap.size()) return;
+
+            std::vector<typename A::ElementDataType> original(array.begin(), array.end());
+            for(unsigned int i=0; i<original.size(); ++i)
+            {
+                array[_remap[i]] = original[i];
+            }
+            array.dirty();
+        }
+
+        virtual void apply(osg::Array&) { _unhandled = true; }
+        virtual void apply(osg::ByteArray& array) { remap(array); }
+        virtual void apply(osg::ShortArray& array) { remap(array); }
+        virtual void apply(osg::IntArray& array) { remap(array); }
+        virtual void apply(osg::UByteArray& array) { remap(array); }
+        virtual void apply(osg::UShortArray& array) { remap(array); }
+        virtual void apply(osg::UIntArray& array) { remap(array); }
+        virtual void apply(osg::FloatArray& array) { remap(array); }
+        virtual void apply(osg::DoubleArray& array) { remap(array); }
+        virtual void apply(osg::Vec2Array& array) { remap(array); }
+        virtual void apply(osg::Vec3Array& array) { remap(array); }
+        virtual void apply(osg::Vec4Array& array) { remap(array); }
+        virtual void apply(osg::Vec4ubArray& array) { remap(array); }
+        virtual void apply(osg::Vec2bArray& array) { remap(array); }
+        virtual void apply(osg::Vec3bArray& array) { remap(array); }
+        virtual void apply(osg::Vec4bArray& array) { remap(array); }
+        virtual void apply(osg::Vec2sArray& array) { remap(array); }
+        virtual void apply(osg::Vec3sArray& array) { remap(array); }
+        virtual void apply(osg::Vec4sArray& array) { remap(array); }
+        virtual void apply(osg::Vec2dArray& array) { remap(array); }
+        virtual void apply(osg::Vec3dArray& array) { remap(array); }
+        virtual void apply(osg::Vec4dArray& array) { remap(array); }
+
+        const VertexCacheOptimizer::IndexList& _remap;
+        bool                                   _checkOnly;
+        bool                                   _unhandled;
+
+    protected:
+
+        RemapArray& operator = (const RemapArray&) { return *this; }
+};
+
+typedef std::vector<osg::Array*> ArrayList;
+
+/** Collect the arrays of geometry with an element per vertex, each array only once as texture coordinate
+  * and vertex attribute arrays may be shared.*/
+void getPerVertexArrays(osg::Geometry& geometry, unsigned int numVertices, ArrayList& arrays)
+{
+    ArrayList candidates;
+    candidates.push_back(geometry.getVertexArray());
+    if (geometry.getNormalBinding()==osg::Geometry::BIND_PER_VERTEX) candidates.push_back(geometry.getNormalArray());
+    if (geometry.getColorBinding()==osg::Geometry::BIND_PER_VERTEX) candidates.push_back(geometry.getColorArray());
+    if (geometry.getSecondaryColorBinding()==osg::Geometry::BIND_PER_VERTEX) candidates.push_back(geometry.getSecondaryColorArray());
+    if (geometry.getFogCoordBinding()==osg::Geometry::BIND_PER_VERTEX) candidates.push_back(geometry.getFogCoordArray());
+    for(unsigned int unit=0; unit<geometry.getNumTexCoordArrays(); ++unit)
+    {
+        candidates.push_back(geometry.getTexCoordArray(unit));
+    }
+    for(unsigned int index=0; index<geometry.getNumVertexAttribArrays(); ++index)
+    {
+        if (geometry.getVertexAttribBinding(index)==osg::Geometry::BIND_PER_VERTEX) candidates.push_back(geometry.getVertexAttribArray(index));
+    }
+
+    arrays.clear();
+    for(ArrayList::iterator itr = candidates.begin(); itr != candidates.end(); ++itr)
+    {
+        osg::Array* array = *itr;
+        if (array && array->getNumElements()==numVertices && std::find(arrays.begin(), arrays.end(), array)==arrays.end())
+        {
+            arrays.push_back(array);
+        }
+    }
+}
+
+}
+
+VertexCacheOptimizer::VertexCacheOptimizer(unsigned int cacheSize):
+    _cacheSize(cacheSize)
+{
+}
+
+void VertexCacheOptimizer::optimizeTriangleOrder(IndexList& triangles, unsigned int numVertices) const
+{
+    unsigned int numTriangles = triangles.size()/3;
+    if (numTriangles<2 || numVertices==0) return;
+
+    // triangles adjacent to each vertex, stored as offsets into a single list.
+    IndexList live(numVertices, 0);
+    for(unsigned int i=0; i<numTriangles*3; ++i)
+    {
+        ++live[triangles[i]];
+    }
+
+    IndexList offsets(numVertices+1, 0);
+    for(unsigned int v=0; v<numVertices; ++v)
+    {
+        offsets[v+1] = offsets[v] + live[v];
+    }
+
+    IndexList adjacency(offsets[numVertices]);
+    IndexList fill(offsets.begin(), offsets.end()-1);
+    for(unsigned int t=0; t<numTriangles; ++t)
+    {
+        for(unsigned int k=0; k<3; ++k)
+        {
+            adjacency[fill[triangles[t*3+k]]++] = t;
+        }
+    }
+
+    // Tipsify, fan out from the current vertex then move on to the candidate that's most recently
+    // in the cache but won't be pushed out by emitting its remaining triangles.
+    IndexList output;
+    output.reserve(numTriangles*3);
+
+    std::vector<int> cacheTime(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    IndexList deadEnd;
+    IndexList candidates;
+
+    int time = _cacheSize+1;
+    unsigned int cursor = 0;
+    int fanningVertex = 0;
+
+    while(fanningVertex>=0)
+    {
+        candidates.clear();
+        for(unsigned int a=offsets[fanningVertex]; a<offsets[fanningVertex+1]; ++a)
+        {
+            unsigned int t = adjacency[a];
+            if (emitted[t]) continue;
+
+            for(unsigned int k=0; k<3; ++k)
+            {
+                unsigned int v = triangles[t*3+k];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time-cacheTime[v]>int(_cacheSize))
+                {
+                    cacheTime[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // next vertex from the candidates.
+        int nextVertex = -1;
+        int bestPriority = -1;
+        for(IndexList::iterator itr = candidates.begin();
+            itr != candidates.end();
+            ++itr)
+        {
+            unsigned int v = *itr;
+            if (live[v]==0) continue;
+
+            int priority = 0;
+            if (time-cacheTime[v]+2*int(live[v])<=int(_cacheSize)) priority = time-cacheTime[v];
+            if (priority>bestPriority)
+            {
+                bestPriority = priority;
+                nextVertex = v;
+            }
+        }
+
+        // otherwise back track through the recently used vertices, then on to any vertex with triangles left.
+        while(nextVertex<0 && !deadEnd.empty())
+        {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v]>0) nextVertex = v;
+        }
+        while(nextVertex<0 && cursor<numVertices)
+        {
+            if (live[cursor]>0) nextVertex = cursor;
+            ++cursor;
+        }
+
+        fanningVertex = nextVertex;
+    }
+
+    triangles.swap(output);
+}
+
+void VertexCacheOptimizer::computeVertexOrder(const IndexList& triangles, unsigned int numVertices, IndexList& remap)
+{
+    remap.assign(numVertices, numVertices);
+
+    unsigned int next = 0;
+    for(IndexList::const_iterator itr = triangles.begin();
+        itr != triangles.end();
+        ++itr)
+    {
+        if (remap[*itr]==numVertices) remap[*itr] = next++;
+    }
+
+    for(unsigned int v=0; v<numVertices; ++v)
+    {
+        if (remap[v]==numVertices) remap[v] = next++;
+    }
+}
+
+double VertexCacheOptimizer::computeACMR(const IndexList& triangles) const
+{
+    unsigned int numTriangles = triangles.size()/3;
+    if (numTriangles==0) return 0.0;
+
+    std::deque<unsigned int> cache;
+    unsigned int misses = 0;
+    for(unsigned int i=0; i<numTriangles*3; ++i)
+    {
+        if (std::find(cache.begin(), cache.end(), triangles[i])!=cache.end()) continue;
+
+        ++misses;
+        cache.push_back(triangles[i]);
+        if (cache.size()>_cacheSize) cache.pop_front();
+    }
+
+    return double(misses)/double(numTriangles);
+}
+
+bool VertexCacheOptimizer::optimize(osg::Geometry& geometry, Statistics& statistics) const
+{
+    osg::Array* vertices = geometry.getVertexArray();
+    if (!vertices || !geometry.suitableForOptimization()) return false;
+
+    unsigned int numVertices = vertices->getNumElements();
+
+    bool allDrawElements = true;
+    IndexList allTriangles;
+
+    osg::Geometry::PrimitiveSetList& primitives = geometry.getPrimitiveSetList();
+    for(osg::Geometry::PrimitiveSetList::iterator itr = primitives.begin();
+        itr != primitives.end();
+        ++itr)
+    {
+        osg::DrawElements* drawElements = dynamic_cast<osg::DrawElements*>(itr->get());
+        if (!drawElements)
+        {
+            allDrawElements = false;
+            continue;
+        }
+
+        if (drawElements->getMode()!=GL_TRIANGLES || drawElements->getNumIndices()<6) continue;
+
+        IndexList triangles(drawElements->getNumIndices());
+        for(unsigned int i=0; i<triangles.size(); ++i)
+        {
+            triangles[i] = drawElements->index(i);
+        }
+
+        double acmrBefore = computeACMR(triangles);
+        optimizeTriangleOrder(triangles, numVertices);
+        statistics.add(triangles.size()/3, acmrBefore, computeACMR(triangles));
+
+        allTriangles.insert(allTriangles.end(), triangles.begin(), triangles.end());
+        *itr = GridIndexCache::createDrawElements(GL_TRIANGLES, triangles);
+    }
+
+    if (allTriangles.empty()) return false;
+
+    if (!allDrawElements) return true;
+
+    // only reorder the vertices when every per vertex array can be reordered with them.
+    VertexCacheOptimizerUtils::ArrayList arrays;
+    VertexCacheOptimizerUtils::getPerVertexArrays(geometry, numVertices, arrays);
+
+    IndexList remap;
+    VertexCacheOptimizerUtils::RemapArray checkArray(remap, true);
+    for(VertexCacheOptimizerUtils::ArrayList::iterator aitr = arrays.begin(); aitr != arrays.end(); ++aitr)
+    {
+        (*aitr)->accept(checkArray);
+    }
+    if (checkArray._unhandled) return true;
+
+    // reorder the vertices by first use, so the vertex fetches of consecutive triangles are close together.
+    computeVertexOrder(allTriangles, numVertices, remap);
+
+    for(osg::Geometry::PrimitiveSetList::iterator itr = primitives.begin();
+        itr != primitives.end();
+        ++itr)
+    {
+        osg::DrawElements* drawElements = static_cast<osg::DrawElements*>(itr->get());
+        IndexList indices(drawElements->getNumIndices());
+        for(unsigned int i=0; i<indices.size(); ++i)
+        {
+            indices[i] = remap[drawElements->index(i)];
+        }
+        *itr = GridIndexCache::createDrawElements(drawElements->getMode(), indices);
+    }
+
+    VertexCacheOptimizerUtils::RemapArray remapArray(remap);
+    for(VertexCacheOptimizerUtils::ArrayList::iterator aitr = arrays.begin(); aitr != arrays.end(); ++aitr)
+    {
+        (*aitr)->accept(remapArray);
+    }
+
+    geometry.dirtyDisplayList();
+
+    return true;
+}
@@ -0,0 +1,288 @@
+/* -*-c++-*- VirtualPlanetBuilder - Copyright (C) 1998-2009 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <vpb/WriteQueue>
+#include <vpb/FileUtils>
+#include <vpb/FilePathManager>
+#include <vpb/BuildLog>
+#include <vpb/MemoryTracker>
+
+#include <osgDB/FileNameUtils>
+
+#include <set>
+#include <sstream>
+
+using namespace vpb;
+
+/** maximum number of files an I/O thread takes from the queue at once, the files of a batch share one sync pass.*/
+static const unsigned int s_maximumBatchSize = 16;
+
+WriteQueue::WriteQueue(unsigned int numThreads, double maximumQueuedBytes, bool syncWrites):
+    _numThreads(numThreads>0 ? numThreads : 1),
+    _maximumQueuedBytes(maximumQueuedBytes),
+    _syncWrites(syncWrites),
+    _queuedBytes(0),
+    _numInProgress(0),
+    _done(false)
+{
+}
+
+WriteQueue::~WriteQueue()
+{
+    stopThreads();
+}
+
+void WriteQueue::startThreads()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (!_threads.empty()) return;
+
+    _done = false;
+    for(unsigned int i=0; i<_numThreads; ++i)
+    {
+        IOThread* thread = new IOThread(this);
+        thread->startThread();
+        _threads.push_back(thread);
+    }
+}
+
+void WriteQueue::stopThreads()
+{
+    Threads threads;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _done = true;
+        _entriesAvailable.broadcast();
+        threads.swap(_threads);
+    }
+
+    // the threads only exit once the queue is empty so joining them flushes everything queued.
+    for(Threads::iterator itr = threads.begin();
+        itr != threads.end();
+        ++itr)
+    {
+        (*itr)->join();
+        delete *itr;
+    }
+}
+
+void WriteQueue::write(const std::string& filename, std::string& buffer)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    // always accept a file when nothing is queued so a single file larger than the budget can't deadlock.
+    if (_queuedBytes>0 && _queuedBytes+double(buffer.size())>_maximumQueuedBytes)
+    {
+        ++_statistics.numBlockedWrites;
+        while (_queuedBytes>0 && _queuedBytes+double(buffer.size())>_maximumQueuedBytes)
+        {
+            _spaceAvailable.wait(&_mutex);
+        }
+    }
+
+    _entries.push_back(Entry());
+    Entry& entry = _entries.back();
+    entry.filename = filename;
+    entry.buffer.swap(buffer);
+    entry.queued = osg::Timer::instance()->tick();
+
+    _queuedBytes += double(entry.buffer.size());
+    MemoryTracker::instance()->allocated(MemoryTracker::WRITE_QUEUE, double(entry.buffer.size()));
+
+    if (_entries.size()>_statistics.maxQueueDepth) _statistics.maxQueueDepth = _entries.size();
+    if (_queuedBytes>_statistics.maxQueuedBytes) _statistics.maxQueuedBytes = _queuedBytes;
+
+    _entriesAvailable.signal();
+}
+
+void WriteQueue::flush()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    while (!_entries.empty() || _numInProgress>0)
+    {
+        _allWritten.wait(&_mutex);
+    }
+}
+
+WriteQueue::Statistics WriteQueue::getStatistics() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _statistics;
+}
+
+bool WriteQueue::takeBatch(Entries& batch, unsigned int maxNumEntries)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    while (_entries.empty())
+    {
+        if (_done) return false;
+        _entriesAvailable.wait(&_mutex);
+    }
+
+    while (!_entries.empty() && batch.size()<maxNumEntries)
+    {
+        batch.push_back(Entry());
+        batch.back().filename.swap(_entries.front().filename);
+        batch.back().buffer.swap(_entries.front().buffer);
+        batch.back().queued = _entries.front().queued;
+        _entries.pop_front();
+    }
+
+    _numInProgress += batch.size();
+
+    return true;
+}
+
+void WriteQueue::IOThread::run()
+{
+    Entries batch;
+    while (_queue->takeBatch(batch, s_maximumBatchSize))
+    {
+        _queue->writeBatch(batch);
+        batch.clear();
+    }
+}
+
+static std::string getTemporaryFileName(const std::string& filename)
+{
+    std::ostringstream str;
+    str<<filename<<".tmp."<<vpb::getpid();
+    return str.str();
+}
+
+void WriteQueue::writeBatch(Entries& batch)
+{
+    std::vector<bool> succeeded(batch.size(), false);
+    std::vector<bool> existed(batch.size(), false);
+    std::vector<FILE*> files(batch.size(), (FILE*)0);
+
+    // write out all the files of the batch before syncing any, so the OS can write them back together.
+    for(unsigned int i=0; i<batch.size(); ++i)
+    {
+        Entry& entry = batch[i];
+        std::string tmpFileName = getTemporaryFileName(entry.filename);
+
+        FILE* fp = vpb::fopen(tmpFileName.c_str(), "wb");
+        if (!fp)
+        {
+            // the directory may not exist yet, create it and try once more.
+            if (FilePathManager::instance()->checkWritePermissionAndEnsurePathAvailability(entry.filename))
+            {
+                fp = vpb::fopen(tmpFileName.c_str(), "wb");
+            }
+        }
+
+        if (!fp)
+        {
+            log(osg::WARN,"Error: unable to open temporary file '%s' for writing.",tmpFileName.c_str());
+            if (_callback.valid()) _callback->failed(entry.filename, "unable to open temporary file");
+            continue;
+        }
+
+        bool ok = entry.buffer.empty() || fwrite(entry.buffer.data(), 1, entry.buffer.size(), fp)==entry.buffer.size();
+        ok = (fflush(fp)==0) && ok;
+
+        if (!ok)
+        {
+            vpb::fclose(fp);
+            log(osg::WARN,"Error: unable to write temporary file '%s'.",tmpFileName.c_str());
+            remove(tmpFileName.c_str());
+            if (_callback.valid()) _callback->failed(entry.filename, "unable to write temporary file");
+            continue;
+        }
+
+        files[i] = fp;
+        succeeded[i] = true;
+    }
+
+    // then sync the whole batch in one pass.
+    for(unsigned int i=0; i<batch.size(); ++i)
+    {
+        if (!files[i]) continue;
+        if (_syncWrites) vpb::fsync(fileno(files[i]));
+        vpb::fclose(files[i]);
+    }
+
+    // rename only once every file of the batch is complete, so that with syncing enabled no file becomes
+    // visible before its contents are on disk.
+    std::set<std::string> directories;
+    for(unsigned int i=0; i<batch.size(); ++i)
+    {
+        if (!succeeded[i]) continue;
+
+        Entry& entry = batch[i];
+        std::string tmpFileName = getTemporaryFileName(entry.filename);
+
+        existed[i] = vpb::access(entry.filename.c_str(), F_OK)==0;
+
+        if (vpb::rename(tmpFileName.c_str(), entry.filename.c_str())!=0)
+        {
+            log(osg::WARN,"Error: unable to rename '%s' to '%s'.",tmpFileName.c_str(), entry.filename.c_str());
+            remove(tmpFileName.c_str());
+            succeeded[i] = false;
+            if (_callback.valid()) _callback->failed(entry.filename, "unable to rename temporary file");
+            continue;
+        }
+
+        if (_syncWrites) directories.insert(osgDB::getFilePath(entry.filename));
+    }
+
+    // the renames are only durable once the directories holding them are synced, once each per batch.
+    for(std::set<std::string>::iterator itr = directories.begin(); itr != directories.end(); ++itr)
+    {
+        if (vpb::syncDirectory(*itr)!=0) log(osg::INFO,"Warning: unable to sync directory '%s'.",itr->c_str());
+    }
+
+    for(unsigned int i=0; i<batch.size(); ++i)
+    {
+        if (succeeded[i] && _callback.valid()) _callback->written(batch[i].filename, existed[i]);
+    }
+
+    completed(batch, succeeded);
+}
+
+void WriteQueue::completed(const Entries& batch, const std::vector<bool>& succeeded)
+{
+    osg::Timer_t now = osg::Timer::instance()->tick();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    for(unsigned int i=0; i<batch.size(); ++i)
+    {
+        const Entry& entry = batch[i];
+
+        _queuedBytes -= double(entry.buffer.size());
+        MemoryTracker::instance()->released(MemoryTracker::WRITE_QUEUE, double(entry.buffer.size()));
+
+        if (succeeded[i])
+        {
+            double latency = osg::Timer::instance()->delta_s(entry.queued, now);
+
+            ++_statistics.numFiles;
+            _statistics.numBytes += double(entry.buffer.size());
+            _statistics.totalLatency += latency;
+            if (latency>_statistics.maxLatency) _statistics.maxLatency = latency;
+        }
+        else
+        {
+            ++_statistics.numFailed;
+        }
+    }
+
+    _numInProgress -= batch.size();
+
+    _spaceAvailable.broadcast();
+    if (_entries.empty() && _numInProgress==0) _allWritten.broadcast();
+}